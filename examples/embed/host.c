@@ -0,0 +1,90 @@
+// embeds libmaya next to a SIGSEGV handler of its own, like a host recovering from its own faults
+// would: vm stack overflows have to keep coming back as errors however many faults the host
+// handled in between, and the host's faults have to keep reaching its handler. `scons
+// embed-check` builds and runs it from the root of the repository.
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libmaya.h"
+
+static sigjmp_buf recover;
+static volatile sig_atomic_t recovering;
+static volatile sig_atomic_t faults;
+
+static void on_host_fault(int sig, siginfo_t* info, void* context) {
+    (void)sig;
+    (void)info;
+    (void)context;
+
+    if (!recovering) {
+        static const char message[] = "ERROR: a fault the host did not expect reached its handler\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+        _exit(EXIT_FAILURE);
+    }
+
+    faults++;
+    siglongjmp(recover, 1);
+}
+
+// touches a page the host protected itself, its handler recovers.
+static void host_fault(volatile uint8_t* page) {
+    recovering = 1;
+    if (sigsetjmp(recover, 1) == 0)
+        page[0] = 1;
+
+    recovering = 0;
+}
+
+int main(void) {
+    struct sigaction action = {0};
+    action.sa_sigaction = on_host_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+
+    uint8_t* page = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "ERROR: cannot map a page\n");
+        return EXIT_FAILURE;
+    }
+
+    MayaSetupError error;
+    MayaProgram* program = maya_program_load("overflow.maya", NULL, NULL, 0, &error);
+    if (program == NULL) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        return EXIT_FAILURE;
+    }
+
+    MayaVm* vm = maya_vm_create(program, 4096, &error);
+    if (vm == NULL) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        return EXIT_FAILURE;
+    }
+
+    for (int round = 0; round < 3; round++) {
+        MayaError result = maya_vm_run(vm, 0);
+        if (result != ERR_STACK_OVERFLOW) {
+            fprintf(stderr, "ERROR: round %d: expected a stack overflow, got %s\n", round, maya_error_to_str(result));
+            return EXIT_FAILURE;
+        }
+
+        maya_vm_reset(vm, program);
+        host_fault(page);
+    }
+
+    if (faults != 3) {
+        fprintf(stderr, "ERROR: the host handler recovered %d faults out of 3\n", (int)faults);
+        return EXIT_FAILURE;
+    }
+
+    maya_vm_destroy(vm);
+    maya_program_free(program);
+    munmap(page, (size_t)sysconf(_SC_PAGESIZE));
+
+    printf("3 vm overflows and 3 host faults handled\n");
+    return EXIT_SUCCESS;
+}
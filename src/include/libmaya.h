@@ -0,0 +1,60 @@
+#pragma once
+
+#include "maya.h"
+
+// embedding api, built as libmaya. a program is loaded, bound to its natives and verified once,
+// then shared read only by any number of vms on any number of threads. a vm is created once and
+// reset between runs. nothing here prints or exits: setup failures are described in a
+// MayaSetupError and runs return a MayaError, running out of memory included: the gc_* natives
+// then give a null pointer like alloc. the assembler, linker and profiler built into the archive
+// for the command line still exit when they fail, nothing reachable from this header calls them.
+//
+// stack overflows are caught on guard pages: the first vm created installs a SIGSEGV handler for
+// the whole process, which keeps the faults on a vm's guard pages and hands every other one to
+// the handler installed before it, or to the default action. a host with its own SIGSEGV handler
+// has to install it before creating the first vm, one installed later takes the vm's faults.
+typedef struct MayaProgram_t MayaProgram;
+
+#define MAYA_SLICE_QUANTUM 1024 // backward branches and calls run between two looks at the clock
+
+// natives is a NULL terminated array like `maya_natives` or NULL, its names shadow the ones of
+// the stdlib and of the native libraries given, and the array has to outlive the program.
+MayaProgram* maya_program_load(const char* filepath, const MayaNativeEntry* natives, const char** libraries,
+                               size_t libraries_size, MayaSetupError* error);
+void maya_program_free(MayaProgram* program);
+
+// a vm ready to run program from its entry, or to be reset to a program first when it is NULL.
+// stack_limit 0 picks MAYA_STACK_DEFAULT_LIMIT. the print natives write to a buffer read back
+// with maya_vm_output.
+MayaVm* maya_vm_create(const MayaProgram* program, size_t stack_limit, MayaSetupError* error);
+void maya_vm_destroy(MayaVm* maya);
+
+// back to the entry of program, which need not be the one the vm ran before: empty stacks,
+// zeroed registers, no output, and the gc heap and arena of the last run released.
+void maya_vm_reset(MayaVm* maya, const MayaProgram* program);
+
+// runs until halt, an error or budget backward branches and calls, whichever comes first, 0
+// runs without a budget. ERR_OUT_OF_FUEL suspends the program and the next maya_vm_run resumes
+// it; after any other error the vm has to be reset.
+MayaError maya_vm_run(MayaVm* maya, uint64_t budget);
+
+// maya_vm_run that also suspends the program once it ran for slice_ns nanoseconds, 0 leaves
+// the slice unlimited, so a host thread can take turns between many vms. the slice is checked at
+// the same points as the budget, every MAYA_SLICE_QUANTUM of them.
+MayaError maya_vm_run_slice(MayaVm* maya, uint64_t budget, uint64_t slice_ns);
+
+// what is left of the budget of the last run: 0 after ERR_OUT_OF_FUEL means the budget ran out,
+// anything else that the slice did.
+uint64_t maya_vm_fuel(const MayaVm* maya);
+bool maya_vm_halted(const MayaVm* maya);
+
+// arguments are pushed before the run, results popped after it. push fails on a full stack and
+// pop on an empty one.
+bool maya_vm_push(MayaVm* maya, Frame value);
+bool maya_vm_pop(MayaVm* maya, Frame* value);
+size_t maya_vm_depth(const MayaVm* maya);
+
+// everything printed since the last reset, not NUL terminated.
+const char* maya_vm_output(MayaVm* maya, size_t* size);
+
+const char* maya_error_to_str(MayaError error);
@@ -4,15 +4,18 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "sv.h"
 
-#define MAYA_STACK_CAP 1024
-#define MAYA_NATIVES_CAP 1024
+#define MAYA_STACK_DEFAULT_LIMIT (1 << 20) // in frames
+#define MAYA_STACK_MAX_LIMIT (1 << 28)
+#define MAYA_LIBRARIES_CAP 16 // native libraries loaded next to the stdlib
+#define MAYA_OUTPUT_CAP (1 << 16) // in bytes
 #define MAYA_REGISTERS_CAP 7
-#define MAYA_STACK_POINTER_REG 5
-#define MAYA_RETURN_VALUE_REG 6
-#define MAYA_OPERANDS_CAP 2
+#define MAYA_OPERANDS_CAP 3
+#define MAYA_INSTRUCTION_MAX_SIZE 17
+#define MAYA_BYTECODE_VERSION 6
 
 typedef enum MayaError_t {
     ERR_OK,
@@ -21,8 +24,20 @@ typedef enum MayaError_t {
     ERR_INVALID_OPERAND,
     ERR_INVALID_INSTRUCTION,
     ERR_DIV_BY_ZERO,
+    ERR_NATIVE_STACK_EFFECT,
+    ERR_CALL_STACK_OVERFLOW,
+    ERR_RET_OUTSIDE_CALL,
+    ERR_OUT_OF_FUEL, // suspended, running the vm again resumes it
 } MayaError;
 
+// why loading a program or setting up a vm failed. filled in instead of printing and exiting, so
+// the vm can be embedded in a host that has to keep running.
+typedef struct MayaSetupError_t {
+    char message[256];
+} MayaSetupError;
+
+void maya_setup_fail(MayaSetupError* error, const char* format, ...);
+
 typedef enum MayaOpCode_t {
     OP_HALT,
     OP_PUSH,
@@ -53,8 +68,82 @@ typedef enum MayaOpCode_t {
     OP_LOAD_PTR,
     OP_PUSH_PTR,
     OP_STORE_PTR,
+
+    // frame relative instructions, the operand is a single byte. arguments are counted down
+    // from the base of the frame (arg 0 is the last one pushed), locals up from it.
+    OP_RETV,
+    OP_LOAD_ARG,
+    OP_STORE_ARG,
+    OP_LOAD_LOCAL,
+    OP_STORE_LOCAL,
+
+    // batched native call: a 4 byte native index then a 1 byte count of frames, handed to the
+    // native as one slice and popped once it returns.
+    OP_NATIVE_BATCH,
+
+    // small immediate forms, the operand is a single byte.
+    OP_PUSH_S,
+    OP_DUP_S,
+    OP_LOAD_S,
+    OP_STORE_S,
+
+    // superinstructions, written over the first instruction of the sequence
+    // they replace by maya_fuse_program. the rest of the sequence is kept
+    // untouched, so jumps into the middle of it still work.
+    OP_LOAD_PUSH_IADD, // load_s r; push_s k; iadd
+    OP_PUSHI_JNEQ,     // push_s k; ijneq target
+    OP_PUSH_JNEQ,      // push k; ijneq target
+    OP_DUP_STORE,      // dup_s 1; store_s r
+
+    // immediate forms, numbered after the superinstructions so files assembled before them keep
+    // their opcodes. iaddi, isubi and imuli apply an 8 byte immediate to the top of the stack,
+    // inc and dec a register given as a single byte, and ijlti jumps while a register is below
+    // an immediate without touching the stack.
+    OP_IADDI,
+    OP_ISUBI,
+    OP_IMULI,
+    OP_INC,
+    OP_DEC,
+    OP_IJLTI, // 1 byte register, 8 byte immediate, 4 byte target
+
+    // integer alu and conversions. shifts are logical and use the low 6 bits of their count, mod
+    // is the remainder of idiv.
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_MOD,
+    OP_I2F,
+    OP_F2I,
+
+    OP_VECTOR, // 1 byte MayaVectorKernel, runs a whole array operation in one instruction
+
+    // quickened forms, never assembled nor accepted by the verifier. the checked interpreter
+    // writes them over a load_s, store_s or dup_s the first time it runs it with a valid operand,
+    // when the program is private to its vm, and runs them without looking at the operand again.
+    // they keep the operand byte, so they decode to the instruction they replace.
+    OP_LOAD_R0,
+    OP_LOAD_R1,
+    OP_LOAD_R2,
+    OP_LOAD_R3,
+    OP_LOAD_R4,
+    OP_LOAD_R5,
+    OP_LOAD_R6,
+    OP_STORE_R0,
+    OP_STORE_R1,
+    OP_STORE_R2,
+    OP_STORE_R3,
+    OP_STORE_R4,
+    OP_STORE_R5,
+    OP_STORE_R6,
+    OP_DUP1,
+
+    OP_COUNT,
 } MayaOpCode;
 
+#define MAYA_IS_QUICKENED(opcode) ((opcode) >= OP_LOAD_R0 && (opcode) <= OP_DUP1)
+
 typedef union Frame_t {
     int64_t as_i64;
     uint64_t as_u64;
@@ -63,46 +152,369 @@ typedef union Frame_t {
 } Frame;
 
 static_assert(sizeof(Frame) == 8, "Maya's frame size is expected to be 64 bit.");
+static_assert(OP_STORE_R0 - OP_LOAD_R0 == MAYA_REGISTERS_CAP, "Every register needs its quickened load and store.");
 
+// decoded form of an instruction, programs are stored and executed packed:
+// a 1 byte opcode followed only by the operand bytes that opcode needs.
+//
+//   push, dup, load, store, load_ptr           8 byte operand
+//   iaddi, isubi, imuli                        8 byte operand
+//   push_ptr, store_ptr                        two 8 byte operands
+//   jmp, jumps, call                           4 byte target offset
+//   ijlti                                      1 byte register, 8 byte immediate, 4 byte target
+//   native                                     4 byte native index
+//   native_batch                               4 byte native index, 1 byte count
+//   push_s (signed), dup_s, load_s, store_s    1 byte operand
+//   inc, dec, vector                           1 byte operand
 typedef struct MayaInstruction_t {
     MayaOpCode opcode;
     Frame operands[MAYA_OPERANDS_CAP];
 } MayaInstruction;
 
+static inline uint64_t maya_read_u64(const uint8_t* code) {
+    uint64_t value;
+    memcpy(&value, code, sizeof(value));
+    return value;
+}
+
+static inline uint32_t maya_read_u32(const uint8_t* code) {
+    uint32_t value;
+    memcpy(&value, code, sizeof(value));
+    return value;
+}
+
+static inline void maya_write_u64(uint8_t* code, uint64_t value) {
+    memcpy(code, &value, sizeof(value));
+}
+
+static inline void maya_write_u32(uint8_t* code, uint32_t value) {
+    memcpy(code, &value, sizeof(value));
+}
+
+#define MAYA_FUSION_THRESHOLD 1 // percent of the executed instruction pairs
+
+// dynamic counts of adjacent instruction pairs, used to pick which superinstructions to generate.
+typedef struct MayaPairProfile_t {
+    uint64_t pairs[OP_COUNT][OP_COUNT];
+    uint64_t total;
+    size_t next_rip;
+    uint8_t previous;
+} MayaPairProfile;
+
+const char* maya_instruction_to_str(MayaInstruction instruction);
+size_t maya_instruction_size(uint8_t opcode);
+
+// whether the instruction at rip starts and ends inside the program. an invalid opcode fits, it is
+// rejected when dispatched.
+static inline bool maya_instruction_fits(const uint8_t* program, size_t program_size, size_t rip) {
+    return rip < program_size && maya_instruction_size(program[rip]) <= program_size - rip;
+}
+size_t maya_decode_instruction(const uint8_t* code, MayaInstruction* instruction);
+size_t maya_encode_instruction(MayaInstruction instruction, uint8_t* code);
+MayaInstruction maya_compact_instruction(MayaInstruction instruction);
+
+void maya_fuse_program(uint8_t* program, size_t program_size, const MayaPairProfile* profile);
+void maya_unfuse_program(uint8_t* program, size_t program_size);
+
 typedef struct MayaVm_t MayaVm;
 
 typedef MayaError (*MayaNative)(MayaVm*);
 
-struct MayaVm_t {
-    MayaInstruction* program;
+// what a native does to the stack: it needs at least `arity` frames and moves sp by `delta`.
+typedef struct MayaNativeEffect_t {
+    uint8_t arity;
+    int8_t delta;
+} MayaNativeEffect;
+
+// batched form of a native: called once for `count` frames, oldest first, instead of once per
+// frame. it leaves sp alone, the vm pops the slice when it returns.
+typedef MayaError (*MayaNativeBatch)(MayaVm*, Frame* values, size_t count);
+
+// native libraries export their natives as a `maya_natives` array terminated by a NULL name.
+typedef struct MayaNativeEntry_t {
+    const char* name;
+    MayaNative native;
+    MayaNativeEffect effect;
+    MayaNativeBatch batch; // NULL when the native has no batched form
+} MayaNativeEntry;
+
+// what the print natives write, collected in a buffer owned by the vm and written with a single
+// write(2) when it fills, when the program ends or on the flush native. unbuffered output is
+// written after every value, for interactive use. with fd MAYA_OUTPUT_CAPTURE flushing appends
+// to captured instead, which the owner takes over and resets.
+#define MAYA_OUTPUT_CAPTURE -1
+
+typedef struct MayaOutput_t {
+    char* data; // MAYA_OUTPUT_CAP bytes
+    size_t size;
+    int fd;
+    bool unbuffered;
+
+    char* captured;
+    size_t captured_size;
+    size_t captured_cap;
+} MayaOutput;
+
+bool maya_output_init(MayaOutput* output, int fd, bool unbuffered);
+void maya_output_flush(MayaOutput* output);
+void maya_output_free(MayaOutput* output);
+void maya_output_write(MayaOutput* output, const char* str, size_t len);
+
+// each writes the value on its own line, formatted like printf's %ld, %lf, %s and %p.
+void maya_output_i64(MayaOutput* output, int64_t value);
+void maya_output_f64(MayaOutput* output, double value);
+void maya_output_str(MayaOutput* output, const char* str);
+void maya_output_ptr(MayaOutput* output, const void* ptr);
+
+// bump allocator over a chain of chunks, everything it handed out is released at once by reset
+// or destroy. chunk_size 0 picks a default. create and alloc return NULL when out of memory.
+typedef struct MayaArena_t MayaArena;
+
+MayaArena* maya_arena_create(size_t chunk_size);
+void* maya_arena_alloc(MayaArena* arena, size_t size);
+void maya_arena_reset(MayaArena* arena);
+void maya_arena_destroy(MayaArena* arena);
+
+// blocks of one size class carved from slabs and recycled through a free list. create and alloc
+// return NULL when out of memory.
+typedef struct MayaPool_t MayaPool;
+
+MayaPool* maya_pool_create(size_t block_size);
+void* maya_pool_alloc(MayaPool* pool);
+void maya_pool_free(MayaPool* pool, void* block);
+void maya_pool_destroy(MayaPool* pool);
+
+// optional garbage collected heap behind the gc_* natives. objects are found from the stack and
+// the registers conservatively and collected by an incremental mark-sweep, paid for a slice at a
+// time by the allocations. natives that store heap pointers into heap objects must go through a
+// barrier, push_ptr and memcpy already do. create and alloc return NULL when out of memory.
+typedef struct MayaHeap_t MayaHeap;
+
+MayaHeap* maya_heap_create(void);
+void* maya_heap_alloc(MayaHeap* heap, const MayaVm* maya, size_t size);
+void maya_heap_collect(MayaHeap* heap, const MayaVm* maya);
+void maya_heap_barrier(MayaHeap* heap, Frame value);
+void maya_heap_barrier_range(MayaHeap* heap, const void* start, size_t size);
+void maya_heap_report(const MayaHeap* heap);
+void maya_heap_destroy(MayaHeap* heap);
+
+// kernels of the vector instruction, each one an assembler mnemonic. they work on arrays of
+// 64 bit elements given by a pointer and a length, as in
+//
+//   vadd, vmul       dst a b len ->      dst[i] = a[i] op b[i]
+//   vfma             dst a b len ->      dst[i] += a[i] * b[i], rounded twice for floats
+//   vscale           dst src k len ->    dst[i] = src[i] * k
+//   vdot             a b len -> value
+//   vsum, vmin, vmax ptr len -> value    min and max of an empty array are 0
+//
+// dst may be one of the sources, other overlaps are undefined. the kernels use avx2 or sse2
+// where the cpu has them, float reductions accumulate in four lanes on every cpu so the results
+// do not depend on which one runs.
+typedef enum MayaVectorKernel_t {
+    VEC_ADD_I64,
+    VEC_ADD_F64,
+    VEC_MUL_I64,
+    VEC_MUL_F64,
+    VEC_FMA_I64,
+    VEC_FMA_F64,
+    VEC_SCALE_I64,
+    VEC_SCALE_F64,
+    VEC_DOT_I64,
+    VEC_DOT_F64,
+    VEC_SUM_I64,
+    VEC_SUM_F64,
+    VEC_MIN_I64,
+    VEC_MIN_F64,
+    VEC_MAX_I64,
+    VEC_MAX_F64,
+    VEC_COUNT,
+} MayaVectorKernel;
+
+typedef struct MayaVectorEntry_t {
+    const char* name;
+    MayaNativeEffect effect;
+} MayaVectorEntry;
+
+extern const MayaVectorEntry maya_vector_entries[VEC_COUNT];
+
+// args are the kernel's arity frames, the result of a reduction replaces the first.
+void maya_vector_run(MayaVm* maya, uint8_t kernel, Frame* args);
+
+// pushed by call, popped by ret: where to return and the caller's frame base.
+typedef struct MayaCallFrame_t {
     size_t rip;
-    size_t program_size;
+    size_t bp;
+} MayaCallFrame;
+
+struct MayaVm_t {
+    uint8_t* program;
+    size_t rip; // byte offset into program
+    size_t program_size; // in bytes
 
-    Frame stack[MAYA_STACK_CAP];
+    Frame* stack; // mapped, followed by a guard page
+    size_t stack_limit; // in frames
     size_t sp; // stack pointer
+
+    // call stack, mapped after the operand stack with room for stack_limit calls.
+    MayaCallFrame* frames;
+    size_t fp; // number of active calls
+    size_t bp; // sp when the running function was called, its arguments are right below
     Frame registers[MAYA_REGISTERS_CAP];
 
-    MayaNative natives[MAYA_NATIVES_CAP];
+    // dense dispatch table, one entry per import of the program, resolved once at load time.
+    MayaNative* natives;
+    MayaNativeEffect* natives_effects;
+    MayaNativeBatch* natives_batches;
     size_t natives_size;
 
     char* literals;
     size_t literals_size;
 
-    void* stdlib_handle;
+    // import table, stored right after the literals: null terminated native names, the operand
+    // of a native instruction indexes it.
+    char* imports;
+    size_t imports_size;
+
+    // label table, stored right after the imports: (rip, null terminated name) pairs.
+    char* symbols;
+    size_t symbols_size;
+
+    // set when the program is executed in place from a mapped file.
+    void* mapping;
+    size_t mapping_size;
+
+    void* libraries[MAYA_LIBRARIES_CAP + 1];
+    size_t libraries_size;
+
+    MayaOutput output;
+
+    // set by -r: alloc bump allocates from it, free does nothing and the whole arena is
+    // released by maya_deinit.
+    MayaArena* arena;
+
+    MayaHeap* heap; // created by the first gc_alloc
+
+    // state of the instrumented interpreters and the register form, unused by the plain one.
+    void* trace;
 
     bool halt;
+
+    bool verified; // set by maya_vm_reset for programs the verifier accepted, they run unchecked
+    bool quicken; // set by maya_read_program, the checked interpreter may rewrite the program in place
+
+    // spent by the fueled interpreters at every backward branch and call, they suspend the
+    // program with ERR_OUT_OF_FUEL once it is 0.
+    uint64_t fuel;
+
+#ifdef MAYA_BENCHMARK
+    size_t executed; // instructions dispatched so far
+#endif
 };
 
+// operand and call stacks backed by a lazily committed mapping. maya_stack_guarded runs execute
+// and reports a push or call past the limit, caught by a guard page, as the overflow error.
+bool maya_stack_create(MayaVm* maya, size_t limit, MayaSetupError* error);
+void maya_stack_destroy(MayaVm* maya);
+MayaError maya_stack_guarded(MayaVm* maya, MayaError (*execute)(MayaVm*));
+
+// opens the stdlib and the given libraries and resolves every import of the program against
+// their `maya_natives`, libraries later in the list shadow the earlier ones and the natives of
+// the host, a NULL terminated array like `maya_natives` or NULL, shadow them all.
+bool maya_bind_natives(MayaVm* maya, const MayaNativeEntry* natives, const char** libraries, size_t libraries_size,
+                       MayaSetupError* error);
+void maya_unbind_natives(MayaVm* maya);
+
+// program loaders: maya_read_program reads the file into memory of the vm's own, which the
+// checked interpreter quickens, maya_map_program maps it read only. both relocate the string
+// literals, maya_unload_program releases either.
+bool maya_read_program(MayaVm* maya, const char* filepath, MayaSetupError* error);
+bool maya_map_program(MayaVm* maya, const char* filepath, MayaSetupError* error);
+void maya_unload_program(MayaVm* maya);
+
+// sets up the stack, the output and the rest of the vm state without a program. the output is
+// captured until the caller points it at a file descriptor.
+bool maya_vm_init(MayaVm* maya, size_t stack_limit, MayaSetupError* error);
+void maya_vm_deinit(MayaVm* maya);
+
+// execution profiler, driven by the instrumented interpreter behind the -p flag.
+typedef struct MayaProfile_t MayaProfile;
+
+MayaProfile* maya_profile_create(const MayaVm* maya);
+void maya_profile_instruction(MayaVm* maya, size_t rip);
+// stops the clock as the run returns, before the output is flushed.
+void maya_profile_stop(MayaProfile* profile);
+void maya_profile_report(MayaProfile* profile, const MayaVm* maya);
+void maya_profile_destroy(MayaProfile* profile);
+
+// load time verifier: proves stack depth, register and native indices and jump targets for every
+// reachable instruction, so the program can run on the interpreter without per instruction checks.
+typedef struct MayaVerifyError_t {
+    size_t rip;
+    const char* message;
+} MayaVerifyError;
+
+bool maya_verify_program(const MayaVm* maya, MayaVerifyError* error);
+
+// maya_verify_program that also gives the stack depth relative to the running frame before every
+// instruction, MAYA_DEPTH_UNREACHED for the bytes no reachable instruction starts at. depths has
+// room for program_size entries.
+#define MAYA_DEPTH_UNREACHED INT64_MIN
+
+bool maya_verify_depths(const MayaVm* maya, MayaVerifyError* error, int64_t* depths);
+
+// template jit for x86-64 behind the -j flag. maya_jit_compile returns NULL on other targets and
+// when out of memory, the program then runs on the interpreter. maya_jit_execute returns false
+// when it hits an instruction without a template, the vm is then left at that instruction for the
+// interpreter to continue from.
+typedef struct MayaJit_t MayaJit;
+
+MayaJit* maya_jit_compile(const MayaVm* maya);
+bool maya_jit_execute(MayaJit* jit, MayaVm* maya, MayaError* error);
+void maya_jit_destroy(MayaJit* jit);
+
+// register form behind the -R flag: verified programs are translated at load time into three
+// address instructions over the slots of the running frame, the registers and a constant pool,
+// see mayareg.c. maya_reg_translate returns NULL for programs the verifier rejects, they stay on
+// the stack interpreters. maya_reg_execute runs the program from its entry to the end.
+typedef struct MayaRegProgram_t MayaRegProgram;
+
+MayaRegProgram* maya_reg_translate(const MayaVm* maya);
+MayaError maya_reg_execute(MayaRegProgram* program, MayaVm* maya);
+void maya_reg_disassemble(const MayaRegProgram* program);
+void maya_reg_destroy(MayaRegProgram* program);
+
 typedef struct MayaHeader_t {
     uint32_t magic;
+    uint32_t version;
     size_t starting_rip;
     size_t program_size;
+    size_t imports_size; // native names, after the string literals
+    size_t symbols_size; // label table at the end of the file, after the imports
 } MayaHeader;
 
-typedef struct MayaMacro_t {
-    StringView name;
-    Frame frame;
-} MayaMacro;
+// labels and macros share one namespace, looked up through an open addressing hash table.
+typedef enum MayaSymbolKind_t {
+    SYMBOL_LABEL,
+    SYMBOL_MACRO,
+    SYMBOL_NATIVE,
+    SYMBOL_PROGRAM,
+} MayaSymbolKind;
+
+typedef struct MayaSymbol_t {
+    StringView name; // NULL str marks an empty slot
+    MayaSymbolKind kind;
+    Frame value; // rip for labels, import index for natives, program index for -P jobs
+} MayaSymbol;
+
+typedef struct MayaSymbolTable_t {
+    MayaSymbol* slots;
+    size_t size;
+    size_t cap; // power of two
+} MayaSymbolTable;
+
+MayaSymbol* maya_symbols_find(const MayaSymbolTable* table, StringView name);
+MayaSymbol* maya_symbols_insert(MayaSymbolTable* table, MayaSymbol symbol);
+void maya_symbols_free(MayaSymbolTable* table);
 
 typedef struct MayaLabel_t {
     size_t rip;
@@ -122,18 +534,31 @@ typedef struct MayaStringLiteral_t {
 typedef struct MayaEnv_t {
     char* buffer;
 
-    MayaMacro macros[100];
-    size_t macros_size; 
+    MayaSymbolTable symbols;
 
-    MayaLabel labels[100];
+    // labels again in definition order, for the label table of the output.
+    MayaLabel* labels;
     size_t labels_size;
+    size_t labels_cap;
 
-    MayaDeferredSymbol deferred_symbol[100];
-    size_t deferred_symbol_size;
+    MayaDeferredSymbol* deferred_symbols;
+    size_t deferred_symbols_size;
+    size_t deferred_symbols_cap;
 
-    MayaStringLiteral str_literals[100];
+    MayaStringLiteral* str_literals;
     size_t str_literals_size;
+    size_t str_literals_cap;
+
+    // native names in import order, filled by the linker.
+    StringView* imports;
+    size_t imports_size;
+    size_t imports_cap;
+
+    // assembled program, linked in place before being written.
+    uint8_t* code;
+    size_t code_size;
+    StringView entry;
 } MayaEnv;
 
-void maya_translate_asm(MayaEnv* env, const char* input_path, const char* output_path);
-void maya_link_program(MayaEnv* env, const char* input_path);
+void maya_translate_asm(MayaEnv* env);
+void maya_link_program(MayaEnv* env, const char* output_path);
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct StringView_t {
     const char* str;
@@ -13,3 +14,4 @@ StringView sv_strip_by_delim(StringView sv, const char* delim);
 StringView sv_chop_by_delim(StringView* sv, const char* delim);
 StringView sv_chop_by_string_literal(StringView* sv);
 bool sv_equals(StringView lhs, StringView rhs);
+uint64_t sv_hash(StringView sv);
@@ -1,317 +1,121 @@
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-#include "maya.h"
-
-static const char* maya_error_to_str(MayaError error) {
-    switch (error) {
-    case ERR_OK:
-        return "OK";
-    case ERR_STACK_OVERFLOW:
-        return "STACK OVERFLOW";
-    case ERR_STACK_UNDERFLOW:
-        return "STACK UNDERFLOW";
-    case ERR_INVALID_OPERAND:
-        return "INVALID OPERAND";
-    case ERR_INVALID_INSTRUCTION:
-        return "INVALID INSTRUCTION";
-    case ERR_DIV_BY_ZERO:
-        return "DIVIDE BY ZERO";
-    default:
-        return "UNKNOWN ERROR";
-    }
-}
+#include "libmaya.h"
 
-static MayaError maya_execute_instruction(MayaVm* maya, MayaInstruction instruction) {
-    switch (instruction.opcode) {
-    case OP_HALT:
-        maya->halt = true;
-        break;
-    case OP_PUSH:
-        if (maya->sp >= MAYA_STACK_CAP)
-            return ERR_STACK_OVERFLOW;
-
-        maya->stack[maya->sp++] = instruction.operands[0];
-        maya->rip++;
-        break;
-    case OP_POP:
-        if (maya->sp <= 0)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_DUP:
-        if (maya->sp >= MAYA_STACK_CAP)
-            return ERR_STACK_OVERFLOW;
-
-        if ((int64_t)maya->sp - instruction.operands[0].as_i64 < 0)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp] = maya->stack[maya->sp - instruction.operands[0].as_u64];
-        maya->sp++;
-        maya->rip++;
-        break;
-    case OP_IADD:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_i64 += maya->stack[maya->sp - 1].as_i64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_FADD:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_f64 += maya->stack[maya->sp - 1].as_f64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_ISUB:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_i64 -= maya->stack[maya->sp - 1].as_i64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_FSUB:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_f64 -= maya->stack[maya->sp - 1].as_f64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_IMUL:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_i64 *= maya->stack[maya->sp - 1].as_i64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_FMUL:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_f64 *= maya->stack[maya->sp - 1].as_f64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_IDIV:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        if (maya->stack[maya->sp - 1].as_i64 == 0)
-            return ERR_DIV_BY_ZERO;
-
-        maya->stack[maya->sp - 2].as_i64 /= maya->stack[maya->sp - 1].as_i64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_FDIV:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        maya->stack[maya->sp - 2].as_f64 /= maya->stack[maya->sp - 1].as_f64;
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_JMP:
-        maya->rip = instruction.operands[0].as_u64;
-        break;
-    case OP_IJEQ:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
-
-        if (maya->stack[maya->sp - 2].as_i64 == maya->stack[maya->sp - 1].as_i64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
-            
-        maya->sp -= 2;
-        break;
-    case OP_FJEQ:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+#ifdef MAYA_THREADED_DISPATCH
+#define MAYA_DISPATCH_NAME "threaded"
+#else
+#define MAYA_DISPATCH_NAME "switch"
+#endif
 
-        if (maya->stack[maya->sp - 2].as_f64 == maya->stack[maya->sp - 1].as_f64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
+// native libraries given with -l, bound after the stdlib.
+static const char* libraries[MAYA_LIBRARIES_CAP];
+static size_t libraries_size;
 
-        maya->sp -= 2;
-        break;
-    case OP_IJNEQ:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+// set by -u, writes the output of the print natives as soon as it is produced.
+static bool output_unbuffered;
 
-        if (maya->stack[maya->sp - 2].as_i64 != maya->stack[maya->sp - 1].as_i64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
-            
-        maya->sp -= 2;
-        break;
-    case OP_FJNEQ:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+// set by -r, alloc takes memory from a per vm arena released all at once by maya_deinit.
+static bool alloc_arena;
 
-        if (maya->stack[maya->sp - 2].as_f64 != maya->stack[maya->sp - 1].as_f64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
+// set by -F, the budget of backward branches and calls of every run, 0 when unlimited.
+static uint64_t run_budget;
 
-        maya->sp -= 2;
-        break;
-    case OP_IJGT:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+// set by -T, -P takes turns between the jobs of a worker in slices this long, 0 runs every job
+// to its end before the next.
+static uint64_t run_slice_ns;
 
-        if (maya->stack[maya->sp - 2].as_i64 > maya->stack[maya->sp - 1].as_i64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
-            
-        maya->sp -= 2;
-        break;
-    case OP_FJGT:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+// records adjacent instruction pairs for the profile driven superinstruction selection.
+static inline void maya_trace_pair(MayaVm* maya, size_t rip) {
+    MayaPairProfile* profile = maya->trace;
+    uint8_t opcode = maya->program[rip];
 
-        if (maya->stack[maya->sp - 2].as_f64 > maya->stack[maya->sp - 1].as_f64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
+    if (rip == profile->next_rip) {
+        profile->pairs[profile->previous][opcode]++;
+        profile->total++;
+    }
 
-        maya->sp -= 2;
-        break;
-    case OP_IJLT:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+    profile->previous = opcode;
+    profile->next_rip = rip + maya_instruction_size(opcode);
+}
 
-        if (maya->stack[maya->sp - 2].as_i64 < maya->stack[maya->sp - 1].as_i64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
-            
-        maya->sp -= 2;
-        break;
-    case OP_FJLT:
-        if (maya->sp < 2)
-            return ERR_STACK_UNDERFLOW;
+#define MAYA_EXECUTE maya_execute
+#define MAYA_QUICKEN
+#include "mayaexec.inc"
 
-        if (maya->stack[maya->sp - 2].as_f64 < maya->stack[maya->sp - 1].as_f64) {
-            maya->rip = instruction.operands[0].as_u64;
-        } else {
-            maya->rip++;
-        }
-
-        maya->sp -= 2;
-        break;
-    case OP_CALL:
-        maya->registers[MAYA_RETURN_VALUE_REG].as_u64 = maya->rip + 1;
-        maya->registers[MAYA_STACK_POINTER_REG].as_u64 = maya->sp;
-        maya->rip = instruction.operands[0].as_u64;
-        break;
-    case OP_NATIVE:
-        if (maya->sp < 1)
-            return ERR_STACK_UNDERFLOW;
-
-        if (instruction.operands[0].as_u64 >= maya->natives_size)
-            return ERR_INVALID_OPERAND;
-
-        {
-            MayaError error = maya->natives[instruction.operands[0].as_u64](maya);
-            if (error != ERR_OK)
-                return error;
-        }
-        maya->rip++;
-        break;
-    case OP_RET:
-        maya->sp = maya->registers[MAYA_STACK_POINTER_REG].as_u64;
-        maya->rip = maya->registers[MAYA_RETURN_VALUE_REG].as_u64;
-        break;
-    case OP_LOAD:
-        if (maya->sp >= MAYA_STACK_CAP)
-            return ERR_STACK_OVERFLOW;
-
-        if (instruction.operands[0].as_i64 < 0 || instruction.operands[0].as_u64 >= MAYA_REGISTERS_CAP)
-            return ERR_INVALID_OPERAND;
-
-        maya->stack[maya->sp++] = maya->registers[instruction.operands[0].as_u64];
-        maya->rip++;
-        break;
-    case OP_STORE:
-        if (maya->sp < 1)
-            return ERR_STACK_UNDERFLOW;
-
-        if (instruction.operands[0].as_i64 < 0 || instruction.operands[0].as_u64 >= MAYA_REGISTERS_CAP)
-            return ERR_INVALID_OPERAND;
-
-        maya->registers[instruction.operands[0].as_u64] = maya->stack[maya->sp - 1];
-        maya->sp--;
-        maya->rip++;
-        break;
-    case OP_LOAD_PTR:
-        if (maya->sp >= MAYA_STACK_CAP)
-            return ERR_STACK_OVERFLOW;
-
-        if (instruction.operands[0].as_i64 < 0 || instruction.operands[0].as_u64 >= MAYA_REGISTERS_CAP)
-            return ERR_INVALID_OPERAND;
-
-        maya->stack[maya->sp].as_ptr = &maya->stack[maya->sp - instruction.operands[0].as_u64];
-        maya->sp++;
-        maya->rip++;
-        break;
-    case OP_PUSH_PTR:
-        if (maya->sp < 1)
-            return ERR_STACK_UNDERFLOW;
-
-        if (instruction.operands[1].as_i64 < 0 || instruction.operands[1].as_u64 >= MAYA_REGISTERS_CAP)
-            return ERR_INVALID_OPERAND;
-
-        memcpy(maya->stack[maya->sp - 1].as_ptr + (instruction.operands[0].as_u64 * sizeof(Frame)), &maya->registers[instruction.operands[1].as_u64], sizeof(Frame));
-        maya->rip++;
-        break;
-    case OP_STORE_PTR:
-        if (maya->sp < 1)
-            return ERR_STACK_UNDERFLOW;
-
-        if (instruction.operands[1].as_i64 < 0 || instruction.operands[1].as_u64 >= MAYA_REGISTERS_CAP)
-            return ERR_INVALID_OPERAND;
-
-        memcpy(&maya->registers[instruction.operands[1].as_u64], maya->stack[maya->sp - 1].as_ptr + (instruction.operands[0].as_u64 * sizeof(Frame)), sizeof(Frame));
-        maya->rip++;
-        break;
-    default:
-        return ERR_INVALID_INSTRUCTION;
+#define MAYA_EXECUTE maya_execute_unchecked
+#define MAYA_UNCHECKED
+#include "mayaexec.inc"
+
+#define MAYA_EXECUTE maya_execute_pairs
+#define MAYA_TRACE(maya, rip) maya_trace_pair(maya, rip)
+#include "mayaexec.inc"
+
+#define MAYA_EXECUTE maya_execute_profiled
+#define MAYA_TRACE(maya, rip) maya_profile_instruction(maya, rip)
+#include "mayaexec.inc"
+
+static void maya_execute_program(MayaVm* maya) {
+    // programs the verifier accepts run without the per instruction checks.
+    maya->verified = maya_verify_program(maya, NULL);
+
+    MayaError error = ERR_OK;
+    if (run_budget != 0) {
+        error = maya_vm_run(maya, run_budget);
+    } else {
+        error = maya_stack_guarded(maya, maya->verified ? maya_execute_unchecked : maya_execute);
     }
 
-    return ERR_OK;
+    maya_output_flush(&maya->output);
+    if (error != ERR_OK)
+        fprintf(stderr, "ERROR: %s\n", maya_error_to_str(error));
 }
 
-static void maya_execute_program(MayaVm* maya) {
-    while (!maya->halt) {
-        MayaError error = maya_execute_instruction(maya, maya->program[maya->rip]);
-        if (error != ERR_OK) {
+static void maya_execute_jit(MayaVm* maya) {
+    // compiled code does not spend fuel, budgeted runs stay on the interpreter.
+    MayaJit* jit = run_budget == 0 ? maya_jit_compile(maya) : NULL;
+    if (jit == NULL) {
+        maya_execute_program(maya);
+        return;
+    }
+
+    MayaError error = ERR_OK;
+    if (maya_jit_execute(jit, maya, &error)) {
+        maya_output_flush(&maya->output);
+        if (error != ERR_OK)
             fprintf(stderr, "ERROR: %s\n", maya_error_to_str(error));
-            return;
-        }
+    } else {
+        maya_execute_program(maya);
+    }
+
+    maya_jit_destroy(jit);
+}
+
+static void maya_execute_registers(MayaVm* maya) {
+    // the register form does not spend fuel, budgeted runs stay on the interpreter.
+    MayaRegProgram* program = run_budget == 0 ? maya_reg_translate(maya) : NULL;
+    if (program == NULL) {
+        maya_execute_program(maya);
+        return;
     }
+
+    MayaError error = maya_reg_execute(program, maya);
+    maya_output_flush(&maya->output);
+    if (error != ERR_OK)
+        fprintf(stderr, "ERROR: %s\n", maya_error_to_str(error));
+
+    maya_reg_destroy(program);
 }
 
 static char* shift(int* argc, char*** argv) {
@@ -330,9 +134,27 @@ static void usage(FILE* stream, const char* program_name) {
     fprintf(stream, "\n");
     fprintf(stream, "options:\n");
     fprintf(stream, "  -h                                   show usage.\n");
+    fprintf(stream, "  -u                                   write the program's output unbuffered, before the mode option.\n");
+    fprintf(stream, "  -r                                   allocate from an arena released when the program ends, before the mode option.\n");
+    fprintf(stream, "  -l <library.so>                      bind natives from <library.so> too, before the mode option.\n");
+    fprintf(stream, "  -s <frames>                          limit the stack to <frames>, before the mode option.\n");
+    fprintf(stream, "  -F <fuel>                            stop programs after <fuel> backward branches and calls, before the mode option.\n");
+    fprintf(stream, "  -T <microseconds>                    take turns between the jobs of -P in slices this long, before the mode option.\n");
     fprintf(stream, "  -a <input.masm>                      assemble mayasm file.\n");
     fprintf(stream, "  -e <input.maya>                      execute maya file.\n");
+    fprintf(stream, "  -m <input.maya>                      execute maya file mapped in place.\n");
+    fprintf(stream, "  -j <input.maya>                      execute maya file compiled to machine code.\n");
+    fprintf(stream, "  -R <input.maya>                      execute maya file translated to register form.\n");
     fprintf(stream, "  -d <input.maya>                      disassemble maya file.\n");
+    fprintf(stream, "  -D <input.maya>                      disassemble the register form of maya file.\n");
+    fprintf(stream, "  -v <input.maya>                      verify maya file.\n");
+    fprintf(stream, "  -p <input.maya>                      execute maya file and report where it spends its time.\n");
+    fprintf(stream, "  -f <input.maya>                      execute maya file and keep only its hot superinstructions.\n");
+    fprintf(stream, "  -P <jobs> [input.maya...]            execute a batch of maya files on <jobs> threads, read from stdin without files.\n");
+#ifdef MAYA_BENCHMARK
+    fprintf(stream, "  -b <input.maya>                      execute maya file and report instructions per second.\n");
+    fprintf(stream, "  -B <input.maya>                      execute maya file in register form and report instructions per second.\n");
+#endif
 }
 
 static const char* get_actual_filename(const char* filepath) {
@@ -350,67 +172,155 @@ static const char* get_actual_filename(const char* filepath) {
     return filepath;
 }
 
-static const char* maya_instruction_to_str(MayaInstruction instruction) {
-    switch (instruction.opcode) {
-    case OP_HALT:
-        return "halt";
-    case OP_PUSH:
-        return "push";
-    case OP_POP:
-        return "pop";
-    case OP_DUP:
-        return "dup";
-    case OP_IADD:
-        return "iadd";
-    case OP_FADD:
-        return "fadd";
-    case OP_ISUB:
-        return "isub";
-    case OP_FSUB:
-        return "fsub";
-    case OP_IMUL:
-        return "imul";
-    case OP_FMUL:
-        return "fmul";
-    case OP_IDIV:
-        return "idiv";
-    case OP_FDIV:
-        return "fdiv";
-    case OP_JMP:
-        return "jmp";
-    case OP_IJEQ:
-        return "ijeq";
-    case OP_FJEQ:
-        return "fjeq";
-    case OP_IJNEQ:
-        return "ijneq";
-    case OP_FJNEQ:
-        return "fjneq";
-    case OP_IJGT:
-        return "ijgt";
-    case OP_FJGT:
-        return "fjgt";
-    case OP_IJLT:
-        return "ijlt";
-    case OP_FJLT:
-        return "fjlt";
-    case OP_CALL:
-        return "call";
-    case OP_NATIVE:
-        return "native";
-    case OP_RET:
-        return "ret";
-    case OP_LOAD:
-        return "load";
-    case OP_STORE:
-        return "store";
-    default:
-        return "invalid opcode";
+static void maya_load_program_from_file(MayaVm* maya, const char* filepath) {
+    MayaSetupError error;
+    if (!maya_read_program(maya, filepath, &error)) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        exit(EXIT_FAILURE);
     }
 }
 
-static void maya_load_program_from_file(MayaVm* maya, const char* filepath) {
-    FILE* file = fopen(filepath, "rb");
+static void maya_map_program_from_file(MayaVm* maya, const char* filepath) {
+    MayaSetupError error;
+    if (!maya_map_program(maya, filepath, &error)) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// name of the native import at index, NULL when the import table is shorter.
+static const char* maya_import_name(const MayaVm* maya, uint64_t index) {
+    size_t offset = 0;
+    for (; offset < maya->imports_size && index > 0; index--)
+        offset += strnlen(maya->imports + offset, maya->imports_size - offset) + 1;
+
+    return offset < maya->imports_size ? maya->imports + offset : NULL;
+}
+
+static void maya_disassemble(MayaVm* maya) {
+    size_t rip = 0;
+    while (rip < maya->program_size) {
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&maya->program[rip], &instruction);
+        if (size == 0 || rip + size > maya->program_size) {
+            printf("%zu: %s\n", rip, maya_instruction_to_str(instruction));
+            return;
+        }
+
+        printf("%zu: %s", rip, maya_instruction_to_str(instruction));
+        switch (instruction.opcode) {
+        case OP_PUSH_PTR:
+        case OP_STORE_PTR:
+        case OP_LOAD_PUSH_IADD:
+        case OP_PUSHI_JNEQ:
+        case OP_PUSH_JNEQ:
+            printf(" %ld %ld\n", instruction.operands[0].as_i64, instruction.operands[1].as_i64);
+            break;
+        case OP_VECTOR:
+            printf("\n");
+            break;
+        case OP_IJLTI:
+            printf(" %ld %ld %ld\n", instruction.operands[0].as_i64, instruction.operands[1].as_i64,
+                   instruction.operands[2].as_i64);
+            break;
+        case OP_NATIVE: {
+            const char* name = maya_import_name(maya, instruction.operands[0].as_u64);
+            printf(" %ld # %s\n", instruction.operands[0].as_i64, name != NULL ? name : "?");
+            break;
+        }
+        case OP_NATIVE_BATCH: {
+            const char* name = maya_import_name(maya, instruction.operands[0].as_u64);
+            printf(" %ld %ld # %s\n", instruction.operands[0].as_i64, instruction.operands[1].as_i64,
+                   name != NULL ? name : "?");
+            break;
+        }
+        default:
+            if (size == 1) {
+                printf("\n");
+            } else {
+                printf(" %ld\n", instruction.operands[0].as_i64);
+            }
+            break;
+        }
+
+        rip += size;
+    }
+}
+
+static void maya_init(MayaVm* maya, size_t stack_limit) {
+    MayaSetupError error;
+    if (!maya_vm_init(maya, stack_limit, &error)) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        exit(EXIT_FAILURE);
+    }
+
+    maya->output.fd = STDOUT_FILENO;
+    maya->output.unbuffered = output_unbuffered;
+
+    if (alloc_arena) {
+        maya->arena = maya_arena_create(0);
+        if (!maya->arena) {
+            fprintf(stderr, "ERROR: cannot allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void maya_deinit(MayaVm* maya) {
+    maya_vm_deinit(maya);
+    maya_unload_program(maya);
+}
+
+static void maya_load_natives(MayaVm* maya) {
+    MayaSetupError error;
+    if (!maya_bind_natives(maya, NULL, libraries, libraries_size, &error)) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// runs the program with every superinstruction undone while counting adjacent instruction
+// pairs, then rewrites the file keeping only the superinstructions whose pair is hot.
+static void maya_train_fusions(const char* filepath, size_t stack_limit) {
+    MayaPairProfile* profile = calloc(1, sizeof(MayaPairProfile));
+    if (!profile) {
+        fprintf(stderr, "ERROR: cannot allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    profile->next_rip = SIZE_MAX;
+
+    MayaVm maya;
+    maya_init(&maya, stack_limit);
+    maya_load_program_from_file(&maya, filepath);
+    maya_unfuse_program(maya.program, maya.program_size);
+    maya_load_natives(&maya);
+
+    maya.trace = profile;
+    MayaError error = maya_stack_guarded(&maya, maya_execute_pairs);
+    maya_output_flush(&maya.output);
+    if (error != ERR_OK) {
+        fprintf(stderr, "ERROR: %s\n", maya_error_to_str(error));
+        exit(EXIT_FAILURE);
+    }
+
+    maya_unbind_natives(&maya);
+    maya_deinit(&maya);
+
+    for (size_t i = 0; i < OP_COUNT; i++) {
+        for (size_t j = 0; j < OP_COUNT; j++) {
+            if (profile->pairs[i][j] * 100 < profile->total * MAYA_FUSION_THRESHOLD)
+                continue;
+
+            fprintf(stderr, "%s -> %s: %.2f%%\n",
+                    maya_instruction_to_str((MayaInstruction) {.opcode = i}),
+                    maya_instruction_to_str((MayaInstruction) {.opcode = j}),
+                    (double)profile->pairs[i][j] * 100.0 / (double)profile->total);
+        }
+    }
+
+    // the loaded program had its literals relocated, patch the file from a fresh copy instead.
+    FILE* file = fopen(filepath, "r+b");
     if (!file) {
         fprintf(stderr, "ERROR: cannot open file '%s'\n", filepath);
         exit(EXIT_FAILURE);
@@ -419,115 +329,300 @@ static void maya_load_program_from_file(MayaVm* maya, const char* filepath) {
     MayaHeader header = {0};
     fread(&header, sizeof(MayaHeader), 1, file);
 
-    uint8_t* magic = (uint8_t*)&header.magic;
-    if (strncmp((const char*) magic, "MAYA", 4) != 0) {
-        fprintf(stderr, "ERROR: invalid header: '%.4s'\n", magic);
-        fclose(file);
+    uint8_t* program = malloc(sizeof(uint8_t) * header.program_size);
+    if (!program) {
+        fprintf(stderr, "ERROR: cannot allocate memory\n");
         exit(EXIT_FAILURE);
     }
 
-    maya->rip = header.starting_rip;
+    fread(program, sizeof(uint8_t), header.program_size, file);
 
-    MayaInstruction* instructions = malloc(sizeof(MayaInstruction) * header.program_size);
-    if (!instructions) {
+    maya_unfuse_program(program, header.program_size);
+    maya_fuse_program(program, header.program_size, profile);
+
+    fseek(file, sizeof(MayaHeader), SEEK_SET);
+    fwrite(program, sizeof(uint8_t), header.program_size, file);
+    fclose(file);
+
+    free(program);
+    free(profile);
+}
+
+// -P runs a batch of jobs on a pool of threads. every distinct file is loaded once as a
+// MayaProgram shared by the jobs running it, each thread owns one vm reset between its jobs.
+typedef struct MayaJob_t {
+    const char* filepath;
+    const MayaProgram* program;
+    MayaError error;
+    char* output; // captured, printed once every job is done
+    size_t output_size;
+} MayaJob;
+
+// the jobs a worker was dealt. the owner takes from the bottom, the other workers steal from the
+// top once their own queue is empty.
+typedef struct MayaJobQueue_t {
+    pthread_mutex_t lock;
+    size_t top;
+    size_t bottom;
+} MayaJobQueue;
+
+typedef struct MayaJobRunner_t {
+    MayaJob* jobs;
+    size_t jobs_size;
+    MayaJobQueue* queues; // queue i holds the jobs [top, bottom)
+    size_t workers;
+    size_t stack_limit;
+} MayaJobRunner;
+
+#define MAYA_WORKER_SLOTS 8 // jobs a worker takes turns between under -T
+
+// a job a worker is running, suspended between its slices.
+typedef struct MayaWorkerSlot_t {
+    MayaVm* maya;
+    size_t job;
+    uint64_t fuel; // left of the -F budget
+    bool running;
+} MayaWorkerSlot;
+
+typedef struct MayaWorker_t {
+    MayaJobRunner* runner;
+    size_t index;
+    pthread_t thread;
+} MayaWorker;
+
+static void* xcalloc(size_t count, size_t size) {
+    void* ptr = calloc(count, size);
+    if (!ptr) {
         fprintf(stderr, "ERROR: cannot allocate memory\n");
         exit(EXIT_FAILURE);
     }
 
-    fread(instructions, sizeof(MayaInstruction), header.program_size, file);
-    maya->program_size = header.program_size;
-    maya->program = instructions;
+    return ptr;
+}
 
-    long literals_start = ftell(file);
+static bool maya_job_take(MayaJobQueue* queue, bool steal, size_t* job) {
+    pthread_mutex_lock(&queue->lock);
 
-    fseek(file, 0, SEEK_END);
-    long whole_file_size = ftell(file);
-    fseek(file, literals_start, SEEK_SET);
+    bool taken = queue->top < queue->bottom;
+    if (taken)
+        *job = steal ? queue->top++ : --queue->bottom;
 
-    long literals_size = whole_file_size - literals_start;
+    pthread_mutex_unlock(&queue->lock);
+    return taken;
+}
 
-    if (literals_size == 0) {
-        maya->literals = NULL;
-        maya->literals_size = 0;
+// no job is ever added once the workers start, so a worker finding every queue empty is done.
+static bool maya_job_next(MayaJobRunner* runner, size_t worker, size_t* job) {
+    if (maya_job_take(&runner->queues[worker], false, job))
+        return true;
 
-        fclose(file);
-        return;
+    for (size_t i = 1; i < runner->workers; i++) {
+        if (maya_job_take(&runner->queues[(worker + i) % runner->workers], true, job))
+            return true;
     }
 
-    maya->literals_size = literals_size;
-    char* literals = malloc(sizeof(MayaInstruction) * literals_size);
-    fread(literals, sizeof(char), literals_size, file);
-    maya->literals = literals;
-
-    fclose(file);
+    return false;
+}
 
-    // load string literals.
-    while (literals_size > 0) {
-        char* starting_literal = literals;
+static MayaVm* maya_job_vm(const MayaJobRunner* runner) {
+    MayaSetupError error;
+    MayaVm* maya = maya_vm_create(NULL, runner->stack_limit, &error);
+    if (maya == NULL) {
+        fprintf(stderr, "ERROR: %s\n", error.message);
+        exit(EXIT_FAILURE);
+    }
 
-        while (*literals != 0) {
-            literals++;
-            literals_size--;
+    if (alloc_arena) {
+        maya->arena = maya_arena_create(0);
+        if (!maya->arena) {
+            fprintf(stderr, "ERROR: cannot allocate memory\n");
+            exit(EXIT_FAILURE);
         }
+    }
 
-        // skip the null terminating char
-        literals++;
-        literals_size--;
+    return maya;
+}
 
-        size_t rip = *literals;
-        maya->program[rip].operands[0].as_ptr = starting_literal;
+// runs the job of a slot for one slice, returns false once the job is done.
+static bool maya_job_step(MayaWorkerSlot* slot, MayaJob* job) {
+    MayaError error = maya_vm_run_slice(slot->maya, slot->fuel, run_slice_ns);
+    slot->fuel = maya_vm_fuel(slot->maya);
+    if (error == ERR_OUT_OF_FUEL && slot->fuel != 0)
+        return true;
+
+    job->error = error;
+
+    // the job takes the captured output over instead of copying it.
+    MayaOutput* output = &slot->maya->output;
+    maya_output_flush(output);
+    job->output = output->captured;
+    job->output_size = output->captured_size;
+    output->captured = NULL;
+    output->captured_size = 0;
+    output->captured_cap = 0;
+    return false;
+}
 
-        literals += sizeof(size_t);
-        literals_size -= sizeof(size_t);
+// without -T a worker runs its jobs one after the other on a single vm. with it, the worker
+// keeps MAYA_WORKER_SLOTS jobs going and takes turns between them a slice at a time, so a long
+// job does not hold up the short ones dealt to the same worker.
+static void* maya_job_worker(void* arg) {
+    MayaWorker* worker = arg;
+    MayaJobRunner* runner = worker->runner;
+
+    MayaWorkerSlot slots[MAYA_WORKER_SLOTS] = {0};
+    size_t slots_size = run_slice_ns != 0 ? MAYA_WORKER_SLOTS : 1;
+    size_t running = 0;
+    bool more = true;
+
+    do {
+        for (size_t i = 0; i < slots_size && more; i++) {
+            if (slots[i].running)
+                continue;
+
+            more = maya_job_next(runner, worker->index, &slots[i].job);
+            if (!more)
+                break;
+
+            if (slots[i].maya == NULL)
+                slots[i].maya = maya_job_vm(runner);
+
+            maya_vm_reset(slots[i].maya, runner->jobs[slots[i].job].program);
+            slots[i].fuel = run_budget;
+            slots[i].running = true;
+            running++;
+        }
+
+        for (size_t i = 0; i < slots_size; i++) {
+            if (slots[i].running && !maya_job_step(&slots[i], &runner->jobs[slots[i].job])) {
+                slots[i].running = false;
+                running--;
+            }
+        }
+    } while (running > 0 || more);
+
+    for (size_t i = 0; i < slots_size; i++) {
+        if (slots[i].maya != NULL)
+            maya_vm_destroy(slots[i].maya);
     }
-}
 
-static void maya_disassemble(MayaVm* maya) {
-    for (size_t i = 0; i < maya->program_size; i++)
-        printf("%s\n", maya_instruction_to_str(maya->program[i]));
+    return NULL;
 }
 
-static void maya_init(MayaVm* maya) {
-    maya->program = NULL;
-    maya->rip = 0;
-    maya->program_size = 0;
-    maya->sp = 0;
-    maya->natives_size = 0;
-    maya->literals = NULL;
-    maya->literals_size = 0;
+// runs every file of the batch on up to workers threads and prints the output of each job in
+// the order of the batch, returns the number of jobs that failed.
+static size_t maya_run_jobs(const char** filepaths, size_t filepaths_size, size_t workers, size_t stack_limit) {
+    MayaJob* jobs = xcalloc(filepaths_size, sizeof(MayaJob));
+    MayaProgram** programs = xcalloc(filepaths_size, sizeof(MayaProgram*));
+    size_t programs_size = 0;
+
+    MayaSymbolTable loaded = {0};
+    for (size_t i = 0; i < filepaths_size; i++) {
+        StringView name = sv_from_cstr(filepaths[i]);
+        MayaSymbol* symbol = maya_symbols_find(&loaded, name);
+        size_t index = symbol != NULL ? symbol->value.as_u64 : programs_size;
+        if (symbol == NULL) {
+            MayaSetupError error;
+            programs[programs_size] = maya_program_load(filepaths[i], NULL, libraries, libraries_size, &error);
+            if (programs[programs_size] == NULL) {
+                fprintf(stderr, "ERROR: %s\n", error.message);
+                exit(EXIT_FAILURE);
+            }
+
+            programs_size++;
+            maya_symbols_insert(&loaded, (MayaSymbol) {.name = name, .kind = SYMBOL_PROGRAM, .value.as_u64 = index});
+        }
 
-    memset(maya->registers, 0, sizeof(maya->registers));
+        jobs[i] = (MayaJob) {.filepath = filepaths[i], .program = programs[index]};
+    }
 
-    maya->halt = false;
-}
+    maya_symbols_free(&loaded);
 
-static void maya_deinit(MayaVm* maya) {
-    if (maya->program != NULL)
-        free(maya->program);
+    if (workers > filepaths_size)
+        workers = filepaths_size;
 
-    if (maya->literals != NULL)
-        free(maya->literals);
+    MayaJobRunner runner = {
+        .jobs = jobs,
+        .jobs_size = filepaths_size,
+        .queues = xcalloc(workers, sizeof(MayaJobQueue)),
+        .workers = workers,
+        .stack_limit = stack_limit,
+    };
 
-    maya_init(maya);
-}
+    // every worker starts with a contiguous share of the batch.
+    for (size_t i = 0; i < workers; i++) {
+        pthread_mutex_init(&runner.queues[i].lock, NULL);
+        runner.queues[i].top = filepaths_size * i / workers;
+        runner.queues[i].bottom = filepaths_size * (i + 1) / workers;
+    }
 
-static void maya_load_stdlib(MayaVm* maya) {
-    maya->stdlib_handle = dlopen("./stdlib/libmaya_stdlib.so", RTLD_LOCAL | RTLD_LAZY);
-    if (!maya->stdlib_handle) {
-        fprintf(stderr, "ERROR: cannot load stdlib: %s\n", dlerror());
-        exit(EXIT_FAILURE);
+    MayaWorker* pool = xcalloc(workers, sizeof(MayaWorker));
+    for (size_t i = 0; i < workers; i++) {
+        pool[i] = (MayaWorker) {.runner = &runner, .index = i};
+        if (pthread_create(&pool[i].thread, NULL, maya_job_worker, &pool[i]) != 0) {
+            fprintf(stderr, "ERROR: cannot start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (size_t i = 0; i < workers; i++)
+        pthread_join(pool[i].thread, NULL);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < filepaths_size; i++) {
+        fwrite(jobs[i].output, sizeof(char), jobs[i].output_size, stdout);
+        fflush(stdout);
+
+        if (jobs[i].error != ERR_OK) {
+            fprintf(stderr, "ERROR: %s: %s\n", jobs[i].filepath, maya_error_to_str(jobs[i].error));
+            failed++;
+        }
+
+        free(jobs[i].output);
     }
 
-    maya->natives[maya->natives_size++] = dlsym(maya->stdlib_handle, "maya_alloc");
-    maya->natives[maya->natives_size++] = dlsym(maya->stdlib_handle, "maya_free");
-    maya->natives[maya->natives_size++] = dlsym(maya->stdlib_handle, "maya_print_f64");
-    maya->natives[maya->natives_size++] = dlsym(maya->stdlib_handle, "maya_print_i64");
-    maya->natives[maya->natives_size++] = dlsym(maya->stdlib_handle, "maya_print_str");
-    maya->natives[maya->natives_size++] = dlsym(maya->stdlib_handle, "maya_print_ptr");
+    for (size_t i = 0; i < workers; i++)
+        pthread_mutex_destroy(&runner.queues[i].lock);
+
+    for (size_t i = 0; i < programs_size; i++)
+        maya_program_free(programs[i]);
+
+    free(pool);
+    free(runner.queues);
+    free(programs);
+    free(jobs);
+    return failed;
 }
 
-static void maya_unload_stdlib(MayaVm* maya) {
-    dlclose(maya->stdlib_handle);
+// reads the files of a -P batch given on stdin, one per line.
+static size_t maya_read_job_list(char*** filepaths) {
+    size_t size = 0;
+    size_t cap = 0;
+    char* line = NULL;
+    size_t line_cap = 0;
+
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = 0;
+
+        if (len == 0)
+            continue;
+
+        if (size == cap) {
+            cap = cap != 0 ? cap * 2 : 64;
+            *filepaths = realloc(*filepaths, cap * sizeof(char*));
+            if (!*filepaths) {
+                fprintf(stderr, "ERROR: cannot allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        (*filepaths)[size++] = strdup(line);
+    }
+
+    free(line);
+    return size;
 }
 
 static void maya_load_env(MayaEnv* env, const char* input_file) {
@@ -547,21 +642,21 @@ static void maya_load_env(MayaEnv* env, const char* input_file) {
 
     fclose(istream);
 
-    env->buffer = buffer;
-    env->macros_size = 0;
-    env->labels_size = 0;
-    env->deferred_symbol_size = 0;
-    env->str_literals_size = 0;
+    *env = (MayaEnv) {.buffer = buffer};
 }
 
 static void maya_unload_env(MayaEnv* env) {
     if (env->buffer != NULL)
         free(env->buffer);
 
-    env->macros_size = 0;
-    env->labels_size = 0;
-    env->deferred_symbol_size = 0;
-    env->str_literals_size = 0;
+    maya_symbols_free(&env->symbols);
+    free(env->labels);
+    free(env->deferred_symbols);
+    free(env->str_literals);
+    free(env->imports);
+    free(env->code);
+
+    *env = (MayaEnv) {0};
 }
 
 int main(int argc, char** argv) {
@@ -574,6 +669,69 @@ int main(int argc, char** argv) {
 
     const char* flag = shift(&argc, &argv);
 
+    // options that change how the vm runs come before the mode flag, in any order.
+    size_t stack_limit = MAYA_STACK_DEFAULT_LIMIT;
+    for (;;) {
+        if (strcmp(flag, "-u") == 0) {
+            output_unbuffered = true;
+        } else if (strcmp(flag, "-r") == 0) {
+            alloc_arena = true;
+        } else if (strcmp(flag, "-l") == 0) {
+            const char* library = shift(&argc, &argv);
+            if (library == NULL) {
+                fprintf(stderr, "ERROR: -l is expecting a library\n");
+                exit(EXIT_FAILURE);
+            }
+
+            if (libraries_size == MAYA_LIBRARIES_CAP) {
+                fprintf(stderr, "ERROR: too many native libraries, at most %d\n", MAYA_LIBRARIES_CAP);
+                exit(EXIT_FAILURE);
+            }
+
+            libraries[libraries_size++] = library;
+        } else if (strcmp(flag, "-F") == 0 || strcmp(flag, "-T") == 0) {
+            const char* amount = shift(&argc, &argv);
+            if (amount == NULL) {
+                fprintf(stderr, "ERROR: %s is expecting a number\n", flag);
+                exit(EXIT_FAILURE);
+            }
+
+            char* end = NULL;
+            uint64_t value = strtoull(amount, &end, 10);
+            if (*end != 0 || value == 0) {
+                fprintf(stderr, "ERROR: invalid number: '%s'\n", amount);
+                exit(EXIT_FAILURE);
+            }
+
+            if (flag[1] == 'F') {
+                run_budget = value;
+            } else {
+                run_slice_ns = value * 1000;
+            }
+        } else if (strcmp(flag, "-s") == 0) {
+            const char* limit = shift(&argc, &argv);
+            if (limit == NULL) {
+                fprintf(stderr, "ERROR: -s is expecting a number of frames\n");
+                exit(EXIT_FAILURE);
+            }
+
+            char* end = NULL;
+            stack_limit = strtoull(limit, &end, 10);
+            if (*end != 0) {
+                fprintf(stderr, "ERROR: invalid number of frames: '%s'\n", limit);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            break;
+        }
+
+        flag = shift(&argc, &argv);
+        if (flag == NULL) {
+            usage(stderr, program);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (strcmp(flag, "-h") == 0) {
         usage(stdout, program);
         exit(EXIT_SUCCESS);
@@ -598,29 +756,11 @@ int main(int argc, char** argv) {
 
         strcat(output, ".maya");
 
-        FILE* istream = fopen(input, "r");
-        if (!istream) {
-            fprintf(stderr, "ERROR: cannot open file '%s'\n", input);
-            exit(EXIT_FAILURE);
-        }
-    
-        fseek(istream, 0, SEEK_END);
-        long size = ftell(istream);
-        fseek(istream, 0, SEEK_SET);
-
-        char* buffer = malloc(sizeof(char) * size + 1);
-        buffer[size] = 0;
-        fread(buffer, sizeof(char), size, istream);
-
-        fclose(istream);
-
         MayaEnv env;
         maya_load_env(&env, input);
-        maya_translate_asm(&env, buffer, output);
+        maya_translate_asm(&env);
         maya_link_program(&env, output);
         maya_unload_env(&env);
-
-        free(buffer);
     } else if (strcmp(flag, "-e") == 0) {
         const char* input = shift(&argc, &argv);
         if (input == NULL) {
@@ -629,12 +769,123 @@ int main(int argc, char** argv) {
         }
 
         MayaVm maya;
-        maya_init(&maya);
+        maya_init(&maya, stack_limit);
         maya_load_program_from_file(&maya, input);
-        maya_load_stdlib(&maya);
+        maya_load_natives(&maya);
         maya_execute_program(&maya);
-        maya_unload_stdlib(&maya);
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+    } else if (strcmp(flag, "-m") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_map_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+        maya_execute_program(&maya);
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+    } else if (strcmp(flag, "-j") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+        maya_execute_jit(&maya);
+        maya_unbind_natives(&maya);
         maya_deinit(&maya);
+    } else if (strcmp(flag, "-R") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+        maya_execute_registers(&maya);
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+    } else if (strcmp(flag, "-p") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+
+        MayaProfile* profile = maya_profile_create(&maya);
+        maya.trace = profile;
+
+        MayaError error = maya_stack_guarded(&maya, maya_execute_profiled);
+        maya_profile_stop(profile);
+        maya_output_flush(&maya.output);
+        if (error != ERR_OK)
+            fprintf(stderr, "ERROR: %s\n", maya_error_to_str(error));
+
+        maya_profile_report(profile, &maya);
+        maya_profile_destroy(profile);
+
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+    } else if (strcmp(flag, "-f") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        maya_train_fusions(input, stack_limit);
+    } else if (strcmp(flag, "-P") == 0) {
+        const char* workers = shift(&argc, &argv);
+        if (workers == NULL) {
+            fprintf(stderr, "ERROR: -P is expecting a number of jobs\n");
+            exit(EXIT_FAILURE);
+        }
+
+        char* end = NULL;
+        size_t workers_size = strtoull(workers, &end, 10);
+        if (*end != 0 || workers_size == 0) {
+            fprintf(stderr, "ERROR: invalid number of jobs: '%s'\n", workers);
+            exit(EXIT_FAILURE);
+        }
+
+        // without files on the command line the batch is read from stdin.
+        char** filepaths = argv;
+        size_t filepaths_size = argc;
+        if (filepaths_size == 0) {
+            filepaths = NULL;
+            filepaths_size = maya_read_job_list(&filepaths);
+        }
+
+        size_t failed = 0;
+        if (filepaths_size > 0)
+            failed = maya_run_jobs((const char**)filepaths, filepaths_size, workers_size, stack_limit);
+
+        if (filepaths != argv) {
+            for (size_t i = 0; i < filepaths_size; i++)
+                free(filepaths[i]);
+
+            free(filepaths);
+        }
+
+        if (failed > 0)
+            exit(EXIT_FAILURE);
     } else if (strcmp(flag, "-d") == 0) {
         const char* input = shift(&argc, &argv);
         if (input == NULL) {
@@ -643,10 +894,106 @@ int main(int argc, char** argv) {
         }
 
         MayaVm maya;
-        maya_init(&maya);
+        maya_init(&maya, stack_limit);
         maya_load_program_from_file(&maya, input);
         maya_disassemble(&maya);
         maya_deinit(&maya);
+    } else if (strcmp(flag, "-D") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+
+        // only verified programs have a register form.
+        MayaRegProgram* program = maya_reg_translate(&maya);
+        if (program == NULL) {
+            fprintf(stderr, "ERROR: '%s' cannot be translated, run -v for the reason\n", input);
+            exit(EXIT_FAILURE);
+        }
+
+        maya_reg_disassemble(program);
+        maya_reg_destroy(program);
+
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+    } else if (strcmp(flag, "-v") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+
+        MayaVerifyError error;
+        if (!maya_verify_program(&maya, &error)) {
+            fprintf(stderr, "ERROR: %zu: %s\n", error.rip, error.message);
+            exit(EXIT_FAILURE);
+        }
+
+        printf("%s: verified\n", input);
+
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+#ifdef MAYA_BENCHMARK
+    } else if (strcmp(flag, "-b") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+
+        const char* interpreter = maya_verify_program(&maya, NULL) ? "unchecked" : "checked";
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        maya_execute_program(&maya);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%s dispatch, %s: %zu instructions in %.3fs (%.2f M instructions/s)\n",
+                MAYA_DISPATCH_NAME, interpreter, maya.executed, elapsed, (double)maya.executed / elapsed / 1e6);
+
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+    } else if (strcmp(flag, "-B") == 0) {
+        const char* input = shift(&argc, &argv);
+        if (input == NULL) {
+            fprintf(stderr, "ERROR: expected input file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        MayaVm maya;
+        maya_init(&maya, stack_limit);
+        maya_load_program_from_file(&maya, input);
+        maya_load_natives(&maya);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        maya_execute_registers(&maya);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%s dispatch, register form: %zu instructions in %.3fs (%.2f M instructions/s)\n",
+                MAYA_DISPATCH_NAME, maya.executed, elapsed, (double)maya.executed / elapsed / 1e6);
+
+        maya_unbind_natives(&maya);
+        maya_deinit(&maya);
+#endif
     } else {
         usage(stderr, program);
         fprintf(stderr, "ERROR: invalid flag: '%s'\n", flag);
@@ -0,0 +1,184 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "maya.h"
+
+// built into both the vm and the stdlib, like mayaout.c: the stdlib exposes arenas and pools as
+// natives, the vm owns the arena behind -r.
+
+#define ALIGNMENT 16
+#define ARENA_DEFAULT_CHUNK (1 << 16)
+#define ARENA_MAX_CHUNK (1 << 24)
+#define POOL_SLAB_SIZE (1 << 16)
+
+typedef struct MayaArenaChunk_t {
+    struct MayaArenaChunk_t* next;
+    size_t size;
+    size_t used;
+    _Alignas(ALIGNMENT) uint8_t data[];
+} MayaArenaChunk;
+
+struct MayaArena_t {
+    MayaArenaChunk* first;
+    MayaArenaChunk* current;
+    MayaArenaChunk* last;
+    size_t chunk_size; // size of the next chunk, doubled up to ARENA_MAX_CHUNK
+};
+
+typedef struct MayaPoolSlab_t {
+    struct MayaPoolSlab_t* next;
+    _Alignas(ALIGNMENT) uint8_t data[];
+} MayaPoolSlab;
+
+struct MayaPool_t {
+    size_t block_size;
+    size_t blocks_per_slab;
+    void* free_list; // every free block starts with the next free block
+    MayaPoolSlab* slabs;
+};
+
+static size_t align_up(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+// sizes that would wrap once aligned and put behind the header of their chunk or slab.
+static bool too_large(size_t size, size_t header) {
+    return size > SIZE_MAX - header - ALIGNMENT;
+}
+
+static MayaArenaChunk* new_chunk(size_t size) {
+    if (too_large(size, sizeof(MayaArenaChunk)))
+        return NULL;
+
+    MayaArenaChunk* chunk = malloc(sizeof(MayaArenaChunk) + size);
+    if (!chunk)
+        return NULL;
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+MayaArena* maya_arena_create(size_t chunk_size) {
+    if (too_large(chunk_size, sizeof(MayaArenaChunk)))
+        return NULL;
+
+    MayaArena* arena = malloc(sizeof(MayaArena));
+    if (!arena)
+        return NULL;
+
+    arena->chunk_size = align_up(chunk_size != 0 ? chunk_size : ARENA_DEFAULT_CHUNK);
+    arena->first = new_chunk(arena->chunk_size);
+    if (!arena->first) {
+        free(arena);
+        return NULL;
+    }
+
+    arena->current = arena->first;
+    arena->last = arena->first;
+    return arena;
+}
+
+void* maya_arena_alloc(MayaArena* arena, size_t size) {
+    if (too_large(size, sizeof(MayaArenaChunk)))
+        return NULL;
+
+    size = align_up(size != 0 ? size : 1);
+
+    // after a reset the chunks are reused in order, the ones too small for size are skipped.
+    while (size > arena->current->size - arena->current->used) {
+        if (arena->current->next == NULL) {
+            if (arena->chunk_size < ARENA_MAX_CHUNK)
+                arena->chunk_size *= 2;
+
+            MayaArenaChunk* chunk = new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+            if (!chunk)
+                return NULL;
+
+            arena->last->next = chunk;
+            arena->last = chunk;
+        }
+
+        arena->current = arena->current->next;
+    }
+
+    void* ptr = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return ptr;
+}
+
+void maya_arena_reset(MayaArena* arena) {
+    for (MayaArenaChunk* chunk = arena->first; chunk != NULL; chunk = chunk->next)
+        chunk->used = 0;
+
+    arena->current = arena->first;
+}
+
+void maya_arena_destroy(MayaArena* arena) {
+    MayaArenaChunk* chunk = arena->first;
+    while (chunk != NULL) {
+        MayaArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+MayaPool* maya_pool_create(size_t block_size) {
+    if (too_large(block_size, sizeof(MayaPoolSlab)))
+        return NULL;
+
+    MayaPool* pool = malloc(sizeof(MayaPool));
+    if (!pool)
+        return NULL;
+
+    pool->block_size = align_up(block_size != 0 ? block_size : 1);
+    pool->blocks_per_slab = pool->block_size < POOL_SLAB_SIZE ? POOL_SLAB_SIZE / pool->block_size : 1;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    return pool;
+}
+
+void* maya_pool_alloc(MayaPool* pool) {
+    if (pool->free_list == NULL) {
+        MayaPoolSlab* slab = malloc(sizeof(MayaPoolSlab) + pool->block_size * pool->blocks_per_slab);
+        if (!slab)
+            return NULL;
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        // thread the new blocks onto the free list, first block first.
+        for (size_t i = pool->blocks_per_slab; i > 0; i--) {
+            void* block = slab->data + (i - 1) * pool->block_size;
+            *(void**)block = pool->free_list;
+            pool->free_list = block;
+        }
+    }
+
+    void* block = pool->free_list;
+    pool->free_list = *(void**)block;
+    return block;
+}
+
+void maya_pool_free(MayaPool* pool, void* block) {
+    if (block == NULL)
+        return;
+
+    *(void**)block = pool->free_list;
+    pool->free_list = block;
+}
+
+void maya_pool_destroy(MayaPool* pool) {
+    MayaPoolSlab* slab = pool->slabs;
+    while (slab != NULL) {
+        MayaPoolSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
+    free(pool);
+}
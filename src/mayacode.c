@@ -0,0 +1,369 @@
+#include <stdint.h>
+
+#include "maya.h"
+
+size_t maya_instruction_size(uint8_t opcode) {
+    switch (opcode) {
+    case OP_HALT:
+    case OP_POP:
+    case OP_IADD:
+    case OP_FADD:
+    case OP_ISUB:
+    case OP_FSUB:
+    case OP_IMUL:
+    case OP_FMUL:
+    case OP_IDIV:
+    case OP_FDIV:
+    case OP_RET:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_MOD:
+    case OP_I2F:
+    case OP_F2I:
+        return 1;
+    case OP_PUSH_S:
+    case OP_DUP_S:
+    case OP_LOAD_S:
+    case OP_STORE_S:
+    case OP_RETV:
+    case OP_LOAD_ARG:
+    case OP_STORE_ARG:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_INC:
+    case OP_DEC:
+    case OP_VECTOR:
+    case OP_LOAD_R0:
+    case OP_LOAD_R1:
+    case OP_LOAD_R2:
+    case OP_LOAD_R3:
+    case OP_LOAD_R4:
+    case OP_LOAD_R5:
+    case OP_LOAD_R6:
+    case OP_STORE_R0:
+    case OP_STORE_R1:
+    case OP_STORE_R2:
+    case OP_STORE_R3:
+    case OP_STORE_R4:
+    case OP_STORE_R5:
+    case OP_STORE_R6:
+    case OP_DUP1:
+        return 1 + sizeof(uint8_t);
+    case OP_JMP:
+    case OP_IJEQ:
+    case OP_FJEQ:
+    case OP_IJNEQ:
+    case OP_FJNEQ:
+    case OP_IJGT:
+    case OP_FJGT:
+    case OP_IJLT:
+    case OP_FJLT:
+    case OP_CALL:
+    case OP_NATIVE:
+        return 1 + sizeof(uint32_t);
+    case OP_NATIVE_BATCH:
+        return 1 + sizeof(uint32_t) + sizeof(uint8_t);
+    case OP_PUSH:
+    case OP_DUP:
+    case OP_LOAD:
+    case OP_STORE:
+    case OP_LOAD_PTR:
+    case OP_IADDI:
+    case OP_ISUBI:
+    case OP_IMULI:
+        return 1 + sizeof(uint64_t);
+    case OP_IJLTI:
+        return 1 + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    case OP_PUSH_PTR:
+    case OP_STORE_PTR:
+        return 1 + sizeof(uint64_t) * 2;
+    // superinstructions span the whole sequence they replace.
+    case OP_LOAD_PUSH_IADD:
+        return 2 + 2 + 1;
+    case OP_PUSHI_JNEQ:
+        return 2 + 1 + sizeof(uint32_t);
+    case OP_PUSH_JNEQ:
+        return 1 + sizeof(uint64_t) + 1 + sizeof(uint32_t);
+    case OP_DUP_STORE:
+        return 2 + 2;
+    default:
+        return 0;
+    }
+}
+
+// returns the size of the decoded instruction, or 0 if the opcode is invalid.
+size_t maya_decode_instruction(const uint8_t* code, MayaInstruction* instruction) {
+    size_t size = maya_instruction_size(code[0]);
+
+    instruction->opcode = code[0];
+    instruction->operands[0].as_u64 = 0;
+    instruction->operands[1].as_u64 = 0;
+    instruction->operands[2].as_u64 = 0;
+
+    switch (code[0]) {
+    case OP_IJLTI:
+        instruction->operands[0].as_u64 = code[1];
+        instruction->operands[1].as_u64 = maya_read_u64(&code[2]);
+        instruction->operands[2].as_u64 = maya_read_u32(&code[2 + sizeof(uint64_t)]);
+        return size;
+    case OP_LOAD_PUSH_IADD:
+        instruction->operands[0].as_u64 = code[1];
+        instruction->operands[1].as_i64 = (int8_t)code[3];
+        return size;
+    case OP_PUSHI_JNEQ:
+        instruction->operands[0].as_i64 = (int8_t)code[1];
+        instruction->operands[1].as_u64 = maya_read_u32(&code[3]);
+        return size;
+    case OP_PUSH_JNEQ:
+        instruction->operands[0].as_u64 = maya_read_u64(&code[1]);
+        instruction->operands[1].as_u64 = maya_read_u32(&code[2 + sizeof(uint64_t)]);
+        return size;
+    case OP_DUP_STORE:
+        instruction->operands[0].as_u64 = code[3];
+        return size;
+    default:
+        break;
+    }
+
+    switch (size) {
+    case 1 + sizeof(uint8_t):
+        if (code[0] == OP_PUSH_S) {
+            instruction->operands[0].as_i64 = (int8_t)code[1];
+        } else {
+            instruction->operands[0].as_u64 = code[1];
+        }
+        break;
+    case 1 + sizeof(uint32_t):
+        instruction->operands[0].as_u64 = maya_read_u32(&code[1]);
+        break;
+    case 1 + sizeof(uint32_t) + sizeof(uint8_t):
+        instruction->operands[0].as_u64 = maya_read_u32(&code[1]);
+        instruction->operands[1].as_u64 = code[1 + sizeof(uint32_t)];
+        break;
+    case 1 + sizeof(uint64_t):
+        instruction->operands[0].as_u64 = maya_read_u64(&code[1]);
+        break;
+    case 1 + sizeof(uint64_t) * 2:
+        instruction->operands[0].as_u64 = maya_read_u64(&code[1]);
+        instruction->operands[1].as_u64 = maya_read_u64(&code[1 + sizeof(uint64_t)]);
+        break;
+    default:
+        break;
+    }
+
+    return size;
+}
+
+// encodes the instruction exactly as given, operands that do not fit the encoding are truncated.
+// superinstructions are only produced by maya_fuse_program and quickened forms by the
+// interpreter, neither can be encoded.
+size_t maya_encode_instruction(MayaInstruction instruction, uint8_t* code) {
+    if (instruction.opcode >= OP_LOAD_PUSH_IADD && instruction.opcode <= OP_DUP_STORE)
+        return 0;
+
+    if (MAYA_IS_QUICKENED(instruction.opcode))
+        return 0;
+
+    size_t size = maya_instruction_size(instruction.opcode);
+
+    code[0] = instruction.opcode;
+
+    if (instruction.opcode == OP_IJLTI) {
+        code[1] = (uint8_t)instruction.operands[0].as_u64;
+        maya_write_u64(&code[2], instruction.operands[1].as_u64);
+        maya_write_u32(&code[2 + sizeof(uint64_t)], (uint32_t)instruction.operands[2].as_u64);
+        return size;
+    }
+
+    switch (size) {
+    case 1 + sizeof(uint8_t):
+        code[1] = (uint8_t)instruction.operands[0].as_u64;
+        break;
+    case 1 + sizeof(uint32_t):
+        maya_write_u32(&code[1], (uint32_t)instruction.operands[0].as_u64);
+        break;
+    case 1 + sizeof(uint32_t) + sizeof(uint8_t):
+        maya_write_u32(&code[1], (uint32_t)instruction.operands[0].as_u64);
+        code[1 + sizeof(uint32_t)] = (uint8_t)instruction.operands[1].as_u64;
+        break;
+    case 1 + sizeof(uint64_t):
+        maya_write_u64(&code[1], instruction.operands[0].as_u64);
+        break;
+    case 1 + sizeof(uint64_t) * 2:
+        maya_write_u64(&code[1], instruction.operands[0].as_u64);
+        maya_write_u64(&code[1 + sizeof(uint64_t)], instruction.operands[1].as_u64);
+        break;
+    default:
+        break;
+    }
+
+    return size;
+}
+
+// picks the small immediate form of the instruction when its operand fits in a byte.
+MayaInstruction maya_compact_instruction(MayaInstruction instruction) {
+    Frame operand = instruction.operands[0];
+
+    switch (instruction.opcode) {
+    case OP_PUSH:
+        // sign extending the byte gives back the exact same 64 bits, so this is safe for any frame.
+        if (operand.as_i64 >= INT8_MIN && operand.as_i64 <= INT8_MAX)
+            instruction.opcode = OP_PUSH_S;
+        break;
+    case OP_DUP:
+        if (operand.as_u64 <= UINT8_MAX)
+            instruction.opcode = OP_DUP_S;
+        break;
+    case OP_LOAD:
+        if (operand.as_u64 <= UINT8_MAX)
+            instruction.opcode = OP_LOAD_S;
+        break;
+    case OP_STORE:
+        if (operand.as_u64 <= UINT8_MAX)
+            instruction.opcode = OP_STORE_S;
+        break;
+    default:
+        break;
+    }
+
+    return instruction;
+}
+
+const char* maya_instruction_to_str(MayaInstruction instruction) {
+    switch (instruction.opcode) {
+    case OP_HALT:
+        return "halt";
+    case OP_PUSH:
+    case OP_PUSH_S:
+        return "push";
+    case OP_POP:
+        return "pop";
+    case OP_DUP:
+    case OP_DUP_S:
+    case OP_DUP1:
+        return "dup";
+    case OP_IADD:
+        return "iadd";
+    case OP_FADD:
+        return "fadd";
+    case OP_ISUB:
+        return "isub";
+    case OP_FSUB:
+        return "fsub";
+    case OP_IMUL:
+        return "imul";
+    case OP_FMUL:
+        return "fmul";
+    case OP_IDIV:
+        return "idiv";
+    case OP_FDIV:
+        return "fdiv";
+    case OP_JMP:
+        return "jmp";
+    case OP_IJEQ:
+        return "ijeq";
+    case OP_FJEQ:
+        return "fjeq";
+    case OP_IJNEQ:
+        return "ijneq";
+    case OP_FJNEQ:
+        return "fjneq";
+    case OP_IJGT:
+        return "ijgt";
+    case OP_FJGT:
+        return "fjgt";
+    case OP_IJLT:
+        return "ijlt";
+    case OP_FJLT:
+        return "fjlt";
+    case OP_CALL:
+        return "call";
+    case OP_NATIVE:
+        return "native";
+    case OP_NATIVE_BATCH:
+        return "native_batch";
+    case OP_RET:
+        return "ret";
+    case OP_LOAD:
+    case OP_LOAD_S:
+    case OP_LOAD_R0:
+    case OP_LOAD_R1:
+    case OP_LOAD_R2:
+    case OP_LOAD_R3:
+    case OP_LOAD_R4:
+    case OP_LOAD_R5:
+    case OP_LOAD_R6:
+        return "load";
+    case OP_STORE:
+    case OP_STORE_S:
+    case OP_STORE_R0:
+    case OP_STORE_R1:
+    case OP_STORE_R2:
+    case OP_STORE_R3:
+    case OP_STORE_R4:
+    case OP_STORE_R5:
+    case OP_STORE_R6:
+        return "store";
+    case OP_LOAD_PTR:
+        return "load_ptr";
+    case OP_PUSH_PTR:
+        return "push_ptr";
+    case OP_STORE_PTR:
+        return "store_ptr";
+    case OP_RETV:
+        return "retv";
+    case OP_LOAD_ARG:
+        return "load_arg";
+    case OP_STORE_ARG:
+        return "store_arg";
+    case OP_LOAD_LOCAL:
+        return "load_local";
+    case OP_STORE_LOCAL:
+        return "store_local";
+    case OP_LOAD_PUSH_IADD:
+        return "load_push_iadd";
+    case OP_PUSHI_JNEQ:
+    case OP_PUSH_JNEQ:
+        return "push_ijneq";
+    case OP_DUP_STORE:
+        return "dup_store";
+    case OP_IADDI:
+        return "iaddi";
+    case OP_ISUBI:
+        return "isubi";
+    case OP_IMULI:
+        return "imuli";
+    case OP_INC:
+        return "inc";
+    case OP_DEC:
+        return "dec";
+    case OP_IJLTI:
+        return "ijlti";
+    case OP_AND:
+        return "and";
+    case OP_OR:
+        return "or";
+    case OP_XOR:
+        return "xor";
+    case OP_SHL:
+        return "shl";
+    case OP_SHR:
+        return "shr";
+    case OP_MOD:
+        return "mod";
+    case OP_I2F:
+        return "i2f";
+    case OP_F2I:
+        return "f2i";
+    case OP_VECTOR:
+        // every kernel has its own mnemonic.
+        if (instruction.operands[0].as_u64 < VEC_COUNT)
+            return maya_vector_entries[instruction.operands[0].as_u64].name;
+        return "vector";
+    default:
+        return "invalid opcode";
+    }
+}
@@ -0,0 +1,88 @@
+#include <stdint.h>
+
+#include "maya.h"
+
+typedef struct MayaFusion_t {
+    MayaOpCode fused;
+    MayaOpCode first;
+    MayaOpCode second;
+} MayaFusion;
+
+static const MayaFusion fusions[] = {
+    {OP_LOAD_PUSH_IADD, OP_LOAD_S, OP_PUSH_S},
+    {OP_PUSHI_JNEQ, OP_PUSH_S, OP_IJNEQ},
+    {OP_PUSH_JNEQ, OP_PUSH, OP_IJNEQ},
+    {OP_DUP_STORE, OP_DUP_S, OP_STORE_S},
+};
+
+#define FUSIONS_SIZE (sizeof(fusions) / sizeof(fusions[0]))
+
+// checks the whole sequence a superinstruction replaces starting at code.
+static bool match_fusion(const MayaFusion* fusion, const uint8_t* code, size_t available) {
+    if (available < maya_instruction_size(fusion->fused))
+        return false;
+
+    size_t first_size = maya_instruction_size(fusion->first);
+    if (code[0] != fusion->first || code[first_size] != fusion->second)
+        return false;
+
+    switch (fusion->fused) {
+    case OP_LOAD_PUSH_IADD:
+        return code[first_size + maya_instruction_size(OP_PUSH_S)] == OP_IADD;
+    case OP_DUP_STORE:
+        return code[1] == 1;
+    default:
+        return true;
+    }
+}
+
+// only the pair heading the sequence is profiled, that is what a superinstruction saves a dispatch on.
+static bool fusion_is_hot(const MayaFusion* fusion, const MayaPairProfile* profile) {
+    if (profile == NULL)
+        return true;
+
+    if (profile->total == 0)
+        return false;
+
+    return profile->pairs[fusion->first][fusion->second] * 100 >= profile->total * MAYA_FUSION_THRESHOLD;
+}
+
+// rewrites the first opcode of every matching sequence into its superinstruction. without a
+// profile every known sequence is fused, otherwise only those whose pair is hot in the profile.
+void maya_fuse_program(uint8_t* program, size_t program_size, const MayaPairProfile* profile) {
+    size_t rip = 0;
+    while (rip < program_size) {
+        size_t size = maya_instruction_size(program[rip]);
+        if (size == 0)
+            return;
+
+        for (size_t i = 0; i < FUSIONS_SIZE; i++) {
+            if (match_fusion(&fusions[i], &program[rip], program_size - rip) && fusion_is_hot(&fusions[i], profile)) {
+                program[rip] = fusions[i].fused;
+                size = maya_instruction_size(fusions[i].fused);
+                break;
+            }
+        }
+
+        rip += size;
+    }
+}
+
+void maya_unfuse_program(uint8_t* program, size_t program_size) {
+    size_t rip = 0;
+    while (rip < program_size) {
+        size_t size = maya_instruction_size(program[rip]);
+        if (size == 0)
+            return;
+
+        for (size_t i = 0; i < FUSIONS_SIZE; i++) {
+            if (program[rip] == fusions[i].fused) {
+                program[rip] = fusions[i].first;
+                size = maya_instruction_size(fusions[i].first);
+                break;
+            }
+        }
+
+        rip += size;
+    }
+}
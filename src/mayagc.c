@@ -0,0 +1,556 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "maya.h"
+
+// built into both the vm and the stdlib, like mayaout.c: the gc_* natives allocate, the vm runs
+// the write barrier of push_ptr and releases the heap with itself.
+//
+// small objects live in cells of one size class carved from HEAP_CHUNK_SIZE aligned chunks, large
+// ones get chunks of their own, so any word can be mapped to the object it points into with one
+// hash lookup. roots are found by scanning the stack and the registers conservatively.
+//
+// collection is an incremental mark-sweep. a cycle starts once the heap allocated as much as
+// survived the previous one, then every allocation marks a bounded amount proportional to its
+// size. values stored into the heap by push_ptr or memcpy are shaded while marking, the roots are
+// scanned again when the grey set runs empty, and chunks are then swept a few at a time.
+
+#define HEAP_CHUNK_SHIFT 18
+#define HEAP_CHUNK_SIZE ((size_t)1 << HEAP_CHUNK_SHIFT)
+#define HEAP_CLASSES 8 // cells of 16 to 2048 bytes
+#define HEAP_LARGE HEAP_CLASSES
+#define HEAP_MIN_CELL 16
+#define HEAP_MAX_CELL (HEAP_MIN_CELL << (HEAP_CLASSES - 1))
+#define HEAP_MIN_TRIGGER ((size_t)4 << 20)
+#define HEAP_MARK_RATIO 4 // bytes marked per byte allocated
+#define HEAP_MARK_SLACK 4096
+#define HEAP_PAUSE_BUCKETS 256
+
+#define CELL_ALLOCATED 1
+#define CELL_MARKED 2
+
+#define EMPTY_KEY 0
+#define TOMBSTONE_KEY UINTPTR_MAX
+
+typedef struct HeapChunk_t {
+    uint8_t* base;
+    size_t size; // bytes, a multiple of HEAP_CHUNK_SIZE for large objects
+    size_t cell_size;
+    size_t cells;
+    size_t live;
+    uint8_t* flags; // CELL_ALLOCATED and CELL_MARKED per cell
+    bool swept;
+    struct HeapChunk_t* next;
+} HeapChunk;
+
+typedef struct HeapSlot_t {
+    uintptr_t key; // chunk number, address >> HEAP_CHUNK_SHIFT
+    HeapChunk* chunk;
+} HeapSlot;
+
+typedef struct HeapGrey_t {
+    uint8_t* start;
+    size_t size;
+} HeapGrey;
+
+typedef enum HeapPhase_t {
+    PHASE_IDLE,
+    PHASE_MARKING,
+    PHASE_SWEEPING,
+} HeapPhase;
+
+struct MayaHeap_t {
+    HeapChunk* chunks[HEAP_CLASSES + 1];
+    HeapChunk** sweep_cursor[HEAP_CLASSES + 1];
+    void* free_lists[HEAP_CLASSES];
+
+    HeapSlot* slots;
+    size_t slots_used; // keys and tombstones
+    size_t slots_cap;
+
+    HeapGrey* grey;
+    size_t grey_size;
+    size_t grey_cap;
+    bool grey_overflow; // an object was marked without room to grey it, the marked ones are rescanned
+
+    HeapPhase phase;
+    size_t allocated; // since the last cycle
+    size_t trigger;
+    size_t live; // bytes marked by the last cycle
+    size_t heap_size; // bytes of all chunks
+
+    size_t cycles;
+    size_t pauses;
+    uint64_t pause_max;
+    uint64_t pause_buckets[HEAP_PAUSE_BUCKETS];
+};
+
+static size_t size_class(size_t size) {
+    size_t class = 0;
+    while ((size_t)(HEAP_MIN_CELL << class) < size)
+        class++;
+
+    return class;
+}
+
+static size_t slot_index(uintptr_t key, size_t cap) {
+    return (size_t)((key * 0x9e3779b97f4a7c15) >> 32) & (cap - 1);
+}
+
+// room for the slots has to be reserved first, inserting never fails.
+static void insert_slot(MayaHeap* heap, uintptr_t key, HeapChunk* chunk) {
+    size_t i = slot_index(key, heap->slots_cap);
+    while (heap->slots[i].key != EMPTY_KEY && heap->slots[i].key != TOMBSTONE_KEY)
+        i = (i + 1) & (heap->slots_cap - 1);
+
+    if (heap->slots[i].key == EMPTY_KEY)
+        heap->slots_used++;
+
+    heap->slots[i] = (HeapSlot) {.key = key, .chunk = chunk};
+}
+
+// makes room for count more slots, growing the table until it stays under three quarters full.
+// returns false and leaves the table as it was when out of memory.
+static bool reserve_slots(MayaHeap* heap, size_t count) {
+    size_t cap = heap->slots_cap == 0 ? 64 : heap->slots_cap;
+    while ((heap->slots_used + count) * 4 > cap * 3)
+        cap *= 2;
+
+    if (cap == heap->slots_cap)
+        return true;
+
+    HeapSlot* slots = calloc(cap, sizeof(HeapSlot));
+    if (!slots)
+        return false;
+
+    HeapSlot* old = heap->slots;
+    size_t old_cap = heap->slots_cap;
+
+    heap->slots = slots;
+    heap->slots_cap = cap;
+    heap->slots_used = 0;
+
+    for (size_t i = 0; i < old_cap; i++)
+        if (old[i].key != EMPTY_KEY && old[i].key != TOMBSTONE_KEY)
+            insert_slot(heap, old[i].key, old[i].chunk);
+
+    free(old);
+    return true;
+}
+
+static HeapSlot* find_slot(const MayaHeap* heap, uintptr_t key) {
+    if (heap->slots_cap == 0)
+        return NULL;
+
+    size_t i = slot_index(key, heap->slots_cap);
+    while (heap->slots[i].key != EMPTY_KEY) {
+        if (heap->slots[i].key == key)
+            return &heap->slots[i];
+
+        i = (i + 1) & (heap->slots_cap - 1);
+    }
+
+    return NULL;
+}
+
+static HeapChunk* new_chunk(MayaHeap* heap, size_t class, size_t size) {
+    size_t chunk_size = class == HEAP_LARGE ? (size + HEAP_CHUNK_SIZE - 1) & ~(HEAP_CHUNK_SIZE - 1) : HEAP_CHUNK_SIZE;
+
+    size_t cell_size = class == HEAP_LARGE ? size : (size_t)HEAP_MIN_CELL << class;
+    size_t cells = class == HEAP_LARGE ? 1 : chunk_size / cell_size;
+
+    // everything the chunk needs is allocated before it is linked, so running out of memory
+    // leaves the heap as it was.
+    uint8_t* base = aligned_alloc(HEAP_CHUNK_SIZE, chunk_size);
+    HeapChunk* chunk = calloc(1, sizeof(HeapChunk));
+    uint8_t* flags = calloc(cells, 1);
+    if (!base || !chunk || !flags || !reserve_slots(heap, chunk_size / HEAP_CHUNK_SIZE)) {
+        free(base);
+        free(chunk);
+        free(flags);
+        return NULL;
+    }
+
+    chunk->base = base;
+    chunk->size = chunk_size;
+    chunk->cell_size = cell_size;
+    chunk->cells = cells;
+    chunk->flags = flags;
+    chunk->swept = true;
+    chunk->next = heap->chunks[class];
+    heap->chunks[class] = chunk;
+
+    // every chunk number the object covers maps back to it, for pointers into its middle.
+    for (size_t offset = 0; offset < chunk_size; offset += HEAP_CHUNK_SIZE)
+        insert_slot(heap, (uintptr_t)(base + offset) >> HEAP_CHUNK_SHIFT, chunk);
+
+    heap->heap_size += chunk_size;
+    return chunk;
+}
+
+static void release_chunk(MayaHeap* heap, HeapChunk* chunk) {
+    for (size_t offset = 0; offset < chunk->size; offset += HEAP_CHUNK_SIZE)
+        find_slot(heap, (uintptr_t)(chunk->base + offset) >> HEAP_CHUNK_SHIFT)->key = TOMBSTONE_KEY;
+
+    heap->heap_size -= chunk->size;
+    free(chunk->base);
+    free(chunk->flags);
+    free(chunk);
+}
+
+MayaHeap* maya_heap_create(void) {
+    MayaHeap* heap = calloc(1, sizeof(MayaHeap));
+    if (!heap)
+        return NULL;
+
+    heap->trigger = HEAP_MIN_TRIGGER;
+    return heap;
+}
+
+void maya_heap_destroy(MayaHeap* heap) {
+    for (size_t class = 0; class <= HEAP_LARGE; class++) {
+        HeapChunk* chunk = heap->chunks[class];
+        while (chunk != NULL) {
+            HeapChunk* next = chunk->next;
+            free(chunk->base);
+            free(chunk->flags);
+            free(chunk);
+            chunk = next;
+        }
+    }
+
+    free(heap->slots);
+    free(heap->grey);
+    free(heap);
+}
+
+// greys the object value points into, if any. anything that looks like a pointer counts.
+static void shade(MayaHeap* heap, uintptr_t value) {
+    HeapSlot* slot = find_slot(heap, value >> HEAP_CHUNK_SHIFT);
+    if (slot == NULL)
+        return;
+
+    HeapChunk* chunk = slot->chunk;
+    size_t cell = (value - (uintptr_t)chunk->base) / chunk->cell_size;
+    if (cell >= chunk->cells || chunk->flags[cell] != CELL_ALLOCATED)
+        return;
+
+    chunk->flags[cell] |= CELL_MARKED;
+
+    if (heap->grey_size == heap->grey_cap) {
+        size_t grey_cap = heap->grey_cap == 0 ? 256 : heap->grey_cap * 2;
+        HeapGrey* grey = realloc(heap->grey, grey_cap * sizeof(HeapGrey));
+
+        // the object stays marked, mark finds it again among the marked ones.
+        if (!grey) {
+            heap->grey_overflow = true;
+            return;
+        }
+
+        heap->grey = grey;
+        heap->grey_cap = grey_cap;
+    }
+
+    heap->grey[heap->grey_size++] = (HeapGrey) {
+        .start = chunk->base + cell * chunk->cell_size,
+        .size = chunk->cell_size,
+    };
+}
+
+static void shade_range(MayaHeap* heap, const void* start, size_t size) {
+    const uint8_t* bytes = start;
+    for (size_t offset = 0; offset + sizeof(uintptr_t) <= size; offset += sizeof(uintptr_t)) {
+        uintptr_t value;
+        memcpy(&value, bytes + offset, sizeof(value));
+        shade(heap, value);
+    }
+}
+
+static void scan_roots(MayaHeap* heap, const MayaVm* maya) {
+    shade_range(heap, maya->stack, maya->sp * sizeof(Frame));
+    shade_range(heap, maya->registers, sizeof(maya->registers));
+}
+
+// scans every marked object again, for the ones shade could not grey. rescanning the others
+// shades nothing new.
+static void rescan_marked(MayaHeap* heap) {
+    for (size_t class = 0; class <= HEAP_LARGE; class++)
+        for (HeapChunk* chunk = heap->chunks[class]; chunk != NULL; chunk = chunk->next)
+            for (size_t i = 0; i < chunk->cells; i++)
+                if (chunk->flags[i] & CELL_MARKED)
+                    shade_range(heap, chunk->base + i * chunk->cell_size, chunk->cell_size);
+}
+
+// scans grey objects until budget bytes were scanned, a large object is scanned in pieces.
+// returns true once nothing is left grey.
+static bool mark(MayaHeap* heap, size_t budget) {
+    for (;;) {
+        while (heap->grey_size > 0) {
+            HeapGrey* grey = &heap->grey[heap->grey_size - 1];
+
+            if (grey->size > budget) {
+                uint8_t* start = grey->start;
+                grey->start += budget & ~(sizeof(uintptr_t) - 1);
+                grey->size -= budget & ~(sizeof(uintptr_t) - 1);
+                shade_range(heap, start, budget);
+                return false;
+            }
+
+            HeapGrey object = *grey;
+            heap->grey_size--;
+            budget -= object.size;
+            shade_range(heap, object.start, object.size);
+        }
+
+        if (!heap->grey_overflow)
+            return true;
+
+        // only after running out of memory. a rescan that overflows again marked more objects, so
+        // this ends.
+        heap->grey_overflow = false;
+        rescan_marked(heap);
+    }
+}
+
+static void start_sweep(MayaHeap* heap) {
+    heap->live = 0;
+    for (size_t class = 0; class <= HEAP_LARGE; class++) {
+        for (HeapChunk* chunk = heap->chunks[class]; chunk != NULL; chunk = chunk->next)
+            chunk->swept = false;
+
+        heap->sweep_cursor[class] = &heap->chunks[class];
+    }
+
+    // free cells are found again by the sweep, chunk by chunk.
+    memset(heap->free_lists, 0, sizeof(heap->free_lists));
+    heap->phase = PHASE_SWEEPING;
+}
+
+// frees the unmarked cells of the chunk under the cursor of class, releasing it when nothing in
+// it survived. returns false when the class is swept.
+static bool sweep_chunk(MayaHeap* heap, size_t class) {
+    HeapChunk** cursor = heap->sweep_cursor[class];
+    while (*cursor != NULL && (*cursor)->swept)
+        cursor = &(*cursor)->next;
+
+    heap->sweep_cursor[class] = cursor;
+    if (*cursor == NULL)
+        return false;
+
+    HeapChunk* chunk = *cursor;
+    chunk->live = 0;
+    for (size_t i = 0; i < chunk->cells; i++) {
+        if (chunk->flags[i] == (CELL_ALLOCATED | CELL_MARKED)) {
+            chunk->flags[i] = CELL_ALLOCATED;
+            chunk->live++;
+        } else {
+            chunk->flags[i] = 0;
+        }
+    }
+
+    heap->live += chunk->live * chunk->cell_size;
+
+    if (chunk->live == 0) {
+        *cursor = chunk->next;
+        release_chunk(heap, chunk);
+        return true;
+    }
+
+    chunk->swept = true;
+    if (class != HEAP_LARGE) {
+        for (size_t i = chunk->cells; i > 0; i--) {
+            if (chunk->flags[i - 1] != 0)
+                continue;
+
+            void* cell = chunk->base + (i - 1) * chunk->cell_size;
+            *(void**)cell = heap->free_lists[class];
+            heap->free_lists[class] = cell;
+        }
+    }
+
+    heap->sweep_cursor[class] = &chunk->next;
+    return true;
+}
+
+static void finish_sweep(MayaHeap* heap) {
+    heap->phase = PHASE_IDLE;
+    heap->allocated = 0;
+    heap->trigger = heap->live > HEAP_MIN_TRIGGER ? heap->live : HEAP_MIN_TRIGGER;
+    heap->cycles++;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// pauses are kept in buckets of a quarter of a power of two, enough for percentiles.
+static size_t pause_bucket(uint64_t ns) {
+    if (ns < 4)
+        return ns;
+
+    size_t bits = 63 - __builtin_clzll(ns);
+    size_t bucket = bits * 4 + ((ns >> (bits - 2)) & 3);
+    return bucket < HEAP_PAUSE_BUCKETS ? bucket : HEAP_PAUSE_BUCKETS - 1;
+}
+
+static uint64_t bucket_floor(size_t bucket) {
+    if (bucket < 4)
+        return bucket;
+
+    return (uint64_t)(4 + (bucket & 3)) << (bucket / 4 - 2);
+}
+
+// one bounded slice of collection work, paid for by an allocation of size bytes.
+static void step(MayaHeap* heap, const MayaVm* maya, size_t size) {
+    if (heap->phase == PHASE_IDLE && heap->allocated < heap->trigger)
+        return;
+
+    uint64_t start = now_ns();
+
+    switch (heap->phase) {
+    case PHASE_IDLE:
+        heap->phase = PHASE_MARKING;
+        scan_roots(heap, maya);
+        break;
+    case PHASE_MARKING:
+        if (mark(heap, size * HEAP_MARK_RATIO + HEAP_MARK_SLACK)) {
+            // the roots are not behind a barrier, whatever they gained since goes grey now.
+            scan_roots(heap, maya);
+            mark(heap, SIZE_MAX);
+            start_sweep(heap);
+        }
+        break;
+    case PHASE_SWEEPING: {
+        bool swept = false;
+        for (size_t class = 0; class <= HEAP_LARGE && !swept; class++)
+            swept = sweep_chunk(heap, class);
+
+        if (!swept)
+            finish_sweep(heap);
+        break;
+    }
+    }
+
+    uint64_t pause = now_ns() - start;
+    heap->pauses++;
+    heap->pause_buckets[pause_bucket(pause)]++;
+    if (pause > heap->pause_max)
+        heap->pause_max = pause;
+}
+
+void* maya_heap_alloc(MayaHeap* heap, const MayaVm* maya, size_t size) {
+    // large objects are rounded up to whole chunks, a size that would wrap around cannot exist.
+    if (size > SIZE_MAX - HEAP_CHUNK_SIZE)
+        return NULL;
+
+    size = size != 0 ? size : 1;
+    step(heap, maya, size);
+
+    size_t class = size > HEAP_MAX_CELL ? HEAP_LARGE : size_class(size);
+
+    uint8_t* cell;
+    HeapChunk* chunk;
+    if (class == HEAP_LARGE) {
+        chunk = new_chunk(heap, class, size);
+        if (!chunk)
+            return NULL;
+
+        cell = chunk->base;
+    } else {
+        // sweep lazily before growing, the cells of this class may already be garbage.
+        while (heap->free_lists[class] == NULL && heap->phase == PHASE_SWEEPING && sweep_chunk(heap, class))
+            ;
+
+        if (heap->free_lists[class] == NULL) {
+            chunk = new_chunk(heap, class, size);
+            if (!chunk)
+                return NULL;
+
+            for (size_t i = chunk->cells; i > 0; i--) {
+                void* free_cell = chunk->base + (i - 1) * chunk->cell_size;
+                *(void**)free_cell = heap->free_lists[class];
+                heap->free_lists[class] = free_cell;
+            }
+        }
+
+        cell = heap->free_lists[class];
+        heap->free_lists[class] = *(void**)cell;
+        chunk = find_slot(heap, (uintptr_t)cell >> HEAP_CHUNK_SHIFT)->chunk;
+    }
+
+    // objects allocated while marking are black, they survive the cycle.
+    size_t index = (cell - chunk->base) / chunk->cell_size;
+    chunk->flags[index] = heap->phase == PHASE_MARKING ? CELL_ALLOCATED | CELL_MARKED : CELL_ALLOCATED;
+
+    memset(cell, 0, chunk->cell_size);
+    heap->allocated += chunk->cell_size;
+    return cell;
+}
+
+void maya_heap_collect(MayaHeap* heap, const MayaVm* maya) {
+    uint64_t start = now_ns();
+
+    // finish the cycle in progress, then run a whole one with the roots as they are now.
+    for (size_t i = 0; i < 2; i++) {
+        if (heap->phase == PHASE_IDLE) {
+            heap->phase = PHASE_MARKING;
+            scan_roots(heap, maya);
+        }
+
+        if (heap->phase == PHASE_MARKING) {
+            mark(heap, SIZE_MAX);
+            scan_roots(heap, maya);
+            mark(heap, SIZE_MAX);
+            start_sweep(heap);
+        }
+
+        for (size_t class = 0; class <= HEAP_LARGE; class++)
+            while (sweep_chunk(heap, class))
+                ;
+
+        finish_sweep(heap);
+    }
+
+    uint64_t pause = now_ns() - start;
+    heap->pauses++;
+    heap->pause_buckets[pause_bucket(pause)]++;
+    if (pause > heap->pause_max)
+        heap->pause_max = pause;
+}
+
+void maya_heap_barrier(MayaHeap* heap, Frame value) {
+    if (heap->phase == PHASE_MARKING)
+        shade(heap, (uintptr_t)value.as_u64);
+}
+
+void maya_heap_barrier_range(MayaHeap* heap, const void* start, size_t size) {
+    if (heap->phase == PHASE_MARKING)
+        shade_range(heap, start, size);
+}
+
+void maya_heap_report(const MayaHeap* heap) {
+    double percentiles[] = {50, 90, 99, 99.9};
+    uint64_t values[4] = {0};
+
+    for (size_t p = 0; p < 4; p++) {
+        uint64_t rank = (uint64_t)((double)heap->pauses * percentiles[p] / 100.0);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < HEAP_PAUSE_BUCKETS; i++) {
+            seen += heap->pause_buckets[i];
+            if (seen > rank) {
+                values[p] = bucket_floor(i);
+                break;
+            }
+        }
+    }
+
+    fprintf(stderr, "gc: %zu cycles, %zu pauses, p50 %.1fus p90 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus, "
+            "live %zu KB, heap %zu KB\n",
+            heap->cycles, heap->pauses, values[0] / 1e3, values[1] / 1e3, values[2] / 1e3, values[3] / 1e3,
+            heap->pause_max / 1e3, heap->live >> 10, heap->heap_size >> 10);
+}
@@ -0,0 +1,1160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "maya.h"
+
+#if defined(__x86_64__)
+
+// machine state while jitted code runs:
+//   rbx  MayaVm*
+//   r12  &maya->stack[0]
+//   r13  maya->sp
+//   r14  &maya->registers[0]
+//   r15  rip -> native code table
+//   rbp  maya->bp
+//   r8, r9, r10, r11, rdi  maya->registers[0..4], written back on exit and around natives
+// rip is kept in rsi on the way out so the exit stub can write it back.
+
+#define JIT_BAILOUT 0x100
+
+#define RAX 0
+#define RCX 1
+#define RSI 6
+
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_P 0xA
+#define CC_L 0xC
+#define CC_G 0xF
+
+#define JIT_CACHED_REGISTERS 5
+
+static const uint8_t cached_registers[JIT_CACHED_REGISTERS] = {8, 9, 10, 11, 7};
+
+typedef struct MayaJitPatch_t {
+    size_t position; // of the rel32 to patch
+    size_t target;   // rip
+} MayaJitPatch;
+
+typedef struct MayaJitCompiler_t {
+    uint8_t* code;
+    size_t len;
+    size_t cap;
+
+    MayaJitPatch* patches;
+    size_t patches_size;
+    size_t patches_cap;
+
+    // set once a buffer cannot grow, everything emitted afterwards is dropped and the compilation
+    // is abandoned at the end.
+    bool out_of_memory;
+
+    const bool* boundaries;
+    size_t program_size;
+    size_t stack_limit;
+    size_t exit_stub;
+
+    // within a basic block sp is tracked at compile time and only committed to r13 when needed.
+    int32_t sp_delta;
+    // rax holds stack[sp - 1].
+    bool tos;
+} MayaJitCompiler;
+
+struct MayaJit_t {
+    uint8_t* code;
+    size_t code_size;
+    void** natives_table;
+    void* entry;
+};
+
+static void emit_u8(MayaJitCompiler* c, uint8_t byte) {
+    if (c->out_of_memory)
+        return;
+
+    if (c->len == c->cap) {
+        size_t cap = c->cap == 0 ? 4096 : c->cap * 2;
+        uint8_t* code = realloc(c->code, cap);
+        if (!code) {
+            c->out_of_memory = true;
+            return;
+        }
+
+        c->code = code;
+        c->cap = cap;
+    }
+
+    c->code[c->len++] = byte;
+}
+
+static void emit_u32(MayaJitCompiler* c, uint32_t value) {
+    for (size_t i = 0; i < sizeof(value); i++)
+        emit_u8(c, (value >> (i * 8)) & 0xff);
+}
+
+static void emit_u64(MayaJitCompiler* c, uint64_t value) {
+    for (size_t i = 0; i < sizeof(value); i++)
+        emit_u8(c, (value >> (i * 8)) & 0xff);
+}
+
+static void patch_rel32(MayaJitCompiler* c, size_t position, size_t target) {
+    if (c->out_of_memory)
+        return;
+
+    int32_t rel = (int32_t)((int64_t)target - (int64_t)(position + 4));
+    memcpy(&c->code[position], &rel, sizeof(rel));
+}
+
+// short jumps are emitted with a zero displacement and patched once the target is emitted.
+static size_t emit_jcc8(MayaJitCompiler* c, uint8_t cc) {
+    emit_u8(c, 0x70 | cc);
+    emit_u8(c, 0);
+    return c->len - 1;
+}
+
+static void patch_rel8(MayaJitCompiler* c, size_t position) {
+    if (c->out_of_memory)
+        return;
+
+    c->code[position] = (uint8_t)(c->len - (position + 1));
+}
+
+static void emit_jmp32(MayaJitCompiler* c, size_t target) {
+    emit_u8(c, 0xE9);
+    emit_u32(c, 0);
+    patch_rel32(c, c->len - 4, target);
+}
+
+#define SLOT(n) ((int32_t)(n) * (int32_t)sizeof(Frame))
+
+// <prefix> <rex> <op...> with [r12 + r13 * 8 + disp] as the memory operand, i.e. stack[sp + n].
+static void emit_stack_slot(MayaJitCompiler* c, uint8_t prefix, uint8_t rex, uint8_t op, int op2, uint8_t reg, int32_t n) {
+    if (prefix)
+        emit_u8(c, prefix);
+
+    emit_u8(c, rex | 0x03 | ((reg & 8) ? 0x04 : 0));
+    emit_u8(c, op);
+    if (op2 >= 0)
+        emit_u8(c, op2);
+
+    emit_u8(c, (2 << 6) | ((reg & 7) << 3) | 4);
+    emit_u8(c, (3 << 6) | (5 << 3) | 4);
+    emit_u32(c, (uint32_t)SLOT(n + c->sp_delta));
+}
+
+// 64 bit op with [r12 + rbp * 8 + disp] as the memory operand, i.e. stack[bp + n].
+static void emit_frame_slot(MayaJitCompiler* c, uint8_t op, uint8_t reg, int32_t n) {
+    emit_u8(c, 0x49 | ((reg & 8) ? 0x04 : 0));
+    emit_u8(c, op);
+    emit_u8(c, (2 << 6) | ((reg & 7) << 3) | 4);
+    emit_u8(c, (3 << 6) | (5 << 3) | 4);
+    emit_u32(c, (uint32_t)SLOT(n));
+}
+
+// 64 bit op with [r14 + disp] as the memory operand, i.e. a vm register.
+static void emit_register_slot(MayaJitCompiler* c, uint8_t op, uint8_t reg, size_t index) {
+    emit_u8(c, 0x49 | ((reg & 8) ? 0x04 : 0));
+    emit_u8(c, op);
+    emit_u8(c, (2 << 6) | ((reg & 7) << 3) | 6);
+    emit_u32(c, (uint32_t)SLOT(index));
+}
+
+// 64 bit op with [rbx + disp] as the memory operand, i.e. a MayaVm field.
+static void emit_vm_field(MayaJitCompiler* c, uint8_t op, uint8_t reg, size_t offset) {
+    emit_u8(c, 0x48 | ((reg & 8) ? 0x04 : 0));
+    emit_u8(c, op);
+    emit_u8(c, (2 << 6) | ((reg & 7) << 3) | 3);
+    emit_u32(c, (uint32_t)offset);
+}
+
+// mov rax, reg
+static void emit_mov_from(MayaJitCompiler* c, uint8_t reg) {
+    emit_u8(c, 0x48 | ((reg & 8) ? 0x04 : 0));
+    emit_u8(c, 0x89);
+    emit_u8(c, 0xC0 | ((reg & 7) << 3));
+}
+
+// mov reg, rax
+static void emit_mov_to(MayaJitCompiler* c, uint8_t reg) {
+    emit_u8(c, 0x48 | ((reg & 8) ? 0x01 : 0));
+    emit_u8(c, 0x89);
+    emit_u8(c, 0xC0 | (reg & 7));
+}
+
+static bool fits_i32(uint64_t value) {
+    return (int64_t)value >= INT32_MIN && (int64_t)value <= INT32_MAX;
+}
+
+// mov rax, imm
+static void emit_mov_rax(MayaJitCompiler* c, uint64_t value) {
+    if (fits_i32(value)) {
+        emit_u8(c, 0x48); emit_u8(c, 0xC7); emit_u8(c, 0xC0);
+        emit_u32(c, (uint32_t)value);
+    } else {
+        emit_u8(c, 0x48); emit_u8(c, 0xB8);
+        emit_u64(c, value);
+    }
+}
+
+// <op> with a vm register as the r/m operand, held in its cached register when it has one.
+// reg is a register or the opcode extension.
+static void emit_register_operand(MayaJitCompiler* c, uint8_t op, uint8_t reg, size_t index) {
+    if (index >= JIT_CACHED_REGISTERS) {
+        emit_register_slot(c, op, reg, index);
+        return;
+    }
+
+    uint8_t cached = cached_registers[index];
+    emit_u8(c, 0x48 | ((cached & 8) ? 0x01 : 0));
+    emit_u8(c, op);
+    emit_u8(c, 0xC0 | ((reg & 7) << 3) | (cached & 7));
+}
+
+static void emit_spill_registers(MayaJitCompiler* c) {
+    for (size_t i = 0; i < JIT_CACHED_REGISTERS; i++)
+        emit_register_slot(c, 0x89, cached_registers[i], i);
+}
+
+static void emit_reload_registers(MayaJitCompiler* c) {
+    for (size_t i = 0; i < JIT_CACHED_REGISTERS; i++)
+        emit_register_slot(c, 0x8B, cached_registers[i], i);
+}
+
+// add r13, imm
+static void emit_add_sp(MayaJitCompiler* c, int32_t value) {
+    if (value >= INT8_MIN && value <= INT8_MAX) {
+        emit_u8(c, 0x49); emit_u8(c, 0x83); emit_u8(c, 0xC5);
+        emit_u8(c, (uint8_t)value);
+    } else {
+        emit_u8(c, 0x49); emit_u8(c, 0x81); emit_u8(c, 0xC5);
+        emit_u32(c, (uint32_t)value);
+    }
+}
+
+// commits the pending sp adjustment to r13, clobbers the flags.
+static void emit_flush_sp(MayaJitCompiler* c) {
+    if (c->sp_delta != 0)
+        emit_add_sp(c, c->sp_delta);
+
+    c->sp_delta = 0;
+}
+
+// rcx = maya->fp
+static void emit_load_fp(MayaJitCompiler* c) {
+    emit_vm_field(c, 0x8B, RCX, offsetof(MayaVm, fp));
+}
+
+// rcx = &maya->frames[rcx]
+static void emit_frame_address(MayaJitCompiler* c) {
+    emit_u8(c, 0x48); emit_u8(c, 0xC1); emit_u8(c, 0xE1); emit_u8(c, 0x04);
+    emit_vm_field(c, 0x03, RCX, offsetof(MayaVm, frames));
+}
+
+// eax = result, esi = rip, then leave through the exit stub with sp committed.
+static void emit_exit(MayaJitCompiler* c, uint32_t result, uint32_t rip) {
+    if (c->sp_delta != 0)
+        emit_add_sp(c, c->sp_delta);
+
+    emit_u8(c, 0xB8);
+    emit_u32(c, result);
+    emit_u8(c, 0xBE);
+    emit_u32(c, rip);
+    emit_jmp32(c, c->exit_stub);
+}
+
+// leaves with the error when the flags satisfy fail_cc.
+static void emit_check(MayaJitCompiler* c, uint8_t fail_cc, MayaError error, uint32_t rip) {
+    size_t ok = emit_jcc8(c, fail_cc ^ 1);
+    emit_exit(c, error, rip);
+    patch_rel8(c, ok);
+}
+
+// cmp r13, imm32
+static void emit_cmp_sp(MayaJitCompiler* c, int64_t value) {
+    emit_u8(c, 0x49); emit_u8(c, 0x81); emit_u8(c, 0xFD);
+    emit_u32(c, (uint32_t)value);
+}
+
+static void emit_check_overflow(MayaJitCompiler* c, uint32_t rip) {
+    emit_cmp_sp(c, (int64_t)c->stack_limit - c->sp_delta);
+    emit_check(c, CC_AE, ERR_STACK_OVERFLOW, rip);
+}
+
+// room for pushed more frames, for natives that grow the stack behind the jit's back.
+static void emit_check_room(MayaJitCompiler* c, uint64_t pushed, uint32_t rip) {
+    emit_cmp_sp(c, (int64_t)c->stack_limit - (int64_t)pushed + 1 - c->sp_delta);
+    emit_check(c, CC_AE, ERR_STACK_OVERFLOW, rip);
+}
+
+static void emit_check_underflow(MayaJitCompiler* c, uint64_t needed, uint32_t rip) {
+    // r13 is never negative, so checks already covered by the block's own pushes vanish.
+    if ((int64_t)needed - c->sp_delta <= 0)
+        return;
+
+    emit_cmp_sp(c, (int64_t)needed - c->sp_delta);
+    emit_check(c, CC_B, ERR_STACK_UNDERFLOW, rip);
+}
+
+// rax divided by rcx, quotient in rax and remainder in rdx. idiv traps on INT64_MIN / -1, a
+// divisor of -1 negates rax and divides by 1 instead, leaving a remainder of 0.
+static void emit_idiv(MayaJitCompiler* c) {
+    emit_u8(c, 0x48); emit_u8(c, 0x83); emit_u8(c, 0xF9); emit_u8(c, 0xFF);
+    size_t other = emit_jcc8(c, CC_NE);
+    emit_u8(c, 0x48); emit_u8(c, 0xF7); emit_u8(c, 0xD8);
+    emit_u8(c, 0xB9); emit_u32(c, 1);
+    patch_rel8(c, other);
+
+    emit_u8(c, 0x48); emit_u8(c, 0x99);
+    emit_u8(c, 0x48); emit_u8(c, 0xF7); emit_u8(c, 0xF9);
+}
+
+// jumps to the native code of target, or bails out to the interpreter when target is not an
+// instruction boundary. cc < 0 means an unconditional jump. sp must be committed.
+static void emit_jump(MayaJitCompiler* c, int cc, uint64_t target) {
+    if (target >= c->program_size || !c->boundaries[target]) {
+        size_t skip = 0;
+        if (cc >= 0)
+            skip = emit_jcc8(c, cc ^ 1);
+
+        emit_exit(c, JIT_BAILOUT, (uint32_t)target);
+
+        if (cc >= 0)
+            patch_rel8(c, skip);
+        return;
+    }
+
+    if (cc >= 0) {
+        emit_u8(c, 0x0F);
+        emit_u8(c, 0x80 | cc);
+    } else {
+        emit_u8(c, 0xE9);
+    }
+
+    if (c->patches_size == c->patches_cap && !c->out_of_memory) {
+        size_t patches_cap = c->patches_cap == 0 ? 64 : c->patches_cap * 2;
+        MayaJitPatch* patches = realloc(c->patches, sizeof(MayaJitPatch) * patches_cap);
+        if (patches) {
+            c->patches = patches;
+            c->patches_cap = patches_cap;
+        } else {
+            c->out_of_memory = true;
+        }
+    }
+
+    if (!c->out_of_memory)
+        c->patches[c->patches_size++] = (MayaJitPatch) {.position = c->len, .target = target};
+
+    emit_u32(c, 0);
+}
+
+static int int_condition(uint8_t opcode) {
+    switch (opcode) {
+    case OP_IJEQ:
+        return CC_E;
+    case OP_IJNEQ:
+        return CC_NE;
+    case OP_IJGT:
+        return CC_G;
+    default:
+        return CC_L;
+    }
+}
+
+// push k folded into the iadd, isub or integer jump that consumes it.
+static void compile_push_folded(MayaJitCompiler* c, size_t rip, uint64_t k, MayaInstruction next, size_t next_rip) {
+    emit_check_overflow(c, (uint32_t)rip);
+    emit_stack_slot(c, 0, 0x48, 0xC7, -1, 0, 0);
+    emit_u32(c, (uint32_t)k);
+    c->sp_delta++;
+
+    emit_check_underflow(c, 2, (uint32_t)next_rip);
+    if (!c->tos)
+        emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+
+    switch (next.opcode) {
+    case OP_IADD:
+    case OP_ISUB:
+        emit_u8(c, 0x48); emit_u8(c, next.opcode == OP_IADD ? 0x05 : 0x2D);
+        emit_u32(c, (uint32_t)k);
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    default:
+        c->sp_delta -= 2;
+        emit_flush_sp(c);
+        emit_u8(c, 0x48); emit_u8(c, 0x3D);
+        emit_u32(c, (uint32_t)k);
+        emit_jump(c, int_condition(next.opcode), next.operands[0].as_u64);
+        c->tos = false;
+        break;
+    }
+}
+
+static void compile_instruction(MayaJitCompiler* c, const MayaVm* maya, size_t rip, size_t size, MayaInstruction instruction, size_t dispatch) {
+    uint32_t at = (uint32_t)rip;
+    uint64_t operand = instruction.operands[0].as_u64;
+
+    switch (instruction.opcode) {
+    case OP_HALT:
+        emit_u8(c, 0xC6); emit_u8(c, 0x83); emit_u32(c, offsetof(MayaVm, halt)); emit_u8(c, 1);
+        emit_exit(c, ERR_OK, at);
+        break;
+    case OP_PUSH:
+    case OP_PUSH_S:
+        emit_check_overflow(c, at);
+        emit_mov_rax(c, operand);
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, 0);
+        c->sp_delta++;
+        c->tos = true;
+        break;
+    case OP_POP:
+        emit_check_underflow(c, 1, at);
+        c->sp_delta--;
+        c->tos = false;
+        break;
+    case OP_DUP:
+    case OP_DUP_S:
+        emit_check_overflow(c, at);
+        if (operand > c->stack_limit) {
+            emit_exit(c, ERR_STACK_UNDERFLOW, at);
+            break;
+        }
+
+        emit_check_underflow(c, operand, at);
+        if (operand != 1 || !c->tos)
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -(int32_t)operand);
+
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, 0);
+        c->sp_delta++;
+        c->tos = true;
+        break;
+    case OP_IADD:
+    case OP_ISUB:
+        emit_check_underflow(c, 2, at);
+        if (c->tos && instruction.opcode == OP_IADD) {
+            emit_stack_slot(c, 0, 0x48, 0x03, -1, RAX, -2);
+        } else if (c->tos) {
+            emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xC1);
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+            emit_u8(c, 0x48); emit_u8(c, 0x29); emit_u8(c, 0xC8);
+        } else {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+            emit_stack_slot(c, 0, 0x48, instruction.opcode == OP_IADD ? 0x03 : 0x2B, -1, RAX, -1);
+        }
+
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    case OP_IMUL:
+        emit_check_underflow(c, 2, at);
+        if (c->tos) {
+            emit_stack_slot(c, 0, 0x48, 0x0F, 0xAF, RAX, -2);
+        } else {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+            emit_stack_slot(c, 0, 0x48, 0x0F, 0xAF, RAX, -1);
+        }
+
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    case OP_IDIV:
+        emit_check_underflow(c, 2, at);
+        if (c->tos) {
+            emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xC1);
+        } else {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RCX, -1);
+        }
+
+        emit_u8(c, 0x48); emit_u8(c, 0x85); emit_u8(c, 0xC9);
+        emit_check(c, CC_E, ERR_DIV_BY_ZERO, at);
+        emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+        emit_idiv(c);
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    case OP_MOD:
+        // idiv leaves the remainder in rdx.
+        emit_check_underflow(c, 2, at);
+        if (c->tos) {
+            emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xC1);
+        } else {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RCX, -1);
+        }
+
+        emit_u8(c, 0x48); emit_u8(c, 0x85); emit_u8(c, 0xC9);
+        emit_check(c, CC_E, ERR_DIV_BY_ZERO, at);
+        emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+        emit_idiv(c);
+        emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xD0);
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR: {
+        uint8_t op = instruction.opcode == OP_AND ? 0x23 : instruction.opcode == OP_OR ? 0x0B : 0x33;
+
+        emit_check_underflow(c, 2, at);
+        if (c->tos) {
+            emit_stack_slot(c, 0, 0x48, op, -1, RAX, -2);
+        } else {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+            emit_stack_slot(c, 0, 0x48, op, -1, RAX, -1);
+        }
+
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    }
+    case OP_SHL:
+    case OP_SHR:
+        // shifts by cl only use its low 6 bits, like the interpreter.
+        emit_check_underflow(c, 2, at);
+        if (c->tos) {
+            emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xC1);
+        } else {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RCX, -1);
+        }
+
+        emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -2);
+        emit_u8(c, 0x48); emit_u8(c, 0xD3); emit_u8(c, instruction.opcode == OP_SHL ? 0xE0 : 0xE8);
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -2);
+        c->sp_delta--;
+        c->tos = true;
+        break;
+    case OP_I2F:
+        emit_check_underflow(c, 1, at);
+        if (!c->tos)
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -1);
+
+        // cvtsi2sd xmm0, rax
+        emit_u8(c, 0xF2); emit_u8(c, 0x48); emit_u8(c, 0x0F); emit_u8(c, 0x2A); emit_u8(c, 0xC0);
+        emit_stack_slot(c, 0xF2, 0x40, 0x0F, 0x11, 0, -1);
+        c->tos = false;
+        break;
+    case OP_F2I:
+        // cvttsd2si truncates, out of range values give INT64_MIN.
+        emit_check_underflow(c, 1, at);
+        emit_stack_slot(c, 0xF2, 0x48, 0x0F, 0x2C, RAX, -1);
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -1);
+        c->tos = true;
+        break;
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV: {
+        uint8_t sse = instruction.opcode == OP_FADD ? 0x58 : instruction.opcode == OP_FSUB ? 0x5C : instruction.opcode == OP_FMUL ? 0x59 : 0x5E;
+
+        emit_check_underflow(c, 2, at);
+        emit_stack_slot(c, 0xF2, 0x40, 0x0F, 0x10, 0, -2);
+        emit_stack_slot(c, 0xF2, 0x40, 0x0F, sse, 0, -1);
+        emit_stack_slot(c, 0xF2, 0x40, 0x0F, 0x11, 0, -2);
+        c->sp_delta--;
+        c->tos = false;
+        break;
+    }
+    case OP_JMP:
+        emit_flush_sp(c);
+        emit_jump(c, -1, operand);
+        break;
+    case OP_IJEQ:
+    case OP_IJNEQ:
+    case OP_IJGT:
+    case OP_IJLT:
+        emit_check_underflow(c, 2, at);
+        if (c->tos) {
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RCX, -2);
+            c->sp_delta -= 2;
+            emit_flush_sp(c);
+            emit_u8(c, 0x48); emit_u8(c, 0x39); emit_u8(c, 0xC1);
+        } else {
+            c->sp_delta -= 2;
+            emit_flush_sp(c);
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, 0);
+            emit_stack_slot(c, 0, 0x48, 0x3B, -1, RAX, 1);
+        }
+
+        emit_jump(c, int_condition(instruction.opcode), operand);
+        c->tos = false;
+        break;
+    case OP_FJEQ:
+    case OP_FJNEQ:
+    case OP_FJGT:
+    case OP_FJLT:
+        emit_check_underflow(c, 2, at);
+        c->sp_delta -= 2;
+        emit_flush_sp(c);
+
+        // ucomisd flags unordered operands as ZF = PF = CF = 1, which matches C comparisons with NaN.
+        if (instruction.opcode == OP_FJLT) {
+            emit_stack_slot(c, 0xF2, 0x40, 0x0F, 0x10, 0, 1);
+            emit_stack_slot(c, 0x66, 0x40, 0x0F, 0x2E, 0, 0);
+        } else {
+            emit_stack_slot(c, 0xF2, 0x40, 0x0F, 0x10, 0, 0);
+            emit_stack_slot(c, 0x66, 0x40, 0x0F, 0x2E, 0, 1);
+        }
+
+        if (instruction.opcode == OP_FJEQ) {
+            size_t unordered = emit_jcc8(c, CC_P);
+            emit_jump(c, CC_E, operand);
+            patch_rel8(c, unordered);
+        } else if (instruction.opcode == OP_FJNEQ) {
+            emit_jump(c, CC_P, operand);
+            emit_jump(c, CC_NE, operand);
+        } else {
+            emit_jump(c, CC_A, operand);
+        }
+
+        c->tos = false;
+        break;
+    case OP_CALL:
+        emit_flush_sp(c);
+        emit_load_fp(c);
+        emit_u8(c, 0x48); emit_u8(c, 0x81); emit_u8(c, 0xF9); emit_u32(c, (uint32_t)c->stack_limit);
+        emit_check(c, CC_AE, ERR_CALL_STACK_OVERFLOW, at);
+        emit_frame_address(c);
+        emit_mov_rax(c, rip + size);
+        emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0x01);
+        emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0x69); emit_u8(c, 0x08);
+        emit_u8(c, 0x4C); emit_u8(c, 0x89); emit_u8(c, 0xED);
+        emit_vm_field(c, 0xFF, 0, offsetof(MayaVm, fp));
+        emit_jump(c, -1, operand);
+        break;
+    case OP_RET:
+    case OP_RETV:
+        if (instruction.opcode == OP_RETV) {
+            emit_check_underflow(c, 1, at);
+            if (c->tos) {
+                emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xC6);
+            } else {
+                emit_stack_slot(c, 0, 0x48, 0x8B, -1, RSI, -1);
+            }
+        }
+
+        emit_flush_sp(c);
+        emit_load_fp(c);
+        emit_u8(c, 0x48); emit_u8(c, 0x85); emit_u8(c, 0xC9);
+        emit_check(c, CC_E, ERR_RET_OUTSIDE_CALL, at);
+
+        if (instruction.opcode == OP_RETV) {
+            emit_u8(c, 0x48); emit_u8(c, 0x81); emit_u8(c, 0xFD); emit_u32(c, (uint32_t)operand);
+            emit_check(c, CC_B, ERR_STACK_UNDERFLOW, at);
+
+            // stack[bp - n] = value, sp = bp - n + 1
+            emit_u8(c, 0x4C); emit_u8(c, 0x8D); emit_u8(c, 0xAD); emit_u32(c, (uint32_t)-(int32_t)operand);
+            emit_stack_slot(c, 0, 0x48, 0x89, -1, RSI, 0);
+            emit_u8(c, 0x49); emit_u8(c, 0xFF); emit_u8(c, 0xC5);
+        } else {
+            emit_u8(c, 0x49); emit_u8(c, 0x89); emit_u8(c, 0xED);
+        }
+
+        emit_u8(c, 0x48); emit_u8(c, 0xFF); emit_u8(c, 0xC9);
+        emit_vm_field(c, 0x89, RCX, offsetof(MayaVm, fp));
+        emit_frame_address(c);
+        emit_u8(c, 0x48); emit_u8(c, 0x8B); emit_u8(c, 0x01);
+        emit_u8(c, 0x48); emit_u8(c, 0x8B); emit_u8(c, 0x69); emit_u8(c, 0x08);
+        emit_jmp32(c, dispatch);
+        c->tos = false;
+        break;
+    case OP_LOAD_ARG:
+    case OP_STORE_ARG:
+        if (instruction.opcode == OP_LOAD_ARG) {
+            emit_check_overflow(c, at);
+        } else {
+            emit_check_underflow(c, 1, at);
+        }
+
+        // the argument exists when operand < bp.
+        emit_u8(c, 0x48); emit_u8(c, 0x81); emit_u8(c, 0xFD); emit_u32(c, (uint32_t)operand + 1);
+        emit_check(c, CC_B, ERR_STACK_UNDERFLOW, at);
+
+        if (instruction.opcode == OP_LOAD_ARG) {
+            emit_frame_slot(c, 0x8B, RAX, -1 - (int32_t)operand);
+            emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, 0);
+            c->sp_delta++;
+            c->tos = true;
+        } else {
+            if (!c->tos)
+                emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -1);
+
+            emit_frame_slot(c, 0x89, RAX, -1 - (int32_t)operand);
+            c->sp_delta--;
+            c->tos = false;
+        }
+        break;
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL: {
+        if (instruction.opcode == OP_LOAD_LOCAL) {
+            emit_check_overflow(c, at);
+        } else {
+            emit_check_underflow(c, 1, at);
+        }
+
+        // the local exists when bp + operand < sp, sp being the one after the pop for a store.
+        int32_t top = c->sp_delta - (instruction.opcode == OP_STORE_LOCAL ? 1 : 0);
+        emit_u8(c, 0x48); emit_u8(c, 0x8D); emit_u8(c, 0x8D); emit_u32(c, (uint32_t)((int32_t)operand - top));
+        emit_u8(c, 0x4C); emit_u8(c, 0x39); emit_u8(c, 0xE9);
+        emit_check(c, CC_AE, ERR_STACK_UNDERFLOW, at);
+
+        if (instruction.opcode == OP_LOAD_LOCAL) {
+            emit_frame_slot(c, 0x8B, RAX, (int32_t)operand);
+            emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, 0);
+            c->sp_delta++;
+            c->tos = true;
+        } else {
+            if (!c->tos)
+                emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -1);
+
+            emit_frame_slot(c, 0x89, RAX, (int32_t)operand);
+            c->sp_delta--;
+            c->tos = false;
+        }
+        break;
+    }
+    case OP_NATIVE: {
+        if (operand >= maya->natives_size) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        // the declared effect turns the native's own stack checks into inline ones.
+        MayaNativeEffect effect = maya->natives_effects[operand];
+        emit_check_underflow(c, effect.arity, at);
+        if (effect.delta > 0)
+            emit_check_room(c, effect.delta, at);
+
+        // natives see the vm exactly like the interpreter leaves it.
+        emit_flush_sp(c);
+        emit_spill_registers(c);
+        emit_vm_field(c, 0x89, 13, offsetof(MayaVm, sp));
+        emit_vm_field(c, 0x89, 5, offsetof(MayaVm, bp));
+        emit_u8(c, 0xBE); emit_u32(c, at);
+        emit_vm_field(c, 0x89, 6, offsetof(MayaVm, rip));
+        emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xDF);
+        emit_u8(c, 0x48); emit_u8(c, 0xB8); emit_u64(c, (uint64_t)(uintptr_t)maya->natives[operand]);
+        emit_u8(c, 0xFF); emit_u8(c, 0xD0);
+        emit_vm_field(c, 0x8B, 13, offsetof(MayaVm, sp));
+        emit_reload_registers(c);
+        emit_u8(c, 0x85); emit_u8(c, 0xC0);
+        size_t ok = emit_jcc8(c, CC_E);
+        emit_u8(c, 0xBE); emit_u32(c, at);
+        emit_jmp32(c, c->exit_stub);
+        patch_rel8(c, ok);
+        c->tos = false;
+        break;
+    }
+    case OP_NATIVE_BATCH: {
+        uint64_t count = instruction.operands[1].as_u64;
+        if (operand >= maya->natives_size || maya->natives_batches[operand] == NULL) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        emit_check_underflow(c, count, at);
+
+        emit_flush_sp(c);
+        emit_spill_registers(c);
+        emit_vm_field(c, 0x89, 13, offsetof(MayaVm, sp));
+        emit_vm_field(c, 0x89, 5, offsetof(MayaVm, bp));
+        emit_u8(c, 0xBE); emit_u32(c, at);
+        emit_vm_field(c, 0x89, 6, offsetof(MayaVm, rip));
+        emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xDF);
+        // lea rsi, [r12 + r13 * 8 - count * 8]; mov edx, count
+        emit_u8(c, 0x4B); emit_u8(c, 0x8D); emit_u8(c, 0xB4); emit_u8(c, 0xEC); emit_u32(c, (uint32_t)(-(int32_t)count * 8));
+        emit_u8(c, 0xBA); emit_u32(c, (uint32_t)count);
+        emit_u8(c, 0x48); emit_u8(c, 0xB8); emit_u64(c, (uint64_t)(uintptr_t)maya->natives_batches[operand]);
+        emit_u8(c, 0xFF); emit_u8(c, 0xD0);
+        emit_reload_registers(c);
+        emit_u8(c, 0x85); emit_u8(c, 0xC0);
+        size_t ok = emit_jcc8(c, CC_E);
+        emit_u8(c, 0xBE); emit_u32(c, at);
+        emit_jmp32(c, c->exit_stub);
+        patch_rel8(c, ok);
+
+        // the slice is popped lazily like any other pop.
+        c->sp_delta -= (int32_t)count;
+        c->tos = false;
+        break;
+    }
+    case OP_VECTOR: {
+        if (operand >= VEC_COUNT) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        MayaNativeEffect effect = maya_vector_entries[operand].effect;
+        emit_check_underflow(c, effect.arity, at);
+
+        // maya_vector_run(maya, kernel, &stack[sp - arity]), it cannot fail.
+        emit_flush_sp(c);
+        emit_spill_registers(c);
+        emit_u8(c, 0x48); emit_u8(c, 0x89); emit_u8(c, 0xDF);
+        emit_u8(c, 0xBE); emit_u32(c, (uint32_t)operand);
+        emit_u8(c, 0x4B); emit_u8(c, 0x8D); emit_u8(c, 0x94); emit_u8(c, 0xEC); emit_u32(c, (uint32_t)(-(int32_t)effect.arity * 8));
+        emit_u8(c, 0x48); emit_u8(c, 0xB8); emit_u64(c, (uint64_t)(uintptr_t)maya_vector_run);
+        emit_u8(c, 0xFF); emit_u8(c, 0xD0);
+        emit_reload_registers(c);
+
+        c->sp_delta += effect.delta;
+        c->tos = false;
+        break;
+    }
+    case OP_LOAD:
+    case OP_LOAD_S:
+        emit_check_overflow(c, at);
+        if (operand >= MAYA_REGISTERS_CAP) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        if (operand < JIT_CACHED_REGISTERS) {
+            emit_mov_from(c, cached_registers[operand]);
+        } else {
+            emit_register_slot(c, 0x8B, RAX, operand);
+        }
+
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, 0);
+        c->sp_delta++;
+        c->tos = true;
+        break;
+    case OP_STORE:
+    case OP_STORE_S:
+        emit_check_underflow(c, 1, at);
+        if (operand >= MAYA_REGISTERS_CAP) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        if (!c->tos)
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -1);
+
+        if (operand < JIT_CACHED_REGISTERS) {
+            emit_mov_to(c, cached_registers[operand]);
+        } else {
+            emit_register_slot(c, 0x89, RAX, operand);
+        }
+
+        c->sp_delta--;
+        c->tos = false;
+        break;
+    case OP_IADDI:
+    case OP_ISUBI:
+    case OP_IMULI:
+        emit_check_underflow(c, 1, at);
+        if (!c->tos)
+            emit_stack_slot(c, 0, 0x48, 0x8B, -1, RAX, -1);
+
+        if (fits_i32(operand) && instruction.opcode == OP_IMULI) {
+            emit_u8(c, 0x48); emit_u8(c, 0x69); emit_u8(c, 0xC0);
+            emit_u32(c, (uint32_t)operand);
+        } else if (fits_i32(operand)) {
+            emit_u8(c, 0x48); emit_u8(c, instruction.opcode == OP_IADDI ? 0x05 : 0x2D);
+            emit_u32(c, (uint32_t)operand);
+        } else {
+            // mov rcx, imm64 then the register form.
+            emit_u8(c, 0x48); emit_u8(c, 0xB9); emit_u64(c, operand);
+            if (instruction.opcode == OP_IMULI) {
+                emit_u8(c, 0x48); emit_u8(c, 0x0F); emit_u8(c, 0xAF); emit_u8(c, 0xC1);
+            } else {
+                emit_u8(c, 0x48); emit_u8(c, instruction.opcode == OP_IADDI ? 0x01 : 0x29); emit_u8(c, 0xC8);
+            }
+        }
+
+        emit_stack_slot(c, 0, 0x48, 0x89, -1, RAX, -1);
+        c->tos = true;
+        break;
+    case OP_INC:
+    case OP_DEC:
+        if (operand >= MAYA_REGISTERS_CAP) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        emit_register_operand(c, 0xFF, instruction.opcode == OP_INC ? 0 : 1, operand);
+        break;
+    case OP_IJLTI: {
+        uint64_t k = instruction.operands[1].as_u64;
+        if (operand >= MAYA_REGISTERS_CAP) {
+            emit_exit(c, ERR_INVALID_OPERAND, at);
+            break;
+        }
+
+        // the stack is left alone, rax still holds its top when the branch is not taken.
+        emit_flush_sp(c);
+        if (fits_i32(k)) {
+            emit_register_operand(c, 0x81, 7, operand);
+            emit_u32(c, (uint32_t)k);
+        } else {
+            emit_u8(c, 0x48); emit_u8(c, 0xB9); emit_u64(c, k);
+            emit_register_operand(c, 0x39, RCX, operand);
+        }
+
+        emit_jump(c, CC_L, instruction.operands[2].as_u64);
+        break;
+    }
+    default:
+        // no template, the interpreter takes over from here.
+        emit_exit(c, JIT_BAILOUT, at);
+        break;
+    }
+}
+
+// the compiler tracks sp and whether rax holds the top of the stack within a basic block. stack
+// stores are always written through, so the vm state in memory is exact wherever the code exits,
+// calls a native or bails out to the interpreter. both are reset at leaders, the only places
+// entered from anywhere but the previous instruction.
+MayaJit* maya_jit_compile(const MayaVm* maya) {
+    size_t program_size = maya->program_size;
+
+    // compile from an unfused copy, so every jump target inside a fused sequence is a boundary.
+    // running out of memory anywhere leaves the program to the interpreter.
+    uint8_t* program = malloc(program_size == 0 ? 1 : program_size);
+    bool* boundaries = calloc(program_size + 1, sizeof(bool));
+    bool* leaders = calloc(program_size + 1, sizeof(bool));
+    size_t* offsets = malloc(sizeof(size_t) * (program_size + 1));
+    void** natives_table = calloc(program_size + 1, sizeof(void*));
+    MayaJitCompiler c = {0};
+    uint8_t* code = MAP_FAILED;
+    MayaJit* jit = NULL;
+    if (!program || !boundaries || !leaders || !offsets || !natives_table)
+        goto fail;
+
+    memcpy(program, maya->program, program_size);
+    maya_unfuse_program(program, program_size);
+
+    for (size_t rip = 0; rip < program_size;) {
+        size_t size = maya_instruction_size(program[rip]);
+        if (size == 0 || rip + size > program_size)
+            break;
+
+        boundaries[rip] = true;
+        rip += size;
+    }
+
+    leaders[maya->rip < program_size ? maya->rip : program_size] = true;
+    for (size_t rip = 0; rip < program_size && boundaries[rip];) {
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&program[rip], &instruction);
+
+        switch (instruction.opcode) {
+        case OP_CALL:
+            leaders[rip + size] = true;
+            // fallthrough
+        case OP_JMP:
+        case OP_IJEQ:
+        case OP_FJEQ:
+        case OP_IJNEQ:
+        case OP_FJNEQ:
+        case OP_IJGT:
+        case OP_FJGT:
+        case OP_IJLT:
+        case OP_FJLT:
+            if (instruction.operands[0].as_u64 < program_size)
+                leaders[instruction.operands[0].as_u64] = true;
+            break;
+        case OP_IJLTI:
+            if (instruction.operands[2].as_u64 < program_size)
+                leaders[instruction.operands[2].as_u64] = true;
+            break;
+        default:
+            break;
+        }
+
+        rip += size;
+    }
+
+    c.boundaries = boundaries;
+    c.program_size = program_size;
+    c.stack_limit = maya->stack_limit;
+
+    // exit stub: write the vm state back, restore the callee saved registers.
+    c.exit_stub = c.len;
+    emit_spill_registers(&c);
+    emit_vm_field(&c, 0x89, 13, offsetof(MayaVm, sp));
+    emit_vm_field(&c, 0x89, 5, offsetof(MayaVm, bp));
+    emit_vm_field(&c, 0x89, 6, offsetof(MayaVm, rip));
+    emit_u8(&c, 0x48); emit_u8(&c, 0x83); emit_u8(&c, 0xC4); emit_u8(&c, 0x08);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x5F);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x5E);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x5D);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x5C);
+    emit_u8(&c, 0x5D);
+    emit_u8(&c, 0x5B);
+    emit_u8(&c, 0xC3);
+
+    // dynamic dispatch on rax, used on entry and by ret. rips without native code bail out.
+    size_t dispatch = c.len;
+    emit_u8(&c, 0x48); emit_u8(&c, 0x3D); emit_u32(&c, (uint32_t)program_size);
+    size_t out_of_range = emit_jcc8(&c, CC_AE);
+    emit_u8(&c, 0x49); emit_u8(&c, 0x8B); emit_u8(&c, 0x0C); emit_u8(&c, 0xC7);
+    emit_u8(&c, 0x48); emit_u8(&c, 0x85); emit_u8(&c, 0xC9);
+    size_t not_compiled = emit_jcc8(&c, CC_E);
+    emit_u8(&c, 0xFF); emit_u8(&c, 0xE1);
+    patch_rel8(&c, out_of_range);
+    patch_rel8(&c, not_compiled);
+    emit_u8(&c, 0x48); emit_u8(&c, 0x89); emit_u8(&c, 0xC6);
+    emit_u8(&c, 0xB8); emit_u32(&c, JIT_BAILOUT);
+    emit_jmp32(&c, c.exit_stub);
+
+    // prologue
+    size_t entry = c.len;
+    emit_u8(&c, 0x53);
+    emit_u8(&c, 0x55);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x54);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x55);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x56);
+    emit_u8(&c, 0x41); emit_u8(&c, 0x57);
+    // six pushes and the return address, realign rsp for the calls to natives.
+    emit_u8(&c, 0x48); emit_u8(&c, 0x83); emit_u8(&c, 0xEC); emit_u8(&c, 0x08);
+    emit_u8(&c, 0x48); emit_u8(&c, 0x89); emit_u8(&c, 0xFB);
+    emit_u8(&c, 0x4C); emit_u8(&c, 0x8B); emit_u8(&c, 0xA3); emit_u32(&c, offsetof(MayaVm, stack));
+    emit_u8(&c, 0x4C); emit_u8(&c, 0x8D); emit_u8(&c, 0xB3); emit_u32(&c, offsetof(MayaVm, registers));
+    emit_vm_field(&c, 0x8B, 13, offsetof(MayaVm, sp));
+    emit_vm_field(&c, 0x8B, 5, offsetof(MayaVm, bp));
+    emit_reload_registers(&c);
+    emit_u8(&c, 0x49); emit_u8(&c, 0xBF); emit_u64(&c, (uint64_t)(uintptr_t)natives_table);
+    emit_vm_field(&c, 0x8B, RAX, offsetof(MayaVm, rip));
+    emit_jmp32(&c, dispatch);
+
+    for (size_t i = 0; i <= program_size; i++)
+        offsets[i] = SIZE_MAX;
+
+    size_t rip = 0;
+    while (rip < program_size && boundaries[rip]) {
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&program[rip], &instruction);
+
+        if (leaders[rip]) {
+            emit_flush_sp(&c);
+            c.tos = false;
+        }
+
+        offsets[rip] = c.len;
+
+        MayaInstruction next = {0};
+        size_t next_rip = rip + size;
+        if ((instruction.opcode == OP_PUSH || instruction.opcode == OP_PUSH_S) && fits_i32(instruction.operands[0].as_u64) &&
+            next_rip < program_size && boundaries[next_rip] && !leaders[next_rip])
+            maya_decode_instruction(&program[next_rip], &next);
+
+        switch (next.opcode) {
+        case OP_IADD:
+        case OP_ISUB:
+        case OP_IJEQ:
+        case OP_IJNEQ:
+        case OP_IJGT:
+        case OP_IJLT:
+            compile_push_folded(&c, rip, instruction.operands[0].as_u64, next, next_rip);
+            rip = next_rip + maya_instruction_size(next.opcode);
+            break;
+        default:
+            compile_instruction(&c, maya, rip, size, instruction, dispatch);
+            rip = next_rip;
+            break;
+        }
+    }
+
+    // running off the end of the compiled code is left to the interpreter as well.
+    emit_flush_sp(&c);
+    offsets[rip] = c.len;
+    emit_exit(&c, JIT_BAILOUT, (uint32_t)rip);
+
+    if (c.out_of_memory)
+        goto fail;
+
+    for (size_t i = 0; i < c.patches_size; i++)
+        patch_rel32(&c, c.patches[i].position, offsets[c.patches[i].target]);
+
+    code = mmap(NULL, c.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit = malloc(sizeof(MayaJit));
+    if (code == MAP_FAILED || !jit)
+        goto fail;
+
+    memcpy(code, c.code, c.len);
+    if (mprotect(code, c.len, PROT_READ | PROT_EXEC) != 0)
+        goto fail;
+
+    for (size_t i = 0; i < program_size; i++) {
+        if (leaders[i] && offsets[i] != SIZE_MAX)
+            natives_table[i] = code + offsets[i];
+    }
+
+    jit->code = code;
+    jit->code_size = c.len;
+    jit->natives_table = natives_table;
+    jit->entry = code + entry;
+
+    free(c.code);
+    free(c.patches);
+    free(offsets);
+    free(leaders);
+    free(boundaries);
+    free(program);
+
+    return jit;
+
+fail:
+    if (code != MAP_FAILED)
+        munmap(code, c.len);
+
+    free(jit);
+    free(c.code);
+    free(c.patches);
+    free(natives_table);
+    free(offsets);
+    free(leaders);
+    free(boundaries);
+    free(program);
+
+    return NULL;
+}
+
+#undef SLOT
+
+bool maya_jit_execute(MayaJit* jit, MayaVm* maya, MayaError* error) {
+    uint32_t (*entry)(MayaVm*) = (uint32_t (*)(MayaVm*))jit->entry;
+
+    uint32_t result = entry(maya);
+    if (result == JIT_BAILOUT)
+        return false;
+
+    *error = (MayaError)result;
+    return true;
+}
+
+void maya_jit_destroy(MayaJit* jit) {
+    munmap(jit->code, jit->code_size);
+    free(jit->natives_table);
+    free(jit);
+}
+
+#else
+
+MayaJit* maya_jit_compile(const MayaVm* maya) {
+    (void)maya;
+    return NULL;
+}
+
+bool maya_jit_execute(MayaJit* jit, MayaVm* maya, MayaError* error) {
+    (void)jit;
+    (void)maya;
+    (void)error;
+    return false;
+}
+
+void maya_jit_destroy(MayaJit* jit) {
+    (void)jit;
+}
+
+#endif
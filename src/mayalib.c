@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libmaya.h"
+
+#define MAYA_EXECUTE maya_execute_fueled
+#define MAYA_FUEL
+#include "mayaexec.inc"
+
+#define MAYA_EXECUTE maya_execute_fueled_unchecked
+#define MAYA_UNCHECKED
+#define MAYA_FUEL
+#include "mayaexec.inc"
+
+struct MayaProgram_t {
+    MayaVm image; // mapped, bound and verified, never runs
+    bool verified;
+};
+
+const char* maya_error_to_str(MayaError error) {
+    switch (error) {
+    case ERR_OK:
+        return "OK";
+    case ERR_STACK_OVERFLOW:
+        return "STACK OVERFLOW";
+    case ERR_STACK_UNDERFLOW:
+        return "STACK UNDERFLOW";
+    case ERR_INVALID_OPERAND:
+        return "INVALID OPERAND";
+    case ERR_INVALID_INSTRUCTION:
+        return "INVALID INSTRUCTION";
+    case ERR_DIV_BY_ZERO:
+        return "DIVIDE BY ZERO";
+    case ERR_NATIVE_STACK_EFFECT:
+        return "NATIVE STACK EFFECT MISMATCH";
+    case ERR_CALL_STACK_OVERFLOW:
+        return "CALL STACK OVERFLOW";
+    case ERR_RET_OUTSIDE_CALL:
+        return "RET OUTSIDE OF A CALL";
+    case ERR_OUT_OF_FUEL:
+        return "OUT OF FUEL";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+bool maya_vm_init(MayaVm* maya, size_t stack_limit, MayaSetupError* error) {
+    *maya = (MayaVm) {0};
+
+    if (!maya_stack_create(maya, stack_limit, error))
+        return false;
+
+    if (!maya_output_init(&maya->output, MAYA_OUTPUT_CAPTURE, false)) {
+        maya_setup_fail(error, "cannot allocate memory");
+        maya_stack_destroy(maya);
+        return false;
+    }
+
+    return true;
+}
+
+void maya_vm_deinit(MayaVm* maya) {
+    maya_stack_destroy(maya);
+    maya_output_free(&maya->output);
+
+    if (maya->arena != NULL)
+        maya_arena_destroy(maya->arena);
+
+    if (maya->heap != NULL)
+        maya_heap_destroy(maya->heap);
+
+    maya->arena = NULL;
+    maya->heap = NULL;
+}
+
+MayaProgram* maya_program_load(const char* filepath, const MayaNativeEntry* natives, const char** libraries,
+                               size_t libraries_size, MayaSetupError* error) {
+    MayaProgram* program = calloc(1, sizeof(MayaProgram));
+    if (!program) {
+        maya_setup_fail(error, "cannot allocate memory");
+        return NULL;
+    }
+
+    if (!maya_map_program(&program->image, filepath, error)) {
+        free(program);
+        return NULL;
+    }
+
+    if (!maya_bind_natives(&program->image, natives, libraries, libraries_size, error)) {
+        maya_unload_program(&program->image);
+        free(program);
+        return NULL;
+    }
+
+    program->verified = maya_verify_program(&program->image, NULL);
+    return program;
+}
+
+void maya_program_free(MayaProgram* program) {
+    maya_unbind_natives(&program->image);
+    maya_unload_program(&program->image);
+    free(program);
+}
+
+MayaVm* maya_vm_create(const MayaProgram* program, size_t stack_limit, MayaSetupError* error) {
+    MayaVm* maya = malloc(sizeof(MayaVm));
+    if (!maya) {
+        maya_setup_fail(error, "cannot allocate memory");
+        return NULL;
+    }
+
+    if (!maya_vm_init(maya, stack_limit != 0 ? stack_limit : MAYA_STACK_DEFAULT_LIMIT, error)) {
+        free(maya);
+        return NULL;
+    }
+
+    maya_vm_reset(maya, program);
+    return maya;
+}
+
+void maya_vm_destroy(MayaVm* maya) {
+    // the program belongs to its MayaProgram.
+    maya_vm_deinit(maya);
+    free(maya);
+}
+
+void maya_vm_reset(MayaVm* maya, const MayaProgram* program) {
+    const MayaVm* image = program != NULL ? &program->image : &(MayaVm) {0};
+
+    maya->program = image->program;
+    maya->program_size = image->program_size;
+    maya->rip = image->rip;
+    maya->natives = image->natives;
+    maya->natives_effects = image->natives_effects;
+    maya->natives_batches = image->natives_batches;
+    maya->natives_size = image->natives_size;
+    maya->literals = image->literals;
+    maya->literals_size = image->literals_size;
+    maya->imports = image->imports;
+    maya->imports_size = image->imports_size;
+    maya->symbols = image->symbols;
+    maya->symbols_size = image->symbols_size;
+    maya->verified = program != NULL && program->verified;
+
+    maya->sp = 0;
+    maya->fp = 0;
+    maya->bp = 0;
+    memset(maya->registers, 0, sizeof(maya->registers));
+    maya->halt = false;
+    maya->fuel = 0;
+
+    maya->output.size = 0;
+    maya->output.captured_size = 0;
+
+    if (maya->arena != NULL)
+        maya_arena_reset(maya->arena);
+
+    if (maya->heap != NULL) {
+        maya_heap_destroy(maya->heap);
+        maya->heap = NULL;
+    }
+}
+
+MayaError maya_vm_run(MayaVm* maya, uint64_t budget) {
+    maya->fuel = budget != 0 ? budget : UINT64_MAX;
+
+    if (maya->program == NULL)
+        return ERR_INVALID_INSTRUCTION;
+
+    if (maya->halt)
+        return ERR_OK;
+
+    return maya_stack_guarded(maya, maya->verified ? maya_execute_fueled_unchecked : maya_execute_fueled);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// the interpreter never reads the clock, the slice is run as quanta of fuel and the clock is
+// only read between them.
+MayaError maya_vm_run_slice(MayaVm* maya, uint64_t budget, uint64_t slice_ns) {
+    if (slice_ns == 0)
+        return maya_vm_run(maya, budget);
+
+    uint64_t left = budget != 0 ? budget : UINT64_MAX;
+    uint64_t start = now_ns();
+
+    for (;;) {
+        uint64_t quantum = left < MAYA_SLICE_QUANTUM ? left : MAYA_SLICE_QUANTUM;
+        MayaError error = maya_vm_run(maya, quantum);
+        left -= quantum - maya->fuel;
+
+        if (error != ERR_OUT_OF_FUEL || left == 0 || now_ns() - start >= slice_ns) {
+            maya->fuel = left;
+            return error;
+        }
+    }
+}
+
+uint64_t maya_vm_fuel(const MayaVm* maya) {
+    return maya->fuel;
+}
+
+bool maya_vm_halted(const MayaVm* maya) {
+    return maya->halt;
+}
+
+bool maya_vm_push(MayaVm* maya, Frame value) {
+    if (maya->sp >= maya->stack_limit)
+        return false;
+
+    maya->stack[maya->sp++] = value;
+    return true;
+}
+
+bool maya_vm_pop(MayaVm* maya, Frame* value) {
+    if (maya->sp == 0)
+        return false;
+
+    *value = maya->stack[--maya->sp];
+    return true;
+}
+
+size_t maya_vm_depth(const MayaVm* maya) {
+    return maya->sp;
+}
+
+const char* maya_vm_output(MayaVm* maya, size_t* size) {
+    maya_output_flush(&maya->output);
+
+    *size = maya->output.captured_size;
+    return maya->output.captured;
+}
@@ -1,6 +1,11 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "maya.h"
 
@@ -14,102 +19,179 @@ static void* xmalloc(size_t size) {
     return ptr;
 }
 
-void maya_link_program(MayaEnv* env, const char* input_path) {
-    FILE* file = fopen(input_path, "rb");
-    if (!file) {
-        fprintf(stderr, "ERROR: cannot open file '%s'\n", input_path);
+static void* xrealloc(void* ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fprintf(stderr, "ERROR: cannot allocate memory!\n");
         exit(EXIT_FAILURE);
     }
 
-    MayaHeader header = {0};
-    fread(&header, sizeof(MayaHeader), 1, file);
+    return ptr;
+}
 
-    MayaInstruction* instructions = xmalloc(sizeof(MayaInstruction) * header.program_size);
-    fread(instructions, sizeof(MayaInstruction), header.program_size, file);
+// the stdlib natives in the order `native <index>` numbered them before the import table.
+static const char* legacy_natives[] = {"alloc", "free", "print_f64", "print_i64", "print_str", "print_ptr"};
 
-    long literals_start = ftell(file);
+static size_t add_import(MayaEnv* env, StringView name) {
+    if (env->imports_size == env->imports_cap) {
+        env->imports_cap = env->imports_cap == 0 ? 16 : env->imports_cap * 2;
+        env->imports = xrealloc(env->imports, sizeof(StringView) * env->imports_cap);
+    }
 
-    fseek(file, 0, SEEK_END);
-    long whole_file_size = ftell(file);
-    fseek(file, literals_start, SEEK_SET);
+    env->imports[env->imports_size] = name;
+    return env->imports_size++;
+}
 
-    long literals_size = whole_file_size - literals_start;
-    uint8_t* literals = xmalloc(sizeof(uint8_t) * literals_size);
-    fread(literals, sizeof(char), literals_size, file);
+static void patch_operand(uint8_t* code, Frame frame, StringView symbol) {
+    // deferred pushes and immediates are emitted with a full frame, every other deferred operand
+    // is 32 bit wide. the target of ijlti comes after its register and immediate.
+    if (code[0] == OP_PUSH || code[0] == OP_IADDI || code[0] == OP_ISUBI || code[0] == OP_IMULI) {
+        maya_write_u64(&code[1], frame.as_u64);
+        return;
+    }
 
-    fclose(file);
+    size_t offset = code[0] == OP_IJLTI ? 1 + sizeof(uint8_t) + sizeof(uint64_t) : 1;
 
-    size_t bigger = 0;
-    size_t lower = 0;
-    char type = 0;
-    if (env->labels_size >= env->macros_size) {
-        type = 'L';
-        bigger = env->labels_size;
-        lower = env->macros_size;
-    } else {
-        bigger = env->macros_size;
-        lower = env->labels_size;
+    if (frame.as_u64 > UINT32_MAX) {
+        fprintf(stderr, "ERROR: value of '%.*s' is out of range\n", (int)symbol.len, symbol.str);
+        exit(EXIT_FAILURE);
     }
 
-    // check for duplicate labels in both labels and macros
-    for (size_t i = 0; i < bigger; i++) {
-        for (size_t j = 0; j < lower; j++) {
-            if (type == 'L') {
-                if (sv_equals(env->labels[i].id, env->macros[j].name)) {
-                    fprintf(stderr, "ERROR: duplicate label and macro name '%.*s'\n", (int)env->macros[i].name.len, env->macros[i].name.str);
-                    exit(EXIT_FAILURE);
-                }
-            } else {
-                if (sv_equals(env->labels[j].id, env->macros[i].name)) {
-                    fprintf(stderr, "ERROR: duplicate label and macro name '%.*s'\n", (int)env->macros[i].name.len, env->macros[i].name.str);
-                    exit(EXIT_FAILURE);
-                }
-            }
+    maya_write_u32(&code[offset], (uint32_t)frame.as_u64);
+}
+
+static void write_all(int fd, struct iovec* iov, int iovcnt, const char* output_path) {
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "ERROR: cannot write file '%s'\n", output_path);
+            exit(EXIT_FAILURE);
+        }
+
+        // a short write leaves the rest of the vector for the next call.
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
         }
-    }
 
-    // resolve deferred label
-    for (size_t i = 0; i < env->deferred_symbol_size; i++) {
-        StringView symbol = env->deferred_symbol[i].symbol;
-        bool found = false;
-
-        for (size_t j = 0; j < env->labels_size; j++) {
-            if (sv_equals(symbol, env->labels[j].id)) {
-                instructions[env->deferred_symbol[i].rip].operands[0].as_u64 = env->labels[j].rip;
-                found = true;
-                break;
-            }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
         }
+    }
+}
+
+void maya_link_program(MayaEnv* env, const char* output_path) {
+    uint8_t* program = env->code;
 
-        if (found)
-            continue;
+    // numbered natives keep working, their names always take the first imports. a label or a
+    // macro of the same name still wins when the name is used as an operand.
+    for (size_t i = 0; i < sizeof(legacy_natives) / sizeof(legacy_natives[0]); i++) {
+        StringView name = sv_from_cstr(legacy_natives[i]);
+        size_t index = add_import(env, name);
+
+        if (maya_symbols_find(&env->symbols, name) == NULL)
+            maya_symbols_insert(&env->symbols, (MayaSymbol) {.name = name, .kind = SYMBOL_NATIVE, .value.as_u64 = index});
+    }
 
-        for (size_t j = 0; j < env->macros_size; j++) {
-            if (sv_equals(symbol, env->macros[j].name)) {
-                instructions[env->deferred_symbol[i].rip].operands[0] = env->macros[j].frame;
-                found = true;
-                break;
-            }
+    // resolve deferred symbols, labels and macros were checked for duplicates by the assembler.
+    // any other name given to native becomes a new import, bound by the vm at load time.
+    for (size_t i = 0; i < env->deferred_symbols_size; i++) {
+        StringView name = env->deferred_symbols[i].symbol;
+        uint8_t opcode = program[env->deferred_symbols[i].rip];
+        bool native = opcode == OP_NATIVE || opcode == OP_NATIVE_BATCH;
+
+        MayaSymbol* symbol = maya_symbols_find(&env->symbols, name);
+        if (symbol == NULL && native) {
+            size_t index = add_import(env, name);
+            maya_symbols_insert(&env->symbols, (MayaSymbol) {.name = name, .kind = SYMBOL_NATIVE, .value.as_u64 = index});
+            symbol = maya_symbols_find(&env->symbols, name);
         }
 
-        if (!found) {
-            fprintf(stderr, "ERROR: no such label '%.*s'\n", (int)symbol.len, symbol.str);
+        if (symbol == NULL || (symbol->kind == SYMBOL_NATIVE && !native)) {
+            fprintf(stderr, "ERROR: no such label '%.*s'\n", (int)name.len, name.str);
             exit(EXIT_FAILURE);
         }
+
+        patch_operand(&program[env->deferred_symbols[i].rip], symbol->value, name);
+    }
+
+    maya_fuse_program(program, env->code_size, NULL);
+
+    MayaHeader header = {0};
+
+    uint8_t* magic = (uint8_t*)&header.magic;
+    memcpy(magic, "MAYA", 4);
+    header.version = MAYA_BYTECODE_VERSION;
+    header.program_size = env->code_size;
+
+    if (env->entry.str != NULL && env->entry.len != 0) {
+        MayaSymbol* symbol = maya_symbols_find(&env->symbols, env->entry);
+        if (symbol == NULL || symbol->kind != SYMBOL_LABEL) {
+            fprintf(stderr, "ERROR: no such label for the entry point: '%.*s'\n", (int)env->entry.len, env->entry.str);
+            exit(EXIT_FAILURE);
+        }
+
+        header.starting_rip = symbol->value.as_u64;
+    }
+
+    // string literals, native names then label names (only used for reporting) go after the
+    // program, the tables are laid out in one buffer so the whole file is a single write.
+    size_t literals_size = 0;
+    for (size_t i = 0; i < env->str_literals_size; i++)
+        literals_size += env->str_literals[i].literal.len + 1 + sizeof(size_t);
+
+    for (size_t i = 0; i < env->imports_size; i++)
+        header.imports_size += env->imports[i].len + 1;
+
+    for (size_t i = 0; i < env->labels_size; i++)
+        header.symbols_size += sizeof(size_t) + env->labels[i].id.len + 1;
+
+    uint8_t* tables = xmalloc(literals_size + header.imports_size + header.symbols_size + 1);
+    uint8_t* cursor = tables;
+
+    for (size_t i = 0; i < env->str_literals_size; i++) {
+        StringView literal = env->str_literals[i].literal;
+        memcpy(cursor, literal.str, literal.len);
+        cursor += literal.len;
+        *cursor++ = 0;
+        memcpy(cursor, &env->str_literals[i].rip, sizeof(size_t));
+        cursor += sizeof(size_t);
+    }
+
+    for (size_t i = 0; i < env->imports_size; i++) {
+        memcpy(cursor, env->imports[i].str, env->imports[i].len);
+        cursor += env->imports[i].len;
+        *cursor++ = 0;
+    }
+
+    for (size_t i = 0; i < env->labels_size; i++) {
+        StringView id = env->labels[i].id;
+        memcpy(cursor, &env->labels[i].rip, sizeof(size_t));
+        cursor += sizeof(size_t);
+        memcpy(cursor, id.str, id.len);
+        cursor += id.len;
+        *cursor++ = 0;
     }
 
-    file = fopen(input_path, "wb");
-    if (!file) {
-        fprintf(stderr, "ERROR: cannot open file '%s'\n", input_path);
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: cannot open file '%s'\n", output_path);
         exit(EXIT_FAILURE);
     }
 
-    fwrite(&header, sizeof(MayaHeader), 1, file);
-    fwrite(instructions, sizeof(MayaInstruction), header.program_size, file);
-    fwrite(literals, sizeof(uint8_t), literals_size, file);
+    struct iovec iov[] = {
+        {.iov_base = &header, .iov_len = sizeof(MayaHeader)},
+        {.iov_base = program, .iov_len = env->code_size},
+        {.iov_base = tables, .iov_len = cursor - tables},
+    };
 
-    fclose(file);
+    write_all(fd, iov, sizeof(iov) / sizeof(iov[0]), output_path);
+    close(fd);
 
-    free(literals);
-    free(instructions);
+    free(tables);
 }
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "maya.h"
+
+// loading never prints nor exits, failures are described in error and the vm is left without a
+// program. the command line reports them, an embedding host does what it wants with them.
+
+void maya_setup_fail(MayaSetupError* error, const char* format, ...) {
+    if (error == NULL)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+}
+
+static bool maya_check_header(const MayaHeader* header, const char* filepath, MayaSetupError* error) {
+    const uint8_t* magic = (const uint8_t*)&header->magic;
+    if (strncmp((const char*) magic, "MAYA", 4) != 0) {
+        maya_setup_fail(error, "invalid header: '%.4s'", magic);
+        return false;
+    }
+
+    if (header->version != MAYA_BYTECODE_VERSION) {
+        maya_setup_fail(error, "unsupported bytecode version %u, reassemble '%s'", header->version, filepath);
+        return false;
+    }
+
+    return true;
+}
+
+// patches every push of a string literal with the address of the literal. the linker may have
+// fused the push with a following ijneq, the address goes in the same place.
+static bool maya_relocate_literals(MayaVm* maya, MayaSetupError* error) {
+    char* literals = maya->literals;
+    size_t literals_size = maya->literals_size;
+
+    while (literals_size > 0) {
+        char* starting_literal = literals;
+        size_t literal_len = strnlen(literals, literals_size);
+
+        // the literal, its null terminating char and the rip of its push.
+        if (literal_len + 1 + sizeof(size_t) > literals_size) {
+            maya_setup_fail(error, "truncated string literal section");
+            return false;
+        }
+
+        literals += literal_len + 1;
+        literals_size -= literal_len + 1;
+
+        size_t rip;
+        memcpy(&rip, literals, sizeof(size_t));
+
+        if (rip + 1 + sizeof(uint64_t) > maya->program_size ||
+            (maya->program[rip] != OP_PUSH && maya->program[rip] != OP_PUSH_JNEQ)) {
+            maya_setup_fail(error, "invalid string literal relocation at %zu", rip);
+            return false;
+        }
+
+        maya_write_u64(&maya->program[rip + 1], (uint64_t)(uintptr_t)starting_literal);
+
+        literals += sizeof(size_t);
+        literals_size -= sizeof(size_t);
+    }
+
+    return true;
+}
+
+bool maya_read_program(MayaVm* maya, const char* filepath, MayaSetupError* error) {
+    FILE* file = fopen(filepath, "rb");
+    if (!file) {
+        maya_setup_fail(error, "cannot open file '%s'", filepath);
+        return false;
+    }
+
+    // like maya_map_program, a file too short for its header is not a maya file.
+    MayaHeader header = {0};
+    if (fread(&header, sizeof(MayaHeader), 1, file) != 1) {
+        maya_setup_fail(error, "invalid maya file '%s'", filepath);
+        fclose(file);
+        return false;
+    }
+
+    if (!maya_check_header(&header, filepath, error)) {
+        fclose(file);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long whole_file_size = ftell(file);
+    fseek(file, sizeof(MayaHeader), SEEK_SET);
+
+    if (whole_file_size < 0 || (size_t)whole_file_size < sizeof(MayaHeader)) {
+        maya_setup_fail(error, "invalid maya file '%s'", filepath);
+        fclose(file);
+        return false;
+    }
+
+    if (header.program_size > (size_t)whole_file_size - sizeof(MayaHeader)) {
+        maya_setup_fail(error, "truncated program in '%s'", filepath);
+        fclose(file);
+        return false;
+    }
+
+    size_t sections_size = whole_file_size - sizeof(MayaHeader) - header.program_size;
+    if (header.symbols_size > sections_size || header.imports_size > sections_size - header.symbols_size) {
+        maya_setup_fail(error, "truncated symbols in '%s'", filepath);
+        fclose(file);
+        return false;
+    }
+
+    // literals, imports and symbols are read together, the imports and symbols live at the end of
+    // the literals buffer.
+    uint8_t* program = malloc(sizeof(uint8_t) * header.program_size);
+    char* sections = sections_size != 0 ? malloc(sizeof(char) * sections_size) : NULL;
+    if (!program || (sections_size != 0 && !sections)) {
+        maya_setup_fail(error, "cannot allocate memory");
+        free(program);
+        free(sections);
+        fclose(file);
+        return false;
+    }
+
+    if (fread(program, sizeof(uint8_t), header.program_size, file) != header.program_size ||
+        (sections != NULL && fread(sections, sizeof(char), sections_size, file) != sections_size)) {
+        maya_setup_fail(error, "truncated program in '%s'", filepath);
+        free(program);
+        free(sections);
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+
+    maya->rip = header.starting_rip;
+    maya->program = program;
+    maya->program_size = header.program_size;
+    maya->literals = sections;
+    maya->literals_size = sections_size - header.imports_size - header.symbols_size;
+    maya->imports = sections != NULL ? sections + maya->literals_size : NULL;
+    maya->imports_size = header.imports_size;
+    maya->symbols = sections != NULL ? maya->imports + maya->imports_size : NULL;
+    maya->symbols_size = header.symbols_size;
+
+    if (!maya_relocate_literals(maya, error)) {
+        maya_unload_program(maya);
+        return false;
+    }
+
+    // nothing else sees this copy, so the interpreter can rewrite it as it runs.
+    maya->quicken = true;
+    return true;
+}
+
+// maps the file privately and executes the program and string literals in place, only the
+// pages holding relocated literal pushes get copied on write, the rest stay shared between
+// every process running the same file. the mapping is read only once relocated.
+bool maya_map_program(MayaVm* maya, const char* filepath, MayaSetupError* error) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        maya_setup_fail(error, "cannot open file '%s'", filepath);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MayaHeader)) {
+        maya_setup_fail(error, "invalid maya file '%s'", filepath);
+        close(fd);
+        return false;
+    }
+
+    size_t mapping_size = st.st_size;
+    uint8_t* mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        maya_setup_fail(error, "cannot map file '%s': %s", filepath, strerror(errno));
+        return false;
+    }
+
+    MayaHeader header;
+    memcpy(&header, mapping, sizeof(MayaHeader));
+    if (!maya_check_header(&header, filepath, error)) {
+        munmap(mapping, mapping_size);
+        return false;
+    }
+
+    if (header.program_size > mapping_size - sizeof(MayaHeader)) {
+        maya_setup_fail(error, "truncated program in '%s'", filepath);
+        munmap(mapping, mapping_size);
+        return false;
+    }
+
+    size_t sections_size = mapping_size - sizeof(MayaHeader) - header.program_size;
+    if (header.symbols_size > sections_size || header.imports_size > sections_size - header.symbols_size) {
+        maya_setup_fail(error, "truncated symbols in '%s'", filepath);
+        munmap(mapping, mapping_size);
+        return false;
+    }
+
+    maya->mapping = mapping;
+    maya->mapping_size = mapping_size;
+
+    maya->rip = header.starting_rip;
+    maya->program = mapping + sizeof(MayaHeader);
+    maya->program_size = header.program_size;
+    maya->literals = (char*)maya->program + header.program_size;
+    maya->literals_size = sections_size - header.imports_size - header.symbols_size;
+    maya->imports = maya->literals + maya->literals_size;
+    maya->imports_size = header.imports_size;
+    maya->symbols = maya->imports + maya->imports_size;
+    maya->symbols_size = header.symbols_size;
+
+    if (!maya_relocate_literals(maya, error)) {
+        maya_unload_program(maya);
+        return false;
+    }
+
+    mprotect(mapping, mapping_size, PROT_READ);
+    return true;
+}
+
+void maya_unload_program(MayaVm* maya) {
+    if (maya->mapping != NULL) {
+        munmap(maya->mapping, maya->mapping_size);
+    } else {
+        free(maya->program);
+        free(maya->literals);
+    }
+
+    maya->mapping = NULL;
+    maya->mapping_size = 0;
+    maya->quicken = false;
+    maya->program = NULL;
+    maya->program_size = 0;
+    maya->literals = NULL;
+    maya->literals_size = 0;
+    maya->imports = NULL;
+    maya->imports_size = 0;
+    maya->symbols = NULL;
+    maya->symbols_size = 0;
+}
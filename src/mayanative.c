@@ -0,0 +1,128 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "maya.h"
+
+#define MAYA_STDLIB_PATH "./stdlib/libmaya_stdlib.so"
+
+static void* open_library(const char* path, MayaSetupError* error) {
+    void* handle = dlopen(path, RTLD_LOCAL | RTLD_LAZY);
+    if (!handle)
+        maya_setup_fail(error, "cannot load native library: %s", dlerror());
+
+    return handle;
+}
+
+// adds natives to the registry, names already registered are kept.
+static void register_natives(MayaSymbolTable* registry, const MayaNativeEntry* entries) {
+    for (const MayaNativeEntry* entry = entries; entry->name != NULL; entry++)
+        maya_symbols_insert(registry, (MayaSymbol) {
+            .name = sv_from_cstr(entry->name),
+            .kind = SYMBOL_NATIVE,
+            .value.as_ptr = (void*)entry,
+        });
+}
+
+static bool register_library(MayaSymbolTable* registry, void* handle, const char* path, MayaSetupError* error) {
+    const MayaNativeEntry* entries = dlsym(handle, "maya_natives");
+    if (entries == NULL) {
+        maya_setup_fail(error, "'%s' does not export maya_natives", path);
+        return false;
+    }
+
+    register_natives(registry, entries);
+    return true;
+}
+
+static bool resolve_imports(MayaVm* maya, const MayaSymbolTable* registry, MayaSetupError* error) {
+    size_t count = 0;
+    for (size_t offset = 0; offset < maya->imports_size; count++)
+        offset += strnlen(maya->imports + offset, maya->imports_size - offset) + 1;
+
+    maya->natives = calloc(count, sizeof(MayaNative));
+    maya->natives_effects = calloc(count, sizeof(MayaNativeEffect));
+    maya->natives_batches = calloc(count, sizeof(MayaNativeBatch));
+    maya->natives_size = count;
+    if (count != 0 && (!maya->natives || !maya->natives_effects || !maya->natives_batches)) {
+        maya_setup_fail(error, "cannot allocate memory");
+        return false;
+    }
+
+    const char* name = maya->imports;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strnlen(name, maya->imports + maya->imports_size - name);
+
+        MayaSymbol* symbol = maya_symbols_find(registry, (StringView) {.str = name, .len = len});
+        if (symbol == NULL) {
+            maya_setup_fail(error, "unresolved native '%.*s'", (int)len, name);
+            return false;
+        }
+
+        const MayaNativeEntry* entry = symbol->value.as_ptr;
+        maya->natives[i] = entry->native;
+        maya->natives_effects[i] = entry->effect;
+        maya->natives_batches[i] = entry->batch;
+
+        name += len + 1;
+    }
+
+    return true;
+}
+
+bool maya_bind_natives(MayaVm* maya, const MayaNativeEntry* natives, const char** libraries, size_t libraries_size,
+                       MayaSetupError* error) {
+    if (libraries_size > MAYA_LIBRARIES_CAP) {
+        maya_setup_fail(error, "too many native libraries, at most %d", MAYA_LIBRARIES_CAP);
+        return false;
+    }
+
+    maya->libraries_size = 0;
+    for (size_t i = 0; i <= libraries_size; i++) {
+        const char* path = i == 0 ? MAYA_STDLIB_PATH : libraries[i - 1];
+        maya->libraries[i] = open_library(path, error);
+        if (maya->libraries[i] == NULL) {
+            maya_unbind_natives(maya);
+            return false;
+        }
+
+        maya->libraries_size++;
+    }
+
+    // the host registers first and the last library before the ones it comes after, so their
+    // natives shadow the ones registered later.
+    MayaSymbolTable registry = {0};
+    if (natives != NULL)
+        register_natives(&registry, natives);
+
+    bool bound = true;
+    for (size_t i = libraries_size; bound && i > 0; i--)
+        bound = register_library(&registry, maya->libraries[i], libraries[i - 1], error);
+
+    bound = bound && register_library(&registry, maya->libraries[0], MAYA_STDLIB_PATH, error);
+    bound = bound && resolve_imports(maya, &registry, error);
+
+    maya_symbols_free(&registry);
+
+    if (!bound)
+        maya_unbind_natives(maya);
+
+    return bound;
+}
+
+void maya_unbind_natives(MayaVm* maya) {
+    free(maya->natives);
+    free(maya->natives_effects);
+    free(maya->natives_batches);
+    maya->natives = NULL;
+    maya->natives_effects = NULL;
+    maya->natives_batches = NULL;
+    maya->natives_size = 0;
+
+    for (size_t i = 0; i < maya->libraries_size; i++)
+        dlclose(maya->libraries[i]);
+
+    maya->libraries_size = 0;
+}
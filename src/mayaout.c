@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "maya.h"
+
+// built into both the vm and the stdlib: the vm owns the buffer and flushes it when the program
+// ends, the print natives of the stdlib append to it.
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+bool maya_output_init(MayaOutput* output, int fd, bool unbuffered) {
+    output->data = malloc(MAYA_OUTPUT_CAP);
+    if (!output->data)
+        return false;
+
+    output->size = 0;
+    output->fd = fd;
+    output->unbuffered = unbuffered;
+    output->captured = NULL;
+    output->captured_size = 0;
+    output->captured_cap = 0;
+    return true;
+}
+
+static void capture(MayaOutput* output, const char* str, size_t len) {
+    if (output->captured_size + len > output->captured_cap) {
+        size_t cap = output->captured_cap != 0 ? output->captured_cap : MAYA_OUTPUT_CAP;
+        while (cap < output->captured_size + len)
+            cap *= 2;
+
+        // like a failed write, output that does not fit in memory is lost.
+        char* captured = realloc(output->captured, cap);
+        if (!captured)
+            return;
+
+        output->captured = captured;
+        output->captured_cap = cap;
+    }
+
+    memcpy(output->captured + output->captured_size, str, len);
+    output->captured_size += len;
+}
+
+static void write_all(MayaOutput* output, const char* str, size_t len) {
+    if (output->fd == MAYA_OUTPUT_CAPTURE) {
+        capture(output, str, len);
+        return;
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t result = write(output->fd, str + written, len - written);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // like stdio, a failed write loses the buffered output instead of failing the program.
+            break;
+        }
+
+        written += (size_t)result;
+    }
+}
+
+void maya_output_flush(MayaOutput* output) {
+    write_all(output, output->data, output->size);
+    output->size = 0;
+}
+
+void maya_output_free(MayaOutput* output) {
+    maya_output_flush(output);
+    free(output->data);
+    free(output->captured);
+    output->data = NULL;
+    output->captured = NULL;
+}
+
+// makes room for len more bytes, longer writes than the whole buffer go straight to the fd.
+static inline char* reserve(MayaOutput* output, size_t len) {
+    if (output->size + len > MAYA_OUTPUT_CAP)
+        maya_output_flush(output);
+
+    return output->data + output->size;
+}
+
+static inline void end_value(MayaOutput* output) {
+    output->data[output->size++] = '\n';
+
+    if (output->unbuffered)
+        maya_output_flush(output);
+}
+
+void maya_output_write(MayaOutput* output, const char* str, size_t len) {
+    if (len >= MAYA_OUTPUT_CAP) {
+        maya_output_flush(output);
+        write_all(output, str, len);
+        return;
+    }
+
+    memcpy(reserve(output, len), str, len);
+    output->size += len;
+}
+
+// writes the digits of value right aligned to end, returns where they start.
+static inline char* format_u64(char* end, uint64_t value) {
+    while (value >= 100) {
+        end -= 2;
+        memcpy(end, &digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+
+    if (value >= 10) {
+        end -= 2;
+        memcpy(end, &digit_pairs[value * 2], 2);
+    } else {
+        *--end = '0' + value;
+    }
+
+    return end;
+}
+
+void maya_output_i64(MayaOutput* output, int64_t value) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+
+    char* start = format_u64(end, value < 0 ? -(uint64_t)value : (uint64_t)value);
+    if (value < 0)
+        *--start = '-';
+
+    char* out = reserve(output, (end - start) + 1);
+    memcpy(out, start, end - start);
+    output->size += end - start;
+    end_value(output);
+}
+
+// same text as printf("%lf"). the value is scaled to millionths and rounded, which is exact
+// unless the scaled value sits so close to a half that its own rounding could tip it, those and
+// the values too large for the fast path go through snprintf.
+void maya_output_f64(MayaOutput* output, double value) {
+    double magnitude = fabs(value);
+    double scaled = magnitude * 1e6;
+    uint64_t whole = (uint64_t)(magnitude < 0x1p31 ? scaled : 0);
+    double fraction = scaled - (double)whole;
+
+    if (!(magnitude < 0x1p31) || fabs(fraction - 0.5) <= scaled * 0x1p-52) {
+        char* out = reserve(output, 512);
+        output->size += snprintf(out, 512, "%lf", value);
+        end_value(output);
+        return;
+    }
+
+    uint64_t rounded = whole + (fraction > 0.5);
+
+    char digits[32];
+    char* end = digits + sizeof(digits);
+
+    char* start = format_u64(end, rounded % 1000000 + 1000000);
+    *start = '.'; // the leading 1 only kept the zeros of the fraction
+    start = format_u64(start, rounded / 1000000);
+    if (signbit(value))
+        *--start = '-';
+
+    char* out = reserve(output, (end - start) + 1);
+    memcpy(out, start, end - start);
+    output->size += end - start;
+    end_value(output);
+}
+
+void maya_output_str(MayaOutput* output, const char* str) {
+    if (str == NULL)
+        str = "(null)";
+
+    maya_output_write(output, str, strlen(str));
+    reserve(output, 1);
+    end_value(output);
+}
+
+void maya_output_ptr(MayaOutput* output, const void* ptr) {
+    if (ptr == NULL) {
+        maya_output_write(output, "(nil)", 5);
+        reserve(output, 1);
+        end_value(output);
+        return;
+    }
+
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+
+    for (uintptr_t value = (uintptr_t)ptr; value != 0; value >>= 4)
+        *--start = "0123456789abcdef"[value & 15];
+
+    *--start = 'x';
+    *--start = '0';
+
+    char* out = reserve(output, (end - start) + 1);
+    memcpy(out, start, end - start);
+    output->size += end - start;
+    end_value(output);
+}
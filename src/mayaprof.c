@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "maya.h"
+
+#define MAYA_PROFILE_FRAMES_CAP 1024
+#define MAYA_PROFILE_REPORT_CAP 20
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MAYA_PROFILE_CLOCK_UNIT "cycles"
+#else
+#define MAYA_PROFILE_CLOCK_UNIT "ns"
+#endif
+
+typedef struct MayaProfileFrame_t {
+    size_t function;
+    uint64_t start;
+    uint64_t children;
+} MayaProfileFrame;
+
+struct MayaProfile_t {
+    size_t program_size;
+    uint64_t total;
+    uint64_t opcodes[OP_COUNT];
+
+    // indexed by rip.
+    uint64_t* hits;
+    bool* leaders;
+    uint64_t* block_time;
+    uint64_t* block_entries;
+    uint64_t* calls;
+    uint64_t* inclusive;
+    uint64_t* exclusive;
+
+    size_t block;
+    uint64_t block_start;
+
+    MayaProfileFrame frames[MAYA_PROFILE_FRAMES_CAP];
+    size_t frames_size;
+};
+
+typedef struct MayaProfileEntry_t {
+    size_t key;
+    uint64_t value;
+} MayaProfileEntry;
+
+static uint64_t maya_profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void* xcalloc(size_t count, size_t size) {
+    void* ptr = calloc(count, size);
+    if (!ptr) {
+        fprintf(stderr, "ERROR: cannot allocate memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
+
+static void mark_leader(MayaProfile* profile, uint64_t rip) {
+    if (rip < profile->program_size)
+        profile->leaders[rip] = true;
+}
+
+// basic blocks start at the entry point, at every branch target and right after every branch.
+static void find_leaders(MayaProfile* profile, const MayaVm* maya) {
+    mark_leader(profile, maya->rip);
+
+    size_t rip = 0;
+    while (rip < maya->program_size) {
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&maya->program[rip], &instruction);
+        if (size == 0)
+            return;
+
+        switch (instruction.opcode) {
+        case OP_JMP:
+        case OP_IJEQ:
+        case OP_FJEQ:
+        case OP_IJNEQ:
+        case OP_FJNEQ:
+        case OP_IJGT:
+        case OP_FJGT:
+        case OP_IJLT:
+        case OP_FJLT:
+        case OP_CALL:
+            mark_leader(profile, instruction.operands[0].as_u64);
+            mark_leader(profile, rip + size);
+            break;
+        case OP_PUSHI_JNEQ:
+        case OP_PUSH_JNEQ:
+            mark_leader(profile, instruction.operands[1].as_u64);
+            mark_leader(profile, rip + size);
+            break;
+        case OP_IJLTI:
+            mark_leader(profile, instruction.operands[2].as_u64);
+            mark_leader(profile, rip + size);
+            break;
+        case OP_RET:
+        case OP_RETV:
+        case OP_HALT:
+            mark_leader(profile, rip + size);
+            break;
+        default:
+            break;
+        }
+
+        rip += size;
+    }
+}
+
+static void push_frame(MayaProfile* profile, size_t function, uint64_t now) {
+    if (function < profile->program_size)
+        profile->calls[function]++;
+
+    // calls deeper than the frame cap are folded into the innermost tracked frame.
+    if (profile->frames_size >= MAYA_PROFILE_FRAMES_CAP)
+        return;
+
+    profile->frames[profile->frames_size++] = (MayaProfileFrame) {
+        .function = function,
+        .start = now,
+        .children = 0,
+    };
+}
+
+static void pop_frame(MayaProfile* profile, uint64_t now) {
+    if (profile->frames_size == 0)
+        return;
+
+    MayaProfileFrame frame = profile->frames[--profile->frames_size];
+    uint64_t elapsed = now - frame.start;
+
+    if (frame.function < profile->program_size) {
+        profile->inclusive[frame.function] += elapsed;
+        profile->exclusive[frame.function] += elapsed - frame.children;
+    }
+
+    if (profile->frames_size != 0)
+        profile->frames[profile->frames_size - 1].children += elapsed;
+}
+
+MayaProfile* maya_profile_create(const MayaVm* maya) {
+    MayaProfile* profile = xcalloc(1, sizeof(MayaProfile));
+    size_t size = maya->program_size;
+
+    profile->program_size = size;
+    profile->hits = xcalloc(size, sizeof(uint64_t));
+    profile->leaders = xcalloc(size, sizeof(bool));
+    profile->block_time = xcalloc(size, sizeof(uint64_t));
+    profile->block_entries = xcalloc(size, sizeof(uint64_t));
+    profile->calls = xcalloc(size, sizeof(uint64_t));
+    profile->inclusive = xcalloc(size, sizeof(uint64_t));
+    profile->exclusive = xcalloc(size, sizeof(uint64_t));
+
+    find_leaders(profile, maya);
+
+    // the entry point is accounted as the outermost function.
+    uint64_t now = maya_profile_clock();
+    profile->block = maya->rip;
+    profile->block_start = now;
+    push_frame(profile, maya->rip, now);
+
+    return profile;
+}
+
+void maya_profile_instruction(MayaVm* maya, size_t rip) {
+    MayaProfile* profile = maya->trace;
+    if (rip >= profile->program_size)
+        return;
+
+    uint8_t opcode = maya->program[rip];
+    uint64_t now = maya_profile_clock();
+
+    profile->total++;
+    profile->opcodes[opcode]++;
+    profile->hits[rip]++;
+
+    if (profile->leaders[rip]) {
+        profile->block_time[profile->block] += now - profile->block_start;
+        profile->block_entries[rip]++;
+        profile->block = rip;
+        profile->block_start = now;
+    }
+
+    switch (opcode) {
+    case OP_CALL:
+        push_frame(profile, maya_read_u32(&maya->program[rip + 1]), now);
+        break;
+    case OP_RET:
+    case OP_RETV:
+        pop_frame(profile, now);
+        break;
+    default:
+        break;
+    }
+}
+
+static int compare_entries(const void* lhs, const void* rhs) {
+    const MayaProfileEntry* a = lhs;
+    const MayaProfileEntry* b = rhs;
+
+    if (a->value != b->value)
+        return a->value < b->value ? 1 : -1;
+
+    return a->key < b->key ? -1 : a->key > b->key;
+}
+
+// collects the non zero values sorted from the hottest, the caller frees the entries.
+static MayaProfileEntry* sort_entries(const uint64_t* values, size_t size, size_t* entries_size) {
+    MayaProfileEntry* entries = xcalloc(size == 0 ? 1 : size, sizeof(MayaProfileEntry));
+    size_t len = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        if (values[i] != 0)
+            entries[len++] = (MayaProfileEntry) {.key = i, .value = values[i]};
+    }
+
+    qsort(entries, len, sizeof(MayaProfileEntry), compare_entries);
+    *entries_size = len;
+    return entries;
+}
+
+// prints the closest label at or before rip, falling back to the raw rip.
+static void print_location(const MayaVm* maya, size_t rip) {
+    const char* best = NULL;
+    size_t best_rip = 0;
+
+    const char* symbols = maya->symbols;
+    size_t symbols_size = maya->symbols_size;
+
+    while (symbols_size > sizeof(size_t)) {
+        size_t symbol_rip;
+        memcpy(&symbol_rip, symbols, sizeof(size_t));
+
+        const char* name = symbols + sizeof(size_t);
+        size_t name_len = strnlen(name, symbols_size - sizeof(size_t));
+        if (name_len == symbols_size - sizeof(size_t))
+            break;
+
+        if (symbol_rip <= rip && (best == NULL || symbol_rip >= best_rip)) {
+            best = name;
+            best_rip = symbol_rip;
+        }
+
+        symbols += sizeof(size_t) + name_len + 1;
+        symbols_size -= sizeof(size_t) + name_len + 1;
+    }
+
+    if (best == NULL) {
+        fprintf(stderr, "%zu\n", rip);
+    } else if (best_rip == rip) {
+        fprintf(stderr, "%s\n", best);
+    } else {
+        fprintf(stderr, "%s+%zu\n", best, rip - best_rip);
+    }
+}
+
+static double percent(uint64_t value, uint64_t total) {
+    return total == 0 ? 0.0 : (double)value * 100.0 / (double)total;
+}
+
+void maya_profile_stop(MayaProfile* profile) {
+    uint64_t now = maya_profile_clock();
+
+    // close the running block and every function still on the call stack.
+    profile->block_time[profile->block] += now - profile->block_start;
+    profile->block_start = now;
+    while (profile->frames_size != 0)
+        pop_frame(profile, now);
+}
+
+void maya_profile_report(MayaProfile* profile, const MayaVm* maya) {
+    size_t len = 0;
+    MayaProfileEntry* entries = sort_entries(profile->opcodes, OP_COUNT, &len);
+
+    fprintf(stderr, "\n== opcodes: %lu instructions ==\n", profile->total);
+    fprintf(stderr, "%14s %8s  %s\n", "count", "%", "opcode");
+    for (size_t i = 0; i < len; i++) {
+        fprintf(stderr, "%14lu %7.2f%%  %s\n", entries[i].value, percent(entries[i].value, profile->total),
+                maya_instruction_to_str((MayaInstruction) {.opcode = entries[i].key}));
+    }
+    free(entries);
+
+    entries = sort_entries(profile->hits, profile->program_size, &len);
+
+    fprintf(stderr, "\n== hot spots ==\n");
+    fprintf(stderr, "%14s %8s  %-16s %s\n", "hits", "%", "instruction", "location");
+    for (size_t i = 0; i < len && i < MAYA_PROFILE_REPORT_CAP; i++) {
+        MayaInstruction instruction;
+        maya_decode_instruction(&maya->program[entries[i].key], &instruction);
+
+        fprintf(stderr, "%14lu %7.2f%%  %-16s ", entries[i].value, percent(entries[i].value, profile->total),
+                maya_instruction_to_str(instruction));
+        print_location(maya, entries[i].key);
+    }
+    free(entries);
+
+    uint64_t total_time = 0;
+    for (size_t i = 0; i < profile->program_size; i++)
+        total_time += profile->block_time[i];
+
+    entries = sort_entries(profile->block_time, profile->program_size, &len);
+
+    fprintf(stderr, "\n== basic blocks: %lu %s ==\n", total_time, MAYA_PROFILE_CLOCK_UNIT);
+    fprintf(stderr, "%14s %8s %14s  %s\n", MAYA_PROFILE_CLOCK_UNIT, "%", "entries", "location");
+    for (size_t i = 0; i < len && i < MAYA_PROFILE_REPORT_CAP; i++) {
+        fprintf(stderr, "%14lu %7.2f%% %14lu  ", entries[i].value, percent(entries[i].value, total_time),
+                profile->block_entries[entries[i].key]);
+        print_location(maya, entries[i].key);
+    }
+    free(entries);
+
+    entries = sort_entries(profile->inclusive, profile->program_size, &len);
+
+    fprintf(stderr, "\n== functions ==\n");
+    fprintf(stderr, "%10s %14s %8s %14s %8s  %s\n", "calls", "inclusive", "%", "exclusive", "%", "function");
+    for (size_t i = 0; i < len && i < MAYA_PROFILE_REPORT_CAP; i++) {
+        size_t function = entries[i].key;
+        fprintf(stderr, "%10lu %14lu %7.2f%% %14lu %7.2f%%  ", profile->calls[function],
+                profile->inclusive[function], percent(profile->inclusive[function], total_time),
+                profile->exclusive[function], percent(profile->exclusive[function], total_time));
+        print_location(maya, function);
+    }
+    free(entries);
+}
+
+void maya_profile_destroy(MayaProfile* profile) {
+    free(profile->hits);
+    free(profile->leaders);
+    free(profile->block_time);
+    free(profile->block_entries);
+    free(profile->calls);
+    free(profile->inclusive);
+    free(profile->exclusive);
+    free(profile);
+}
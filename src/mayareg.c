@@ -0,0 +1,1087 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "maya.h"
+
+// register form of a verified program. the verifier knows the stack depth before every
+// instruction, so every stack slot of a frame is a virtual register at a fixed offset from bp and
+// the stack instructions become three address instructions over three operand spaces:
+//
+//   frame      stack[bp + index], arguments are at negative indices
+//   register   the vm registers
+//   constant   a pool filled by the pushes of the program
+//
+// the translator keeps a virtual stack of where each value of the frame currently lives. pushes,
+// loads and dups only record a location, arithmetic reads its operands from wherever they are
+// and writes its result straight to the register or slot a following store names. values are
+// written to their slots only when a branch, a call, a native or a pointer needs the stack to be
+// real, so `load 0; push 1; iadd; store 0` is a single instruction.
+
+typedef enum MayaRegSpace_t {
+    SPACE_FRAME,
+    SPACE_REGISTER,
+    SPACE_CONSTANT,
+    SPACE_COUNT,
+} MayaRegSpace;
+
+// the arithmetic, the integer alu and the branches are in the same order as their stack forms.
+typedef enum MayaRegOpCode_t {
+    REG_HALT,
+    REG_MOV,
+    REG_IADD,
+    REG_FADD,
+    REG_ISUB,
+    REG_FSUB,
+    REG_IMUL,
+    REG_FMUL,
+    REG_IDIV,
+    REG_FDIV,
+    REG_AND,
+    REG_OR,
+    REG_XOR,
+    REG_SHL,
+    REG_SHR,
+    REG_MOD,
+    REG_I2F,
+    REG_F2I,
+    REG_JMP,
+    REG_IJEQ,
+    REG_FJEQ,
+    REG_IJNEQ,
+    REG_FJNEQ,
+    REG_IJGT,
+    REG_FJGT,
+    REG_IJLT,
+    REG_FJLT,
+    REG_CALL,
+    REG_RET,
+    REG_RETV,
+    REG_NATIVE,
+    REG_NATIVE_BATCH,
+    REG_VECTOR,
+    REG_LOAD_PTR,
+    REG_PUSH_PTR,
+    REG_STORE_PTR,
+    REG_COUNT,
+} MayaRegOpCode;
+
+static const char* opcode_names[REG_COUNT] = {
+    [REG_HALT] = "halt",
+    [REG_MOV] = "mov",
+    [REG_IADD] = "iadd",
+    [REG_FADD] = "fadd",
+    [REG_ISUB] = "isub",
+    [REG_FSUB] = "fsub",
+    [REG_IMUL] = "imul",
+    [REG_FMUL] = "fmul",
+    [REG_IDIV] = "idiv",
+    [REG_FDIV] = "fdiv",
+    [REG_AND] = "and",
+    [REG_OR] = "or",
+    [REG_XOR] = "xor",
+    [REG_SHL] = "shl",
+    [REG_SHR] = "shr",
+    [REG_MOD] = "mod",
+    [REG_I2F] = "i2f",
+    [REG_F2I] = "f2i",
+    [REG_JMP] = "jmp",
+    [REG_IJEQ] = "ijeq",
+    [REG_FJEQ] = "fjeq",
+    [REG_IJNEQ] = "ijneq",
+    [REG_FJNEQ] = "fjneq",
+    [REG_IJGT] = "ijgt",
+    [REG_FJGT] = "fjgt",
+    [REG_IJLT] = "ijlt",
+    [REG_FJLT] = "fjlt",
+    [REG_CALL] = "call",
+    [REG_RET] = "ret",
+    [REG_RETV] = "retv",
+    [REG_NATIVE] = "native",
+    [REG_NATIVE_BATCH] = "native_batch",
+    [REG_VECTOR] = "vector",
+    [REG_LOAD_PTR] = "load_ptr",
+    [REG_PUSH_PTR] = "push_ptr",
+    [REG_STORE_PTR] = "store_ptr",
+};
+
+typedef struct MayaRegOperand_t {
+    uint8_t space;
+    int32_t index;
+} MayaRegOperand;
+
+// operand 0 is the destination, 1 and 2 the sources. push_ptr reads the register in operand 0,
+// retv and native_batch keep their count in its index, call the frame depth of its callee.
+typedef struct MayaRegInstruction_t {
+    uint8_t opcode;
+    uint8_t spaces[3];
+    int32_t operands[3];
+    uint32_t target; // instruction index of jumps and calls, native index of natives
+    int32_t depth; // of the frame before the instruction, where sp is when it has to be real
+    uint32_t rip; // of the stack instruction it comes from
+} MayaRegInstruction;
+
+struct MayaRegProgram_t {
+    MayaRegInstruction* code;
+    size_t code_size;
+    size_t code_cap;
+
+    Frame* constants;
+    size_t constants_size;
+    size_t constants_cap;
+
+    size_t entry;
+    size_t entry_depth;
+};
+
+#define NO_PRODUCER SIZE_MAX
+
+typedef struct MayaRegTranslator_t {
+    const MayaVm* maya;
+    MayaRegProgram* out;
+    uint32_t rip;
+
+    // virtual stack, slot i of the frame at values[i - lowest]. slots at or above depth always
+    // hold their own frame location, slots below pending may hold anything else.
+    MayaRegOperand* values;
+    int64_t lowest;
+    int64_t depth;
+    int64_t pending;
+
+    // last instruction emitted, when it is arithmetic whose result nothing has read yet.
+    size_t producer;
+    bool failed;
+} MayaRegTranslator;
+
+static MayaRegOperand frame_slot(int64_t index) {
+    return (MayaRegOperand) {.space = SPACE_FRAME, .index = (int32_t)index};
+}
+
+static bool same(MayaRegOperand a, MayaRegOperand b) {
+    return a.space == b.space && a.index == b.index;
+}
+
+static MayaRegInstruction* emit(MayaRegTranslator* t, MayaRegOpCode opcode, MayaRegOperand dst, MayaRegOperand a,
+                                MayaRegOperand b) {
+    MayaRegProgram* out = t->out;
+    if (out->code_size == out->code_cap) {
+        size_t cap = out->code_cap == 0 ? 256 : out->code_cap * 2;
+        MayaRegInstruction* code = realloc(out->code, sizeof(MayaRegInstruction) * cap);
+        if (!code) {
+            // the translation is thrown away, the caller only needs something to write to.
+            static _Thread_local MayaRegInstruction discarded;
+            t->failed = true;
+            return &discarded;
+        }
+
+        out->code = code;
+        out->code_cap = cap;
+    }
+
+    t->producer = NO_PRODUCER;
+
+    MayaRegInstruction* instruction = &out->code[out->code_size++];
+    *instruction = (MayaRegInstruction) {
+        .opcode = opcode,
+        .spaces = {dst.space, a.space, b.space},
+        .operands = {dst.index, a.index, b.index},
+        .depth = (int32_t)t->depth,
+        .rip = t->rip,
+    };
+
+    return instruction;
+}
+
+static MayaRegOperand constant(MayaRegTranslator* t, uint64_t value) {
+    MayaRegProgram* out = t->out;
+    if (out->constants_size == out->constants_cap) {
+        size_t cap = out->constants_cap == 0 ? 64 : out->constants_cap * 2;
+        Frame* constants = cap <= INT32_MAX ? realloc(out->constants, sizeof(Frame) * cap) : NULL;
+        if (!constants) {
+            t->failed = true;
+            return (MayaRegOperand) {.space = SPACE_CONSTANT};
+        }
+
+        out->constants = constants;
+        out->constants_cap = cap;
+    }
+
+    out->constants[out->constants_size].as_u64 = value;
+    return (MayaRegOperand) {.space = SPACE_CONSTANT, .index = (int32_t)out->constants_size++};
+}
+
+static MayaRegOperand value_at(const MayaRegTranslator* t, int64_t slot) {
+    return slot < t->lowest ? frame_slot(slot) : t->values[slot - t->lowest];
+}
+
+static void push(MayaRegTranslator* t, MayaRegOperand value) {
+    t->values[t->depth - t->lowest] = value;
+    if (!same(value, frame_slot(t->depth)) && t->depth < t->pending)
+        t->pending = t->depth;
+
+    t->depth++;
+}
+
+static MayaRegOperand pop(MayaRegTranslator* t) {
+    t->depth--;
+
+    MayaRegOperand value = t->values[t->depth - t->lowest];
+    t->values[t->depth - t->lowest] = frame_slot(t->depth);
+    return value;
+}
+
+// writes the value of slot to the slot itself.
+static void materialize(MayaRegTranslator* t, int64_t slot) {
+    MayaRegOperand value = t->values[slot - t->lowest];
+    if (same(value, frame_slot(slot)))
+        return;
+
+    emit(t, REG_MOV, frame_slot(slot), value, (MayaRegOperand) {0});
+    t->values[slot - t->lowest] = frame_slot(slot);
+}
+
+static void flush(MayaRegTranslator* t) {
+    for (int64_t slot = t->pending; slot < t->depth; slot++)
+        materialize(t, slot);
+
+    t->pending = INT64_MAX;
+}
+
+// the frame is left, whatever was pending is dropped.
+static void discard(MayaRegTranslator* t) {
+    for (int64_t slot = t->pending; slot < t->depth; slot++)
+        t->values[slot - t->lowest] = frame_slot(slot);
+
+    t->pending = INT64_MAX;
+}
+
+// slots other than except still reading location, which is about to be written.
+static bool referenced(const MayaRegTranslator* t, MayaRegOperand location, int64_t except) {
+    for (int64_t slot = t->pending; slot < t->depth; slot++) {
+        if (slot != except && same(t->values[slot - t->lowest], location))
+            return true;
+    }
+
+    return false;
+}
+
+static void invalidate(MayaRegTranslator* t, MayaRegOperand location, int64_t except) {
+    for (int64_t slot = t->pending; slot < t->depth; slot++) {
+        if (slot != except && same(t->values[slot - t->lowest], location))
+            materialize(t, slot);
+    }
+}
+
+// writes the arithmetic result value to location instead of its slot when nothing read it yet,
+// the slots still holding it read it from location from then on.
+static bool retarget(MayaRegTranslator* t, MayaRegOperand value, MayaRegOperand location, int64_t slot) {
+    if (t->producer == NO_PRODUCER || referenced(t, location, slot))
+        return false;
+
+    MayaRegInstruction* instruction = &t->out->code[t->producer];
+    MayaRegOperand result = {.space = instruction->spaces[0], .index = instruction->operands[0]};
+    if (!same(value, result))
+        return false;
+
+    instruction->spaces[0] = location.space;
+    instruction->operands[0] = location.index;
+
+    // only the result's own slot and the dups above it can hold it.
+    for (int64_t i = result.index; i < t->depth; i++) {
+        if (!same(t->values[i - t->lowest], result))
+            continue;
+
+        t->values[i - t->lowest] = location;
+        if (i < t->pending && !same(location, frame_slot(i)))
+            t->pending = i;
+    }
+
+    return true;
+}
+
+// pops the top of the stack into location, slot is the frame slot location names or INT64_MIN.
+static void store(MayaRegTranslator* t, MayaRegOperand location, int64_t slot) {
+    MayaRegOperand value = pop(t);
+
+    if (!retarget(t, value, location, slot)) {
+        invalidate(t, location, slot);
+        if (!same(value, location))
+            emit(t, REG_MOV, location, value, (MayaRegOperand) {0});
+    }
+
+    t->producer = NO_PRODUCER;
+    if (slot != INT64_MIN && slot >= t->lowest && slot < t->depth)
+        t->values[slot - t->lowest] = frame_slot(slot);
+}
+
+static void translate_instruction(MayaRegTranslator* t, const MayaInstruction* instruction, bool* live) {
+    static const MayaRegOperand none = {0};
+    uint64_t operand = instruction->operands[0].as_u64;
+
+    switch (instruction->opcode) {
+    case OP_HALT:
+        flush(t);
+        emit(t, REG_HALT, none, none, none);
+        *live = false;
+        break;
+    case OP_PUSH:
+        push(t, constant(t, operand));
+        break;
+    case OP_PUSH_S:
+        push(t, constant(t, (uint64_t)(int64_t)(int8_t)operand));
+        break;
+    case OP_POP:
+        pop(t);
+        break;
+    case OP_DUP:
+    case OP_DUP_S:
+        // dup 0 reads whatever was last popped, which may never have been written to its slot.
+        if (operand == 0) {
+            t->failed = true;
+            break;
+        }
+
+        push(t, value_at(t, t->depth - (int64_t)operand));
+        break;
+    case OP_IADD:
+    case OP_FADD:
+    case OP_ISUB:
+    case OP_FSUB:
+    case OP_IMUL:
+    case OP_FMUL:
+    case OP_IDIV:
+    case OP_FDIV: {
+        MayaRegOperand b = pop(t);
+        MayaRegOperand a = pop(t);
+        MayaRegOperand result = frame_slot(t->depth);
+
+        emit(t, REG_IADD + (instruction->opcode - OP_IADD), result, a, b);
+        push(t, result);
+        t->producer = t->out->code_size - 1;
+        break;
+    }
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_MOD: {
+        MayaRegOperand b = pop(t);
+        MayaRegOperand a = pop(t);
+        MayaRegOperand result = frame_slot(t->depth);
+
+        emit(t, REG_AND + (instruction->opcode - OP_AND), result, a, b);
+        push(t, result);
+        t->producer = t->out->code_size - 1;
+        break;
+    }
+    case OP_I2F:
+    case OP_F2I: {
+        MayaRegOperand a = pop(t);
+        MayaRegOperand result = frame_slot(t->depth);
+
+        emit(t, instruction->opcode == OP_I2F ? REG_I2F : REG_F2I, result, a, none);
+        push(t, result);
+        t->producer = t->out->code_size - 1;
+        break;
+    }
+    case OP_IADDI:
+    case OP_ISUBI:
+    case OP_IMULI: {
+        uint8_t opcode = instruction->opcode == OP_IADDI ? REG_IADD : instruction->opcode == OP_ISUBI ? REG_ISUB : REG_IMUL;
+        MayaRegOperand k = constant(t, operand);
+        MayaRegOperand a = pop(t);
+        MayaRegOperand result = frame_slot(t->depth);
+
+        emit(t, opcode, result, a, k);
+        push(t, result);
+        t->producer = t->out->code_size - 1;
+        break;
+    }
+    case OP_INC:
+    case OP_DEC: {
+        MayaRegOperand location = {.space = SPACE_REGISTER, .index = (int32_t)operand};
+        MayaRegOperand one = constant(t, 1);
+
+        // slots still reading the old value keep it.
+        invalidate(t, location, INT64_MIN);
+        emit(t, instruction->opcode == OP_INC ? REG_IADD : REG_ISUB, location, location, one);
+        break;
+    }
+    case OP_IJLTI: {
+        MayaRegOperand k = constant(t, instruction->operands[1].as_u64);
+
+        flush(t);
+        emit(t, REG_IJLT, none, (MayaRegOperand) {.space = SPACE_REGISTER, .index = (int32_t)operand}, k)->target =
+            (uint32_t)instruction->operands[2].as_u64;
+        break;
+    }
+    case OP_JMP:
+        flush(t);
+        emit(t, REG_JMP, none, none, none)->target = (uint32_t)operand;
+        *live = false;
+        break;
+    case OP_IJEQ:
+    case OP_FJEQ:
+    case OP_IJNEQ:
+    case OP_FJNEQ:
+    case OP_IJGT:
+    case OP_FJGT:
+    case OP_IJLT:
+    case OP_FJLT: {
+        MayaRegOperand b = pop(t);
+        MayaRegOperand a = pop(t);
+
+        flush(t);
+        emit(t, REG_IJEQ + (instruction->opcode - OP_IJEQ), none, a, b)->target = (uint32_t)operand;
+        break;
+    }
+    case OP_CALL:
+        // the callee's frame starts at the current depth, the return point is a block of its own.
+        flush(t);
+        emit(t, REG_CALL, none, none, none)->target = (uint32_t)operand;
+        *live = false;
+        break;
+    case OP_RET:
+        emit(t, REG_RET, none, none, none);
+        discard(t);
+        *live = false;
+        break;
+    case OP_RETV:
+        emit(t, REG_RETV, (MayaRegOperand) {.index = (int32_t)operand}, value_at(t, t->depth - 1), none);
+        discard(t);
+        *live = false;
+        break;
+    case OP_NATIVE:
+        flush(t);
+        emit(t, REG_NATIVE, none, none, none)->target = (uint32_t)operand;
+        t->depth += t->maya->natives_effects[operand].delta;
+        break;
+    case OP_NATIVE_BATCH:
+        flush(t);
+        emit(t, REG_NATIVE_BATCH, (MayaRegOperand) {.index = (int32_t)instruction->operands[1].as_u64}, none, none)
+            ->target = (uint32_t)operand;
+        t->depth -= (int64_t)instruction->operands[1].as_u64;
+        break;
+    case OP_VECTOR:
+        // the kernel reads its arguments from the stack.
+        flush(t);
+        emit(t, REG_VECTOR, none, none, none)->target = (uint32_t)operand;
+        t->depth += maya_vector_entries[operand].effect.delta;
+        break;
+    case OP_LOAD:
+    case OP_LOAD_S:
+        push(t, (MayaRegOperand) {.space = SPACE_REGISTER, .index = (int32_t)operand});
+        break;
+    case OP_STORE:
+    case OP_STORE_S:
+        store(t, (MayaRegOperand) {.space = SPACE_REGISTER, .index = (int32_t)operand}, INT64_MIN);
+        break;
+    case OP_LOAD_ARG:
+        push(t, value_at(t, -1 - (int64_t)operand));
+        break;
+    case OP_STORE_ARG:
+        store(t, frame_slot(-1 - (int64_t)operand), -1 - (int64_t)operand);
+        break;
+    case OP_LOAD_LOCAL:
+        push(t, value_at(t, (int64_t)operand));
+        break;
+    case OP_STORE_LOCAL:
+        store(t, frame_slot((int64_t)operand), (int64_t)operand);
+        break;
+    case OP_LOAD_PTR:
+        // pointers see the stack, so it has to be real from here on.
+        flush(t);
+        emit(t, REG_LOAD_PTR, frame_slot(t->depth), frame_slot(t->depth - (int64_t)operand), none);
+        push(t, frame_slot(t->depth));
+        break;
+    case OP_PUSH_PTR:
+    case OP_STORE_PTR:
+        flush(t);
+        emit(t, instruction->opcode == OP_PUSH_PTR ? REG_PUSH_PTR : REG_STORE_PTR,
+             (MayaRegOperand) {.space = SPACE_REGISTER, .index = (int32_t)instruction->operands[1].as_u64},
+             frame_slot(t->depth - 1), constant(t, operand));
+        break;
+    default:
+        t->failed = true;
+        break;
+    }
+}
+
+static bool is_jump(uint8_t opcode) {
+    return opcode == REG_JMP || (opcode >= REG_IJEQ && opcode <= REG_FJLT) || opcode == REG_CALL;
+}
+
+// the deepest slot the frame of the function at entry reaches, following its instructions without
+// entering the functions it calls. visits holds the visit of the last walk over each rip.
+static int64_t frame_depth(const uint8_t* program, size_t program_size, const int64_t* depths, size_t entry,
+                           uint32_t* visits, uint32_t visit, size_t* worklist) {
+    int64_t deepest = 0;
+    size_t worklist_size = 0;
+
+    visits[entry] = visit;
+    worklist[worklist_size++] = entry;
+
+    while (worklist_size > 0) {
+        size_t rip = worklist[--worklist_size];
+        deepest = depths[rip] > deepest ? depths[rip] : deepest;
+
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&program[rip], &instruction);
+        size_t next[2] = {rip + size, SIZE_MAX};
+
+        switch (instruction.opcode) {
+        case OP_HALT:
+        case OP_RET:
+        case OP_RETV:
+            continue;
+        case OP_JMP:
+            next[0] = instruction.operands[0].as_u64;
+            break;
+        case OP_IJEQ:
+        case OP_FJEQ:
+        case OP_IJNEQ:
+        case OP_FJNEQ:
+        case OP_IJGT:
+        case OP_FJGT:
+        case OP_IJLT:
+        case OP_FJLT:
+            next[1] = instruction.operands[0].as_u64;
+            break;
+        case OP_IJLTI:
+            next[1] = instruction.operands[2].as_u64;
+            break;
+        default:
+            break;
+        }
+
+        for (size_t i = 0; i < 2; i++) {
+            if (next[i] < program_size && visits[next[i]] != visit && depths[next[i]] != MAYA_DEPTH_UNREACHED) {
+                visits[next[i]] = visit;
+                worklist[worklist_size++] = next[i];
+            }
+        }
+    }
+
+    return deepest;
+}
+
+void maya_reg_destroy(MayaRegProgram* program) {
+    if (program == NULL)
+        return;
+
+    free(program->code);
+    free(program->constants);
+    free(program);
+}
+
+MayaRegProgram* maya_reg_translate(const MayaVm* maya) {
+    size_t program_size = maya->program_size;
+    if (program_size == 0 || program_size > UINT32_MAX)
+        return NULL;
+
+    MayaRegProgram* out = calloc(1, sizeof(MayaRegProgram));
+    int64_t* depths = malloc(sizeof(int64_t) * program_size);
+    uint8_t* program = malloc(program_size);
+    bool* starts = calloc(program_size, sizeof(bool));
+    uint32_t* indices = malloc(sizeof(uint32_t) * program_size);
+    uint32_t* visits = calloc(program_size, sizeof(uint32_t));
+    int64_t* frame_depths = calloc(program_size, sizeof(int64_t)); // plus one, 0 until walked
+    size_t* worklist = malloc(sizeof(size_t) * program_size);
+    MayaRegOperand* values = NULL;
+    if (!out || !depths || !program || !starts || !indices || !visits || !frame_depths || !worklist ||
+        !maya_verify_depths(maya, NULL, depths))
+        goto fail;
+
+    // superinstructions keep the instructions they replace, the unfused program is translated.
+    memcpy(program, maya->program, program_size);
+    maya_unfuse_program(program, program_size);
+
+    int64_t lowest = 0;
+    int64_t highest = 0;
+    starts[maya->rip] = true;
+
+    for (size_t rip = 0; rip < program_size;) {
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&program[rip], &instruction);
+        if (size == 0)
+            break;
+
+        if (depths[rip] != MAYA_DEPTH_UNREACHED) {
+            lowest = depths[rip] < lowest ? depths[rip] : lowest;
+            highest = depths[rip] > highest ? depths[rip] : highest;
+
+            uint32_t target = (uint32_t)instruction.operands[0].as_u64;
+            if (instruction.opcode == OP_CALL) {
+                starts[target] = true;
+                if (rip + size < program_size)
+                    starts[rip + size] = true;
+            } else if (instruction.opcode >= OP_JMP && instruction.opcode <= OP_FJLT) {
+                starts[target] = true;
+            } else if (instruction.opcode == OP_IJLTI) {
+                starts[instruction.operands[2].as_u64] = true;
+            }
+        }
+
+        rip += size;
+    }
+
+    // arithmetic pops both operands before pushing its result, two below the shallowest depth.
+    // dup and load_arg may reach further below, those slots always hold their own value.
+    lowest -= 2;
+    if (lowest < INT32_MIN / 2 || highest > INT32_MAX / 2)
+        goto fail;
+
+    values = malloc(sizeof(MayaRegOperand) * (size_t)(highest - lowest + 2));
+    if (!values)
+        goto fail;
+
+    for (int64_t slot = lowest; slot < highest + 2; slot++)
+        values[slot - lowest] = frame_slot(slot);
+
+    MayaRegTranslator t = {
+        .maya = maya,
+        .out = out,
+        .values = values,
+        .lowest = lowest,
+        .pending = INT64_MAX,
+        .producer = NO_PRODUCER,
+    };
+
+    bool live = false;
+    for (size_t rip = 0; rip < program_size && !t.failed;) {
+        MayaInstruction instruction;
+        size_t size = maya_decode_instruction(&program[rip], &instruction);
+        if (size == 0)
+            break;
+
+        if (depths[rip] == MAYA_DEPTH_UNREACHED) {
+            rip += size;
+            continue;
+        }
+
+        // jump targets and return points are entered with every value in its slot.
+        if (starts[rip] || !live) {
+            if (live) {
+                flush(&t);
+            } else {
+                discard(&t);
+            }
+
+            t.depth = depths[rip];
+            t.producer = NO_PRODUCER;
+            live = true;
+        }
+
+        t.rip = (uint32_t)rip;
+        indices[rip] = (uint32_t)out->code_size;
+        translate_instruction(&t, &instruction, &live);
+        rip += size;
+    }
+
+    if (t.failed || out->code_size > UINT32_MAX)
+        goto fail;
+
+    // results are written straight to their slots while the slots below them wait, so a write can
+    // land well past the guard page. calls check that the whole frame of their callee fits instead.
+    uint32_t visit = 0;
+    for (size_t i = 0; i < out->code_size; i++) {
+        uint32_t target = out->code[i].target;
+        if (out->code[i].opcode == REG_CALL) {
+            if (frame_depths[target] == 0)
+                frame_depths[target] = frame_depth(program, program_size, depths, target, visits, ++visit, worklist) + 1;
+
+            out->code[i].operands[0] = (int32_t)(frame_depths[target] - 1);
+        }
+
+        if (is_jump(out->code[i].opcode))
+            out->code[i].target = indices[target];
+    }
+
+    out->entry = indices[maya->rip];
+    out->entry_depth = (size_t)frame_depth(program, program_size, depths, maya->rip, visits, ++visit, worklist);
+
+    free(worklist);
+    free(frame_depths);
+    free(visits);
+    free(values);
+    free(indices);
+    free(starts);
+    free(program);
+    free(depths);
+    return out;
+
+fail:
+    free(worklist);
+    free(frame_depths);
+    free(visits);
+    free(values);
+    free(indices);
+    free(starts);
+    free(program);
+    free(depths);
+    maya_reg_destroy(out);
+    return NULL;
+}
+
+static void print_operand(const MayaRegProgram* program, uint8_t space, int32_t index) {
+    switch (space) {
+    case SPACE_FRAME:
+        printf(" f%d", index);
+        break;
+    case SPACE_REGISTER:
+        printf(" r%d", index);
+        break;
+    default:
+        printf(" #%ld", program->constants[index].as_i64);
+        break;
+    }
+}
+
+void maya_reg_disassemble(const MayaRegProgram* program) {
+    for (size_t i = 0; i < program->code_size; i++) {
+        const MayaRegInstruction* instruction = &program->code[i];
+        printf("%zu: %s", i, opcode_names[instruction->opcode]);
+
+        switch (instruction->opcode) {
+        case REG_HALT:
+        case REG_RET:
+            break;
+        case REG_JMP:
+        case REG_CALL:
+        case REG_NATIVE:
+            printf(" %u", instruction->target);
+            break;
+        case REG_NATIVE_BATCH:
+            printf(" %u %d", instruction->target, instruction->operands[0]);
+            break;
+        case REG_VECTOR:
+            printf(" %s", maya_vector_entries[instruction->target].name);
+            break;
+        case REG_RETV:
+            print_operand(program, instruction->spaces[1], instruction->operands[1]);
+            printf(" %d", instruction->operands[0]);
+            break;
+        case REG_MOV:
+        case REG_LOAD_PTR:
+        case REG_I2F:
+        case REG_F2I:
+            for (size_t n = 0; n < 2; n++)
+                print_operand(program, instruction->spaces[n], instruction->operands[n]);
+            break;
+        default:
+            if (instruction->opcode >= REG_IJEQ && instruction->opcode <= REG_FJLT) {
+                for (size_t n = 1; n < 3; n++)
+                    print_operand(program, instruction->spaces[n], instruction->operands[n]);
+
+                printf(" %u", instruction->target);
+            } else {
+                for (size_t n = 0; n < 3; n++)
+                    print_operand(program, instruction->spaces[n], instruction->operands[n]);
+            }
+            break;
+        }
+
+        printf(" # %u\n", instruction->rip);
+    }
+}
+
+#ifdef MAYA_BENCHMARK
+#define COUNT_INSTRUCTION() maya->executed++
+#else
+#define COUNT_INSTRUCTION()
+#endif
+
+#ifdef MAYA_THREADED_DISPATCH
+#define CASE(op) label_##op
+#define DISPATCH()                                                                          \
+    {                                                                                       \
+        COUNT_INSTRUCTION();                                                                \
+        goto *dispatch_table[code->opcode];                                                 \
+    }                                                                                       \
+
+#else
+#define CASE(op) case op
+#define DISPATCH() goto dispatch
+#endif
+
+#define OPERAND(n) spaces[code->spaces[n]][code->operands[n]]
+
+#define FAIL(err)                                                                           \
+    {                                                                                       \
+        error = err;                                                                        \
+        goto done;                                                                          \
+    }                                                                                       \
+
+#define ARITHMETIC(op, field)                                                               \
+    OPERAND(0).field = OPERAND(1).field op OPERAND(2).field;                                \
+    code++;                                                                                 \
+    DISPATCH();
+
+#define BRANCH(op, field)                                                                   \
+    code = OPERAND(1).field op OPERAND(2).field ? &base[code->target] : code + 1;           \
+    DISPATCH();
+
+// the program is verified, nothing but division by zero, the natives' stack effects and the frame
+// depth of calls is checked.
+static MayaError maya_reg_run(MayaVm* maya) {
+#ifdef MAYA_THREADED_DISPATCH
+    static void* dispatch_table[REG_COUNT] = {
+        [REG_HALT] = &&CASE(REG_HALT),
+        [REG_MOV] = &&CASE(REG_MOV),
+        [REG_IADD] = &&CASE(REG_IADD),
+        [REG_FADD] = &&CASE(REG_FADD),
+        [REG_ISUB] = &&CASE(REG_ISUB),
+        [REG_FSUB] = &&CASE(REG_FSUB),
+        [REG_IMUL] = &&CASE(REG_IMUL),
+        [REG_FMUL] = &&CASE(REG_FMUL),
+        [REG_IDIV] = &&CASE(REG_IDIV),
+        [REG_FDIV] = &&CASE(REG_FDIV),
+        [REG_AND] = &&CASE(REG_AND),
+        [REG_OR] = &&CASE(REG_OR),
+        [REG_XOR] = &&CASE(REG_XOR),
+        [REG_SHL] = &&CASE(REG_SHL),
+        [REG_SHR] = &&CASE(REG_SHR),
+        [REG_MOD] = &&CASE(REG_MOD),
+        [REG_I2F] = &&CASE(REG_I2F),
+        [REG_F2I] = &&CASE(REG_F2I),
+        [REG_JMP] = &&CASE(REG_JMP),
+        [REG_IJEQ] = &&CASE(REG_IJEQ),
+        [REG_FJEQ] = &&CASE(REG_FJEQ),
+        [REG_IJNEQ] = &&CASE(REG_IJNEQ),
+        [REG_FJNEQ] = &&CASE(REG_FJNEQ),
+        [REG_IJGT] = &&CASE(REG_IJGT),
+        [REG_FJGT] = &&CASE(REG_FJGT),
+        [REG_IJLT] = &&CASE(REG_IJLT),
+        [REG_FJLT] = &&CASE(REG_FJLT),
+        [REG_CALL] = &&CASE(REG_CALL),
+        [REG_RET] = &&CASE(REG_RET),
+        [REG_RETV] = &&CASE(REG_RETV),
+        [REG_NATIVE] = &&CASE(REG_NATIVE),
+        [REG_NATIVE_BATCH] = &&CASE(REG_NATIVE_BATCH),
+        [REG_VECTOR] = &&CASE(REG_VECTOR),
+        [REG_LOAD_PTR] = &&CASE(REG_LOAD_PTR),
+        [REG_PUSH_PTR] = &&CASE(REG_PUSH_PTR),
+        [REG_STORE_PTR] = &&CASE(REG_STORE_PTR),
+    };
+#endif
+
+    const MayaRegProgram* program = maya->trace;
+    const MayaRegInstruction* base = program->code;
+    const MayaRegInstruction* code = &base[program->entry];
+
+    Frame* stack = maya->stack;
+    MayaCallFrame* frames = maya->frames;
+    size_t fp = maya->fp;
+    size_t bp = maya->bp;
+
+    // indexed by the operand space, the frame moves with bp.
+    Frame* spaces[SPACE_COUNT] = {&stack[bp], maya->registers, program->constants};
+
+    MayaError error = ERR_OK;
+    if (bp + program->entry_depth > maya->stack_limit)
+        FAIL(ERR_STACK_OVERFLOW);
+
+#ifdef MAYA_THREADED_DISPATCH
+    DISPATCH();
+    {
+#else
+dispatch:
+    COUNT_INSTRUCTION();
+
+    switch (code->opcode) {
+#endif
+    CASE(REG_HALT):
+        maya->halt = true;
+        goto done;
+    CASE(REG_MOV):
+        OPERAND(0) = OPERAND(1);
+        code++;
+        DISPATCH();
+    CASE(REG_IADD):
+        ARITHMETIC(+, as_i64);
+    CASE(REG_FADD):
+        ARITHMETIC(+, as_f64);
+    CASE(REG_ISUB):
+        ARITHMETIC(-, as_i64);
+    CASE(REG_FSUB):
+        ARITHMETIC(-, as_f64);
+    CASE(REG_IMUL):
+        ARITHMETIC(*, as_i64);
+    CASE(REG_FMUL):
+        ARITHMETIC(*, as_f64);
+    CASE(REG_IDIV):
+        if (OPERAND(2).as_i64 == 0)
+            FAIL(ERR_DIV_BY_ZERO);
+
+        // INT64_MIN / -1 wraps and INT64_MIN % -1 is 0 instead of trapping, as in the interpreter.
+        if (OPERAND(2).as_i64 == -1) {
+            OPERAND(0).as_u64 = 0 - OPERAND(1).as_u64;
+            code++;
+            DISPATCH();
+        }
+
+        ARITHMETIC(/, as_i64);
+    CASE(REG_FDIV):
+        ARITHMETIC(/, as_f64);
+    CASE(REG_AND):
+        ARITHMETIC(&, as_u64);
+    CASE(REG_OR):
+        ARITHMETIC(|, as_u64);
+    CASE(REG_XOR):
+        ARITHMETIC(^, as_u64);
+    CASE(REG_SHL):
+        OPERAND(0).as_u64 = OPERAND(1).as_u64 << (OPERAND(2).as_u64 & 63);
+        code++;
+        DISPATCH();
+    CASE(REG_SHR):
+        OPERAND(0).as_u64 = OPERAND(1).as_u64 >> (OPERAND(2).as_u64 & 63);
+        code++;
+        DISPATCH();
+    CASE(REG_MOD):
+        if (OPERAND(2).as_i64 == 0)
+            FAIL(ERR_DIV_BY_ZERO);
+
+        if (OPERAND(2).as_i64 == -1) {
+            OPERAND(0).as_i64 = 0;
+            code++;
+            DISPATCH();
+        }
+
+        ARITHMETIC(%, as_i64);
+    CASE(REG_I2F):
+        OPERAND(0).as_f64 = (double)OPERAND(1).as_i64;
+        code++;
+        DISPATCH();
+    CASE(REG_F2I):
+        OPERAND(0).as_i64 = (int64_t)OPERAND(1).as_f64;
+        code++;
+        DISPATCH();
+    CASE(REG_JMP):
+        code = &base[code->target];
+        DISPATCH();
+    CASE(REG_IJEQ):
+        BRANCH(==, as_i64);
+    CASE(REG_FJEQ):
+        BRANCH(==, as_f64);
+    CASE(REG_IJNEQ):
+        BRANCH(!=, as_i64);
+    CASE(REG_FJNEQ):
+        BRANCH(!=, as_f64);
+    CASE(REG_IJGT):
+        BRANCH(>, as_i64);
+    CASE(REG_FJGT):
+        BRANCH(>, as_f64);
+    CASE(REG_IJLT):
+        BRANCH(<, as_i64);
+    CASE(REG_FJLT):
+        BRANCH(<, as_f64);
+    CASE(REG_CALL):
+        // a call past the limit faults on the guard page after the call stack, a frame that does
+        // not fit is refused before its slots are written out of order.
+        if (bp + code->depth + code->operands[0] > maya->stack_limit)
+            FAIL(ERR_STACK_OVERFLOW);
+
+        frames[fp++] = (MayaCallFrame) {.rip = (size_t)(code + 1 - base), .bp = bp};
+        bp += code->depth;
+        spaces[SPACE_FRAME] = &stack[bp];
+        code = &base[code->target];
+        DISPATCH();
+    CASE(REG_RET):
+        fp--;
+        code = &base[frames[fp].rip];
+        bp = frames[fp].bp;
+        spaces[SPACE_FRAME] = &stack[bp];
+        DISPATCH();
+    CASE(REG_RETV):
+        // the value replaces the frame and the arguments it drops.
+        stack[bp - code->operands[0]] = OPERAND(1);
+        fp--;
+        code = &base[frames[fp].rip];
+        bp = frames[fp].bp;
+        spaces[SPACE_FRAME] = &stack[bp];
+        DISPATCH();
+    CASE(REG_NATIVE): {
+        size_t sp = bp + code->depth;
+
+        maya->sp = sp;
+        maya->fp = fp;
+        maya->bp = bp;
+        error = maya->natives[code->target](maya);
+
+        // the translation took the declared stack effect for granted, hold the native to it.
+        if (error == ERR_OK && maya->sp != sp + maya->natives_effects[code->target].delta)
+            error = ERR_NATIVE_STACK_EFFECT;
+
+        if (error != ERR_OK)
+            goto done;
+
+        code++;
+        DISPATCH();
+    }
+    CASE(REG_NATIVE_BATCH): {
+        size_t sp = bp + code->depth;
+        size_t count = code->operands[0];
+
+        maya->sp = sp;
+        maya->fp = fp;
+        maya->bp = bp;
+        error = maya->natives_batches[code->target](maya, &stack[sp - count], count);
+
+        if (error != ERR_OK)
+            goto done;
+
+        code++;
+        DISPATCH();
+    }
+    CASE(REG_VECTOR): {
+        size_t sp = bp + code->depth;
+
+        maya_vector_run(maya, (uint8_t)code->target, &stack[sp - maya_vector_entries[code->target].effect.arity]);
+        code++;
+        DISPATCH();
+    }
+    CASE(REG_LOAD_PTR):
+        OPERAND(0).as_ptr = &OPERAND(1);
+        code++;
+        DISPATCH();
+    CASE(REG_PUSH_PTR):
+        memcpy(OPERAND(1).as_ptr + (OPERAND(2).as_u64 * sizeof(Frame)), &OPERAND(0), sizeof(Frame));
+
+        // the collector marks while the program runs, it has to see pointers stored into the heap.
+        if (maya->heap != NULL)
+            maya_heap_barrier(maya->heap, OPERAND(0));
+
+        code++;
+        DISPATCH();
+    CASE(REG_STORE_PTR):
+        memcpy(&OPERAND(0), OPERAND(1).as_ptr + (OPERAND(2).as_u64 * sizeof(Frame)), sizeof(Frame));
+        code++;
+        DISPATCH();
+#ifndef MAYA_THREADED_DISPATCH
+    default:
+        FAIL(ERR_INVALID_INSTRUCTION);
+#endif
+    }
+
+done:
+    // the stack is real at halt and around natives, the depth is exact there.
+    maya->rip = code->rip;
+    maya->sp = bp + code->depth;
+    maya->fp = fp;
+    maya->bp = bp;
+    return error;
+}
+
+#undef BRANCH
+#undef ARITHMETIC
+#undef FAIL
+#undef OPERAND
+#undef DISPATCH
+#undef CASE
+#undef COUNT_INSTRUCTION
+
+MayaError maya_reg_execute(MayaRegProgram* program, MayaVm* maya) {
+    maya->trace = program;
+    return maya_stack_guarded(maya, maya_reg_run);
+}
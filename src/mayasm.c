@@ -43,9 +43,35 @@
 
 #define SINGLE_INSTRUCTION(ins)                                                             \
     {                                                                                       \
-        instructions[len++] = (MayaInstruction) {                                           \
+        len += emit_instruction(&code[len], (MayaInstruction) {.opcode = ins});             \
+                                                                                            \
+        STRIP_COMMENT(&line);                                                               \
+        CHECK_EOL(&line);                                                                   \
+                                                                                            \
+        goto reallocate;                                                                    \
+    }                                                                                       \
+
+#define INDEX_INSTRUCTION(ins, op_ins)                                                      \
+    {                                                                                       \
+        StringView operand = sv_chop_by_delim(&line, " ");                                  \
+        EXPECT_OPERAND(operand, op_ins);                                                    \
+                                                                                            \
+        char type = 0;                                                                      \
+        if (!check_is_valid_number(operand, &type) || (type != 0 && type != 'U')) {         \
+            fprintf(stderr, "ERROR: %s only accept integer values\n", op_ins);              \
+            exit(EXIT_FAILURE);                                                             \
+        }                                                                                   \
+                                                                                            \
+        Frame frame = {.as_u64 = strtoull(operand.str, NULL, 10)};                          \
+        if (frame.as_u64 > UINT8_MAX) {                                                     \
+            fprintf(stderr, "ERROR: %s index is out of range\n", op_ins);                   \
+            exit(EXIT_FAILURE);                                                             \
+        }                                                                                   \
+                                                                                            \
+        len += emit_instruction(&code[len], (MayaInstruction) {                             \
             .opcode = ins,                                                                  \
-        };                                                                                  \
+            .operands = {frame},                                                            \
+        });                                                                                 \
                                                                                             \
         STRIP_COMMENT(&line);                                                               \
         CHECK_EOL(&line);                                                                   \
@@ -53,6 +79,17 @@
         goto reallocate;                                                                    \
     }                                                                                       \
 
+// appends item to a growable array, doubling its capacity when full.
+#define APPEND(items, size, cap, item)                                                      \
+    {                                                                                       \
+        if ((size) == (cap)) {                                                              \
+            (cap) = (cap) == 0 ? 64 : (cap) * 2;                                            \
+            (items) = xrealloc((items), sizeof(*(items)) * (cap));                          \
+        }                                                                                   \
+                                                                                            \
+        (items)[(size)++] = item;                                                           \
+    }                                                                                       \
+
 #define JMPS_INSTRUCTION(ins, op_ins)                                                           \
     {                                                                                           \
         StringView operand = sv_chop_by_delim(&line, " ");                                      \
@@ -60,14 +97,10 @@
                                                                                                 \
         char type = 0;                                                                          \
         if (check_is_valid_identifier(operand)) {                                               \
-            env->deferred_symbol[env->deferred_symbol_size++] = (MayaDeferredSymbol) {          \
-                .rip = len,                                                                     \
-                .symbol = operand,                                                              \
-            };                                                                                  \
+            APPEND(env->deferred_symbols, env->deferred_symbols_size, env->deferred_symbols_cap,  \
+                   ((MayaDeferredSymbol) {.rip = len, .symbol = operand}));                      \
                                                                                                 \
-            instructions[len++] = (MayaInstruction) {                                           \
-                .opcode = ins,                                                                  \
-            };                                                                                  \
+            len += emit_deferred_instruction(&code[len], ins);                                  \
                                                                                                 \
             STRIP_COMMENT(&line);                                                               \
             CHECK_EOL(&line);                                                                   \
@@ -83,10 +116,15 @@
                 exit(EXIT_FAILURE);                                                             \
             }                                                                                   \
                                                                                                 \
-            instructions[len++] = (MayaInstruction) {                                           \
+            if (frame.as_u64 > UINT32_MAX) {                                                    \
+                fprintf(stderr, "ERROR: %s target is out of range\n", op_ins);                  \
+                exit(EXIT_FAILURE);                                                             \
+            }                                                                                   \
+                                                                                                \
+            len += emit_instruction(&code[len], (MayaInstruction) {                             \
                 .opcode = ins,                                                                  \
-                .operands = {frame},                                                             \
-            };                                                                                  \
+                .operands = {frame},                                                            \
+            });                                                                                 \
                                                                                                 \
             STRIP_COMMENT(&line);                                                               \
             CHECK_EOL(&line);                                                                   \
@@ -118,6 +156,135 @@ static void* xrealloc(void* old_ptr, size_t size) {
     return ptr;
 }
 
+static size_t emit_instruction(uint8_t* code, MayaInstruction instruction) {
+    return maya_encode_instruction(maya_compact_instruction(instruction), code);
+}
+
+// operands of deferred instructions are patched by the linker, so they always use the wide form.
+static size_t emit_deferred_instruction(uint8_t* code, MayaOpCode opcode) {
+    return maya_encode_instruction((MayaInstruction) {.opcode = opcode}, code);
+}
+
+// mnemonics are looked up through a perfect hash: the table is built once with the first seed
+// that maps every mnemonic to its own slot, so a lookup is one hash and one comparison.
+#define MNEMONICS_CAP 128
+
+typedef struct Mnemonic_t {
+    const char* name;
+    MayaOpCode opcode;
+} Mnemonic;
+
+static const Mnemonic mnemonics[] = {
+    {"halt", OP_HALT},
+    {"push", OP_PUSH},
+    {"pop", OP_POP},
+    {"dup", OP_DUP},
+    {"iadd", OP_IADD},
+    {"fadd", OP_FADD},
+    {"isub", OP_ISUB},
+    {"fsub", OP_FSUB},
+    {"imul", OP_IMUL},
+    {"fmul", OP_FMUL},
+    {"idiv", OP_IDIV},
+    {"fdiv", OP_FDIV},
+    {"jmp", OP_JMP},
+    {"ijeq", OP_IJEQ},
+    {"fjeq", OP_FJEQ},
+    {"ijneq", OP_IJNEQ},
+    {"fjneq", OP_FJNEQ},
+    {"ijgt", OP_IJGT},
+    {"fjgt", OP_FJGT},
+    {"ijlt", OP_IJLT},
+    {"fjlt", OP_FJLT},
+    {"call", OP_CALL},
+    {"native", OP_NATIVE},
+    {"native_batch", OP_NATIVE_BATCH},
+    {"ret", OP_RET},
+    {"load", OP_LOAD},
+    {"store", OP_STORE},
+    {"load_ptr", OP_LOAD_PTR},
+    {"push_ptr", OP_PUSH_PTR},
+    {"store_ptr", OP_STORE_PTR},
+    {"retv", OP_RETV},
+    {"load_arg", OP_LOAD_ARG},
+    {"store_arg", OP_STORE_ARG},
+    {"load_local", OP_LOAD_LOCAL},
+    {"store_local", OP_STORE_LOCAL},
+    {"iaddi", OP_IADDI},
+    {"isubi", OP_ISUBI},
+    {"imuli", OP_IMULI},
+    {"inc", OP_INC},
+    {"dec", OP_DEC},
+    {"ijlti", OP_IJLTI},
+    {"and", OP_AND},
+    {"or", OP_OR},
+    {"xor", OP_XOR},
+    {"shl", OP_SHL},
+    {"shr", OP_SHR},
+    {"mod", OP_MOD},
+    {"i2f", OP_I2F},
+    {"f2i", OP_F2I},
+};
+
+static struct {
+    uint64_t seed;
+    StringView names[MNEMONICS_CAP];
+    MayaOpCode opcodes[MNEMONICS_CAP];
+} mnemonics_table;
+
+static size_t mnemonic_slot(StringView name, uint64_t seed) {
+    return ((sv_hash(name) ^ seed) * 0x9e3779b97f4a7c15) >> (64 - 7);
+}
+
+static void build_mnemonics_table(void) {
+    if (mnemonics_table.seed != 0)
+        return;
+
+    for (uint64_t seed = 1;; seed++) {
+        memset(&mnemonics_table, 0, sizeof(mnemonics_table));
+
+        bool collision = false;
+        for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]) && !collision; i++) {
+            StringView name = sv_from_cstr(mnemonics[i].name);
+            size_t slot = mnemonic_slot(name, seed);
+
+            collision = mnemonics_table.names[slot].str != NULL;
+            mnemonics_table.names[slot] = name;
+            mnemonics_table.opcodes[slot] = mnemonics[i].opcode;
+        }
+
+        if (!collision) {
+            mnemonics_table.seed = seed;
+            return;
+        }
+    }
+}
+
+// returns OP_COUNT when name is not an instruction.
+static MayaOpCode lookup_mnemonic(StringView name) {
+    size_t slot = mnemonic_slot(name, mnemonics_table.seed);
+    if (mnemonics_table.names[slot].str == NULL || !sv_equals(mnemonics_table.names[slot], name))
+        return OP_COUNT;
+
+    return mnemonics_table.opcodes[slot];
+}
+
+// labels and macros share one namespace, a name can only be defined once.
+static void define_symbol(MayaEnv* env, MayaSymbol symbol) {
+    MayaSymbol* existing = maya_symbols_insert(&env->symbols, symbol);
+    if (existing == NULL)
+        return;
+
+    if (existing->kind != symbol.kind) {
+        fprintf(stderr, "ERROR: duplicate label and macro name '%.*s'\n", (int)symbol.name.len, symbol.name.str);
+    } else {
+        fprintf(stderr, "ERROR: duplicate %s '%.*s'\n", symbol.kind == SYMBOL_LABEL ? "label" : "macro",
+                (int)symbol.name.len, symbol.name.str);
+    }
+
+    exit(EXIT_FAILURE);
+}
+
 static bool check_is_valid_identifier(StringView sv) {
     if (isalpha(sv.str[0]) || sv.str[0] == '_') {
         do {
@@ -195,6 +362,30 @@ static bool check_is_valid_number(StringView sv, char* type) {
     return false;
 }
 
+// parses the integer immediate of iaddi, isubi, imuli and ijlti, unsigned with a U suffix.
+static Frame parse_immediate(StringView operand, const char* op_ins) {
+    char type = 0;
+    if (!check_is_valid_number(operand, &type)) {
+        fprintf(stderr, "ERROR: invalid operand: '%.*s'\n", (int)operand.len, operand.str);
+        exit(EXIT_FAILURE);
+    }
+
+    Frame frame;
+    switch (type) {
+    case 'U':
+        frame.as_u64 = strtoull(operand.str, NULL, 10);
+        break;
+    case 'F':
+        fprintf(stderr, "ERROR: %s only accept integer values\n", op_ins);
+        exit(EXIT_FAILURE);
+    default:
+        frame.as_i64 = strtoll(operand.str, NULL, 10);
+        break;
+    }
+
+    return frame;
+}
+
 static bool check_is_valid_string(StringView sv) {
     if (sv.str[0] == '"') {
         sv.str++;
@@ -214,14 +405,16 @@ static bool check_is_valid_string(StringView sv) {
     return false;
 }
 
-void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_path) {
-    size_t len = 0;
-    size_t cap = 1;
-    MayaInstruction* instructions = xmalloc(sizeof(MayaInstruction) * cap);
+void maya_translate_asm(MayaEnv* env) {
+    size_t len = 0; // in bytes
+    size_t cap = 256;
+    uint8_t* code = xmalloc(sizeof(uint8_t) * cap);
 
     StringView entry = {.str = NULL, .len = 0};
 
-    StringView str = sv_from_cstr(buffer);
+    build_mnemonics_table();
+
+    StringView str = sv_from_cstr(env->buffer);
     while (str.len != 0) {
         str = sv_strip_by_delim(str, " \n");
 
@@ -269,10 +462,11 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                     exit(EXIT_FAILURE);
                 }
 
-                env->macros[env->macros_size++] = (MayaMacro) {
+                define_symbol(env, (MayaSymbol) {
                     .name = id,
-                    .frame = frame,
-                };
+                    .kind = SYMBOL_MACRO,
+                    .value = frame,
+                });
 
                 STRIP_COMMENT(&line);
                 CHECK_EOL(&line);
@@ -282,13 +476,15 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
 
             // handle label
             if (check_is_valid_identifier((StringView) {.str = opcode.str, .len = opcode.len - 1}) && opcode.str[opcode.len - 1] == ':') {
-                env->labels[env->labels_size++] = (MayaLabel) {
-                    .id = (StringView) {
-                        .str = opcode.str,
-                        .len = opcode.len - 1,
-                    },
-                    .rip = len,
-                };
+                StringView id = {.str = opcode.str, .len = opcode.len - 1};
+
+                define_symbol(env, (MayaSymbol) {
+                    .name = id,
+                    .kind = SYMBOL_LABEL,
+                    .value = {.as_u64 = len},
+                });
+
+                APPEND(env->labels, env->labels_size, env->labels_cap, ((MayaLabel) {.id = id, .rip = len}));
 
                 STRIP_COMMENT(&line);
                 CHECK_EOL(&line);
@@ -296,7 +492,9 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 continue;
             }
 
-            if (sv_equals(opcode, sv_from_cstr("entry"))) {
+            MayaOpCode mnemonic = lookup_mnemonic(opcode);
+
+            if (mnemonic == OP_COUNT && sv_equals(opcode, sv_from_cstr("entry"))) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "entry");
 
@@ -313,22 +511,36 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 exit(EXIT_FAILURE);
             }
 
-            if (sv_equals(opcode, sv_from_cstr("halt")))
+            // the kernels of the vector instruction are mnemonics of their own.
+            if (mnemonic == OP_COUNT) {
+                for (size_t kernel = 0; kernel < VEC_COUNT; kernel++) {
+                    if (!sv_equals(opcode, sv_from_cstr(maya_vector_entries[kernel].name)))
+                        continue;
+
+                    len += emit_instruction(&code[len], (MayaInstruction) {
+                        .opcode = OP_VECTOR,
+                        .operands = {{.as_u64 = kernel}},
+                    });
+
+                    STRIP_COMMENT(&line);
+                    CHECK_EOL(&line);
+
+                    goto reallocate;
+                }
+            }
+
+            if (mnemonic == OP_HALT)
                 SINGLE_INSTRUCTION(OP_HALT);
 
-            if (sv_equals(opcode, sv_from_cstr("push"))) {
+            if (mnemonic == OP_PUSH) {
                 line = sv_strip_by_delim(line, " ");
                 if (check_is_valid_string(line)) {
                     StringView string_literal = sv_chop_by_string_literal(&line);
 
-                    env->str_literals[env->str_literals_size++] = (MayaStringLiteral) {
-                        .literal = string_literal,
-                        .rip = len,
-                    };
+                    APPEND(env->str_literals, env->str_literals_size, env->str_literals_cap,
+                           ((MayaStringLiteral) {.literal = string_literal, .rip = len}));
 
-                    instructions[len++] = (MayaInstruction) {
-                        .opcode = OP_PUSH,
-                    };
+                    len += emit_deferred_instruction(&code[len], OP_PUSH);
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -355,24 +567,20 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         break;
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_PUSH,
                         .operands = {frame},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
 
                     goto reallocate;
                 } else if (check_is_valid_identifier(operand)) {
-                    env->deferred_symbol[env->deferred_symbol_size++] = (MayaDeferredSymbol) {
-                        .rip = len,
-                        .symbol = operand,
-                    };
+                    APPEND(env->deferred_symbols, env->deferred_symbols_size, env->deferred_symbols_cap,
+                           ((MayaDeferredSymbol) {.rip = len, .symbol = operand}));
 
-                    instructions[len++] = (MayaInstruction) {
-                        .opcode = OP_PUSH,
-                    };
+                    len += emit_deferred_instruction(&code[len], OP_PUSH);
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -384,10 +592,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 }
             }
 
-            if (sv_equals(opcode, sv_from_cstr("pop")))
+            if (mnemonic == OP_POP)
                 SINGLE_INSTRUCTION(OP_POP);
 
-            if (sv_equals(opcode, sv_from_cstr("dup"))) {
+            if (mnemonic == OP_DUP) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "dup");
 
@@ -402,10 +610,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_DUP,
                         .operands = {frame},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -417,70 +625,90 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 }
             }
 
-            if (sv_equals(opcode, sv_from_cstr("iadd")))
+            if (mnemonic == OP_IADD)
                 SINGLE_INSTRUCTION(OP_IADD);
 
-            if (sv_equals(opcode, sv_from_cstr("fadd")))
+            if (mnemonic == OP_FADD)
                 SINGLE_INSTRUCTION(OP_FADD);
 
-            if (sv_equals(opcode, sv_from_cstr("isub")))
+            if (mnemonic == OP_ISUB)
                 SINGLE_INSTRUCTION(OP_ISUB);
 
-            if (sv_equals(opcode, sv_from_cstr("fsub")))
+            if (mnemonic == OP_FSUB)
                 SINGLE_INSTRUCTION(OP_FSUB);
 
-            if (sv_equals(opcode, sv_from_cstr("imul")))
+            if (mnemonic == OP_IMUL)
                 SINGLE_INSTRUCTION(OP_IMUL);
 
-            if (sv_equals(opcode, sv_from_cstr("fmul")))
+            if (mnemonic == OP_FMUL)
                 SINGLE_INSTRUCTION(OP_FMUL);
 
-            if (sv_equals(opcode, sv_from_cstr("idiv")))
+            if (mnemonic == OP_IDIV)
                 SINGLE_INSTRUCTION(OP_IDIV);
 
-            if (sv_equals(opcode, sv_from_cstr("fdiv")))
+            if (mnemonic == OP_FDIV)
                 SINGLE_INSTRUCTION(OP_FDIV);
 
-            if (sv_equals(opcode, sv_from_cstr("jmp")))
+            if (mnemonic == OP_AND)
+                SINGLE_INSTRUCTION(OP_AND);
+
+            if (mnemonic == OP_OR)
+                SINGLE_INSTRUCTION(OP_OR);
+
+            if (mnemonic == OP_XOR)
+                SINGLE_INSTRUCTION(OP_XOR);
+
+            if (mnemonic == OP_SHL)
+                SINGLE_INSTRUCTION(OP_SHL);
+
+            if (mnemonic == OP_SHR)
+                SINGLE_INSTRUCTION(OP_SHR);
+
+            if (mnemonic == OP_MOD)
+                SINGLE_INSTRUCTION(OP_MOD);
+
+            if (mnemonic == OP_I2F)
+                SINGLE_INSTRUCTION(OP_I2F);
+
+            if (mnemonic == OP_F2I)
+                SINGLE_INSTRUCTION(OP_F2I);
+
+            if (mnemonic == OP_JMP)
                 JMPS_INSTRUCTION(OP_JMP, "jmp");
 
-            if (sv_equals(opcode, sv_from_cstr("ijeq")))
+            if (mnemonic == OP_IJEQ)
                 JMPS_INSTRUCTION(OP_IJEQ, "ijmp");
 
-            if (sv_equals(opcode, sv_from_cstr("fjeq")))
+            if (mnemonic == OP_FJEQ)
                 JMPS_INSTRUCTION(OP_FJEQ, "fjeq");
 
-            if (sv_equals(opcode, sv_from_cstr("ijneq")))
+            if (mnemonic == OP_IJNEQ)
                 JMPS_INSTRUCTION(OP_IJNEQ, "ijneq");
 
-            if (sv_equals(opcode, sv_from_cstr("fjneq")))
+            if (mnemonic == OP_FJNEQ)
                 JMPS_INSTRUCTION(OP_FJNEQ, "fjneq");
 
-            if (sv_equals(opcode, sv_from_cstr("ijgt")))
+            if (mnemonic == OP_IJGT)
                 JMPS_INSTRUCTION(OP_IJGT, "ijgt");
 
-            if (sv_equals(opcode, sv_from_cstr("fjgt")))
+            if (mnemonic == OP_FJGT)
                 JMPS_INSTRUCTION(OP_FJGT, "fjgt");
 
-            if (sv_equals(opcode, sv_from_cstr("ijlt")))
+            if (mnemonic == OP_IJLT)
                 JMPS_INSTRUCTION(OP_IJLT, "ijlt");
 
-            if (sv_equals(opcode, sv_from_cstr("fjlt")))
+            if (mnemonic == OP_FJLT)
                 JMPS_INSTRUCTION(OP_FJLT, "fjlt");
 
-            if (sv_equals(opcode, sv_from_cstr("call"))) {
+            if (mnemonic == OP_CALL) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "call");
 
                 if (check_is_valid_identifier(operand)) {
-                    env->deferred_symbol[env->deferred_symbol_size++] = (MayaDeferredSymbol) {
-                        .rip = len,
-                        .symbol = operand,
-                    };
+                    APPEND(env->deferred_symbols, env->deferred_symbols_size, env->deferred_symbols_cap,
+                           ((MayaDeferredSymbol) {.rip = len, .symbol = operand}));
 
-                    instructions[len++] = (MayaInstruction) {
-                        .opcode = OP_CALL,
-                    };
+                    len += emit_deferred_instruction(&code[len], OP_CALL);
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -492,54 +720,160 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 exit(EXIT_FAILURE);
             }
 
-            if (sv_equals(opcode, sv_from_cstr("native"))) {
+            if (mnemonic == OP_NATIVE || mnemonic == OP_NATIVE_BATCH) {
+                const char* op_ins = mnemonic == OP_NATIVE ? "native" : "native_batch";
+
                 StringView operand = sv_chop_by_delim(&line, " ");
-                EXPECT_OPERAND(operand, "native");
+                EXPECT_OPERAND(operand, op_ins);
+
+                MayaInstruction instruction = {.opcode = mnemonic};
+                bool deferred = false;
 
                 char type = 0;
                 if (check_is_valid_number(operand, &type)) {
-                    Frame frame;
-
                     if (type == 0 || type == 'U') {
-                        frame.as_u64 = strtoull(operand.str, NULL, 10);
+                        instruction.operands[0].as_u64 = strtoull(operand.str, NULL, 10);
                     } else {
-                        fprintf(stderr, "ERROR: native only accept integer values\n");
+                        fprintf(stderr, "ERROR: %s only accept integer values\n", op_ins);
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
-                        .opcode = OP_NATIVE,
-                        .operands = {frame},
-                    };
+                    if (instruction.operands[0].as_u64 > UINT32_MAX) {
+                        fprintf(stderr, "ERROR: native index is out of range\n");
+                        exit(EXIT_FAILURE);
+                    }
+                } else if (check_is_valid_identifier(operand)) {
+                    deferred = true;
+                } else {
+                    fprintf(stderr, "ERROR: invalid operand: '%.*s'\n", (int)operand.len, operand.str);
+                    exit(EXIT_FAILURE);
+                }
 
-                    STRIP_COMMENT(&line);
-                    CHECK_EOL(&line);
+                // the batched form takes the number of frames it hands to the native.
+                if (mnemonic == OP_NATIVE_BATCH) {
+                    StringView count = sv_chop_by_delim(&line, " ");
+                    EXPECT_OPERAND(count, op_ins);
 
-                    goto reallocate;
-                } else if (check_is_valid_identifier(operand)) {
-                    env->deferred_symbol[env->deferred_symbol_size++] = (MayaDeferredSymbol) {
-                        .rip = len,
-                        .symbol = operand,
-                    };
+                    if (!check_is_valid_number(count, &type) || (type != 0 && type != 'U')) {
+                        fprintf(stderr, "ERROR: native_batch only accept integer counts\n");
+                        exit(EXIT_FAILURE);
+                    }
+
+                    instruction.operands[1].as_u64 = strtoull(count.str, NULL, 10);
+                    if (instruction.operands[1].as_u64 == 0 || instruction.operands[1].as_u64 > UINT8_MAX) {
+                        fprintf(stderr, "ERROR: native_batch count is out of range\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
 
-                    instructions[len++] = (MayaInstruction) {
-                        .opcode = OP_NATIVE,
-                    };
+                if (deferred)
+                    APPEND(env->deferred_symbols, env->deferred_symbols_size, env->deferred_symbols_cap,
+                           ((MayaDeferredSymbol) {.rip = len, .symbol = operand}));
 
-                    STRIP_COMMENT(&line);
-                    CHECK_EOL(&line);
+                len += maya_encode_instruction(instruction, &code[len]);
 
-                    goto reallocate;
+                STRIP_COMMENT(&line);
+                CHECK_EOL(&line);
+
+                goto reallocate;
+            }
+
+            if (mnemonic == OP_RET)
+                SINGLE_INSTRUCTION(OP_RET);
+
+            if (mnemonic == OP_RETV)
+                INDEX_INSTRUCTION(OP_RETV, "retv");
+
+            if (mnemonic == OP_LOAD_ARG)
+                INDEX_INSTRUCTION(OP_LOAD_ARG, "load_arg");
+
+            if (mnemonic == OP_STORE_ARG)
+                INDEX_INSTRUCTION(OP_STORE_ARG, "store_arg");
+
+            if (mnemonic == OP_LOAD_LOCAL)
+                INDEX_INSTRUCTION(OP_LOAD_LOCAL, "load_local");
+
+            if (mnemonic == OP_STORE_LOCAL)
+                INDEX_INSTRUCTION(OP_STORE_LOCAL, "store_local");
+
+            if (mnemonic == OP_INC)
+                INDEX_INSTRUCTION(OP_INC, "inc");
+
+            if (mnemonic == OP_DEC)
+                INDEX_INSTRUCTION(OP_DEC, "dec");
+
+            if (mnemonic == OP_IADDI || mnemonic == OP_ISUBI || mnemonic == OP_IMULI) {
+                const char* op_ins = mnemonic == OP_IADDI ? "iaddi" : mnemonic == OP_ISUBI ? "isubi" : "imuli";
+
+                StringView operand = sv_chop_by_delim(&line, " ");
+                EXPECT_OPERAND(operand, op_ins);
+
+                // a macro as the immediate is patched in by the linker like the one of push.
+                if (check_is_valid_identifier(operand)) {
+                    APPEND(env->deferred_symbols, env->deferred_symbols_size, env->deferred_symbols_cap,
+                           ((MayaDeferredSymbol) {.rip = len, .symbol = operand}));
+
+                    len += emit_deferred_instruction(&code[len], mnemonic);
+                } else {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
+                        .opcode = mnemonic,
+                        .operands = {parse_immediate(operand, op_ins)},
+                    });
+                }
+
+                STRIP_COMMENT(&line);
+                CHECK_EOL(&line);
+
+                goto reallocate;
+            }
+
+            if (mnemonic == OP_IJLTI) {
+                StringView operand = sv_chop_by_delim(&line, " ");
+                EXPECT_OPERAND(operand, "ijlti");
+
+                char type = 0;
+                if (!check_is_valid_number(operand, &type) || (type != 0 && type != 'U')) {
+                    fprintf(stderr, "ERROR: ijlti only accept integer registers\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                MayaInstruction instruction = {.opcode = OP_IJLTI};
+                instruction.operands[0].as_u64 = strtoull(operand.str, NULL, 10);
+                if (instruction.operands[0].as_u64 > UINT8_MAX) {
+                    fprintf(stderr, "ERROR: ijlti index is out of range\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                operand = sv_chop_by_delim(&line, " ");
+                EXPECT_OPERAND(operand, "ijlti");
+                instruction.operands[1] = parse_immediate(operand, "ijlti");
+
+                operand = sv_chop_by_delim(&line, " ");
+                EXPECT_OPERAND(operand, "ijlti");
+
+                if (check_is_valid_identifier(operand)) {
+                    APPEND(env->deferred_symbols, env->deferred_symbols_size, env->deferred_symbols_cap,
+                           ((MayaDeferredSymbol) {.rip = len, .symbol = operand}));
+                } else if (check_is_valid_number(operand, &type) && (type == 0 || type == 'U')) {
+                    instruction.operands[2].as_u64 = strtoull(operand.str, NULL, 10);
+                    if (instruction.operands[2].as_u64 > UINT32_MAX) {
+                        fprintf(stderr, "ERROR: ijlti target is out of range\n");
+                        exit(EXIT_FAILURE);
+                    }
                 } else {
                     fprintf(stderr, "ERROR: invalid operand: '%.*s'\n", (int)operand.len, operand.str);
                     exit(EXIT_FAILURE);
                 }
-            }
 
-            if (sv_equals(opcode, sv_from_cstr("ret")))
-                SINGLE_INSTRUCTION(OP_RET);
+                len += maya_encode_instruction(instruction, &code[len]);
+
+                STRIP_COMMENT(&line);
+                CHECK_EOL(&line);
 
-            if (sv_equals(opcode, sv_from_cstr("load"))) {
+                goto reallocate;
+            }
+
+            if (mnemonic == OP_LOAD) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "load");
 
@@ -554,10 +888,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_LOAD,
                         .operands = {frame},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -569,7 +903,7 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 }
             }
 
-            if (sv_equals(opcode, sv_from_cstr("store"))) {
+            if (mnemonic == OP_STORE) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "store");
 
@@ -584,10 +918,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_STORE,
                         .operands = {frame},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -599,7 +933,7 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 }
             }
 
-            if (sv_equals(opcode, sv_from_cstr("load_ptr"))) {
+            if (mnemonic == OP_LOAD_PTR) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "load_ptr");
 
@@ -614,10 +948,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_LOAD_PTR,
                         .operands = {frame},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -629,7 +963,7 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 }
             }
 
-            if (sv_equals(opcode, sv_from_cstr("push_ptr"))) {
+            if (mnemonic == OP_PUSH_PTR) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "push_ptr");
 
@@ -659,10 +993,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_PUSH_PTR,
                         .operands = {first, second},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -674,7 +1008,7 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                 }
             }
 
-            if (sv_equals(opcode, sv_from_cstr("store_ptr"))) {
+            if (mnemonic == OP_STORE_PTR) {
                 StringView operand = sv_chop_by_delim(&line, " ");
                 EXPECT_OPERAND(operand, "store_ptr");
 
@@ -704,10 +1038,10 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
                         exit(EXIT_FAILURE);
                     }
 
-                    instructions[len++] = (MayaInstruction) {
+                    len += emit_instruction(&code[len], (MayaInstruction) {
                         .opcode = OP_STORE_PTR,
                         .operands = {first, second},
-                    };
+                    });
 
                     STRIP_COMMENT(&line);
                     CHECK_EOL(&line);
@@ -724,49 +1058,14 @@ void maya_translate_asm(MayaEnv* env, const char* buffer, const char* output_pat
         }
 
     reallocate:
-        cap++;
-        instructions = xrealloc(instructions, sizeof(MayaInstruction) * cap);
-    }
-
-    MayaHeader header = {0};
-
-    uint8_t* magic = (uint8_t*)&header.magic;
-    memcpy(magic, "MAYA", 4);
-    header.program_size = len;
-
-    if (entry.str != NULL && entry.len != 0) {
-        bool found = false;
-        for (size_t i = 0; i < env->labels_size; i++) {
-            if (sv_equals(entry, env->labels[i].id)) {
-                header.starting_rip = env->labels[i].rip;
-                found = true;
-                break;
-            }
-        }
-
-        if (!found) {
-            fprintf(stderr, "ERROR: no such label for the entry point: '%.*s'\n", (int)entry.len, entry.str);
-            exit(EXIT_FAILURE);
+        // keep room for the next instruction, growing geometrically.
+        if (cap - len < MAYA_INSTRUCTION_MAX_SIZE) {
+            cap *= 2;
+            code = xrealloc(code, sizeof(uint8_t) * cap);
         }
     }
 
-    FILE* ostream = fopen(output_path, "wb");
-    if (!ostream) {
-        fprintf(stderr, "ERROR: cannot open file '%s'\n", output_path);
-        exit(EXIT_FAILURE);
-    }
-
-    fwrite(&header, sizeof(MayaHeader), 1, ostream);
-    fwrite(instructions, sizeof(MayaInstruction), len, ostream);
-    
-    for (size_t i = 0; i < env->str_literals_size; i++) {
-        StringView literal = env->str_literals[i].literal;
-        fwrite(literal.str, sizeof(uint8_t), literal.len, ostream);
-        uint8_t null = 0;
-        fwrite(&null, sizeof(uint8_t), 1, ostream);
-        fwrite(&env->str_literals[i].rip, sizeof(size_t), 1, ostream);
-    }
-
-    fclose(ostream);
-    free(instructions);
+    env->code = code;
+    env->code_size = len;
+    env->entry = entry;
 }
@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "maya.h"
+
+// the stack is a reservation of stack_limit frames followed by a guard page, then room for as
+// many call frames followed by another guard page. the kernel commits the pages on first touch,
+// so memory grows with the deepest point the program reaches, and a push or a call past the limit
+// faults on a guard page, which the handler turns into the matching overflow error.
+typedef struct MayaStackGuard_t {
+    sigjmp_buf* env;
+    const uint8_t* guard;
+    const uint8_t* call_guard;
+} MayaStackGuard;
+
+// the guard is per thread, so vms can run on several threads at once. the handler is installed
+// once for the whole process and stays installed, every other fault is passed on to the handler
+// it replaced as if that one had been called by the kernel.
+static _Thread_local MayaStackGuard active;
+static size_t page_size;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous_action;
+
+static void forward_fault(int sig, siginfo_t* info, void* context) {
+    struct sigaction previous = previous_action;
+
+    if (!(previous.sa_flags & SA_SIGINFO) && (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN)) {
+        // the faulting instruction runs again under the default action and the process dies
+        // where it would have without the vm, a fault cannot be ignored anyway.
+        signal(sig, SIG_DFL);
+        return;
+    }
+
+    // a one shot handler is only forwarded to once, the vm's handler stays in place.
+    if (previous.sa_flags & SA_RESETHAND) {
+        previous_action.sa_handler = SIG_DFL;
+        previous_action.sa_flags &= ~SA_SIGINFO;
+    }
+
+    // the kernel would have blocked the mask of the handler while it runs, returning from on_fault
+    // restores the mask of the interrupted code.
+    pthread_sigmask(SIG_BLOCK, &previous.sa_mask, NULL);
+
+    if (previous.sa_flags & SA_SIGINFO) {
+        previous.sa_sigaction(sig, info, context);
+    } else {
+        previous.sa_handler(sig);
+    }
+}
+
+static void on_fault(int sig, siginfo_t* info, void* context) {
+    const uint8_t* address = info->si_addr;
+    if (active.env != NULL && address >= active.guard && address < active.guard + page_size)
+        siglongjmp(*active.env, ERR_STACK_OVERFLOW);
+
+    if (active.env != NULL && address >= active.call_guard && address < active.call_guard + page_size)
+        siglongjmp(*active.env, ERR_CALL_STACK_OVERFLOW);
+
+    forward_fault(sig, info, context);
+}
+
+static void setup(void) {
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    struct sigaction action = {0};
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_action);
+}
+
+bool maya_stack_create(MayaVm* maya, size_t limit, MayaSetupError* error) {
+    pthread_once(&setup_once, setup);
+
+    if (limit == 0 || limit > MAYA_STACK_MAX_LIMIT) {
+        maya_setup_fail(error, "stack limit must be between 1 and %d frames", MAYA_STACK_MAX_LIMIT);
+        return false;
+    }
+
+    // the guard page has to start right after the last frame.
+    size_t frames_per_page = page_size / sizeof(Frame);
+    limit = (limit + frames_per_page - 1) / frames_per_page * frames_per_page;
+
+    size_t size = limit * sizeof(Frame);
+    size_t frames_size = limit * sizeof(MayaCallFrame);
+    uint8_t* region = mmap(NULL, size + frames_size + page_size * 2, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        maya_setup_fail(error, "cannot reserve a stack of %zu frames", limit);
+        return false;
+    }
+
+    if (mprotect(region + size, page_size, PROT_NONE) != 0 ||
+        mprotect(region + size + page_size + frames_size, page_size, PROT_NONE) != 0) {
+        maya_setup_fail(error, "cannot protect the stack guard pages");
+        munmap(region, size + frames_size + page_size * 2);
+        return false;
+    }
+
+    maya->stack = (Frame*)region;
+    maya->frames = (MayaCallFrame*)(region + size + page_size);
+    maya->stack_limit = limit;
+    return true;
+}
+
+void maya_stack_destroy(MayaVm* maya) {
+    if (maya->stack != NULL)
+        munmap(maya->stack, maya->stack_limit * (sizeof(Frame) + sizeof(MayaCallFrame)) + page_size * 2);
+
+    maya->stack = NULL;
+    maya->frames = NULL;
+    maya->stack_limit = 0;
+}
+
+MayaError maya_stack_guarded(MayaVm* maya, MayaError (*execute)(MayaVm*)) {
+    pthread_once(&setup_once, setup);
+
+    sigjmp_buf env;
+    MayaStackGuard previous = active;
+
+    int overflow = sigsetjmp(env, 1);
+    if (overflow != 0) {
+        active = previous;
+        return (MayaError)overflow;
+    }
+
+    active = (MayaStackGuard) {
+        .env = &env,
+        .guard = (const uint8_t*)(maya->stack + maya->stack_limit),
+        .call_guard = (const uint8_t*)(maya->frames + maya->stack_limit),
+    };
+
+    MayaError error = execute(maya);
+
+    active = previous;
+    return error;
+}
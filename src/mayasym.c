@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "maya.h"
+#include "sv.h"
+
+#define MAYA_SYMBOLS_INITIAL_CAP 64
+
+static MayaSymbol* find_slot(MayaSymbol* slots, size_t cap, StringView name) {
+    size_t i = sv_hash(name) & (cap - 1);
+    while (slots[i].name.str != NULL && !sv_equals(slots[i].name, name))
+        i = (i + 1) & (cap - 1);
+
+    return &slots[i];
+}
+
+static void grow(MayaSymbolTable* table) {
+    size_t cap = table->cap == 0 ? MAYA_SYMBOLS_INITIAL_CAP : table->cap * 2;
+    MayaSymbol* slots = calloc(cap, sizeof(MayaSymbol));
+    if (!slots) {
+        fprintf(stderr, "ERROR: cannot allocate memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < table->cap; i++) {
+        if (table->slots[i].name.str != NULL)
+            *find_slot(slots, cap, table->slots[i].name) = table->slots[i];
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->cap = cap;
+}
+
+MayaSymbol* maya_symbols_find(const MayaSymbolTable* table, StringView name) {
+    if (table->size == 0)
+        return NULL;
+
+    MayaSymbol* slot = find_slot(table->slots, table->cap, name);
+    return slot->name.str != NULL ? slot : NULL;
+}
+
+// returns the symbol already defined with that name, or NULL once the new one is inserted.
+MayaSymbol* maya_symbols_insert(MayaSymbolTable* table, MayaSymbol symbol) {
+    // keep the load factor under 3/4 so probe sequences stay short.
+    if ((table->size + 1) * 4 > table->cap * 3)
+        grow(table);
+
+    MayaSymbol* slot = find_slot(table->slots, table->cap, symbol.name);
+    if (slot->name.str != NULL)
+        return slot;
+
+    *slot = symbol;
+    table->size++;
+    return NULL;
+}
+
+void maya_symbols_free(MayaSymbolTable* table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->size = 0;
+    table->cap = 0;
+}
@@ -0,0 +1,670 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include "maya.h"
+
+// each kernel has a scalar version and, on x86-64, sse2 and avx2 ones. sse2 is part of x86-64,
+// avx2 is looked up once at first use. neither has a 64 bit integer multiply, so the integer
+// mul, fma, scale and dot only exist in scalar form, and min and max of integers need avx2.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define MAYA_VECTOR_X86
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+#define LANES 4 // float reductions accumulate in this many lanes whatever the cpu
+
+const MayaVectorEntry maya_vector_entries[VEC_COUNT] = {
+    [VEC_ADD_I64] = {"vadd_i64", {.arity = 4, .delta = -4}},
+    [VEC_ADD_F64] = {"vadd_f64", {.arity = 4, .delta = -4}},
+    [VEC_MUL_I64] = {"vmul_i64", {.arity = 4, .delta = -4}},
+    [VEC_MUL_F64] = {"vmul_f64", {.arity = 4, .delta = -4}},
+    [VEC_FMA_I64] = {"vfma_i64", {.arity = 4, .delta = -4}},
+    [VEC_FMA_F64] = {"vfma_f64", {.arity = 4, .delta = -4}},
+    [VEC_SCALE_I64] = {"vscale_i64", {.arity = 4, .delta = -4}},
+    [VEC_SCALE_F64] = {"vscale_f64", {.arity = 4, .delta = -4}},
+    [VEC_DOT_I64] = {"vdot_i64", {.arity = 3, .delta = -2}},
+    [VEC_DOT_F64] = {"vdot_f64", {.arity = 3, .delta = -2}},
+    [VEC_SUM_I64] = {"vsum_i64", {.arity = 2, .delta = -1}},
+    [VEC_SUM_F64] = {"vsum_f64", {.arity = 2, .delta = -1}},
+    [VEC_MIN_I64] = {"vmin_i64", {.arity = 2, .delta = -1}},
+    [VEC_MIN_F64] = {"vmin_f64", {.arity = 2, .delta = -1}},
+    [VEC_MAX_I64] = {"vmax_i64", {.arity = 2, .delta = -1}},
+    [VEC_MAX_F64] = {"vmax_f64", {.arity = 2, .delta = -1}},
+};
+
+// the kernels that have more than a scalar version.
+typedef struct MayaVectorImpl_t {
+    void (*add_i64)(uint64_t* dst, const uint64_t* a, const uint64_t* b, uint64_t n);
+    void (*add_f64)(double* dst, const double* a, const double* b, uint64_t n);
+    void (*mul_f64)(double* dst, const double* a, const double* b, uint64_t n);
+    void (*fma_f64)(double* dst, const double* a, const double* b, uint64_t n);
+    void (*scale_f64)(double* dst, const double* src, double k, uint64_t n);
+    double (*dot_f64)(const double* a, const double* b, uint64_t n);
+    uint64_t (*sum_i64)(const uint64_t* x, uint64_t n);
+    double (*sum_f64)(const double* x, uint64_t n);
+    int64_t (*min_i64)(const int64_t* x, uint64_t n);
+    int64_t (*max_i64)(const int64_t* x, uint64_t n);
+    double (*min_f64)(const double* x, uint64_t n);
+    double (*max_f64)(const double* x, uint64_t n);
+} MayaVectorImpl;
+
+// min and max pick like minpd and maxpd, the second operand when they are unordered.
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// the lanes are combined pairwise, then the elements after the last whole group are added.
+static double reduce_sum(const double lanes[LANES]) {
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static double reduce_min(const double lanes[LANES]) {
+    return MIN(MIN(lanes[1], lanes[0]), MIN(lanes[3], lanes[2]));
+}
+
+static double reduce_max(const double lanes[LANES]) {
+    return MAX(MAX(lanes[1], lanes[0]), MAX(lanes[3], lanes[2]));
+}
+
+static void add_i64_scalar(uint64_t* dst, const uint64_t* a, const uint64_t* b, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = a[i] + b[i];
+}
+
+static void add_f64_scalar(double* dst, const double* a, const double* b, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = a[i] + b[i];
+}
+
+static void mul_f64_scalar(double* dst, const double* a, const double* b, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = a[i] * b[i];
+}
+
+static void fma_f64_scalar(double* dst, const double* a, const double* b, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] += a[i] * b[i];
+}
+
+static void scale_f64_scalar(double* dst, const double* src, double k, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = src[i] * k;
+}
+
+static double dot_f64_scalar(const double* a, const double* b, uint64_t n) {
+    double lanes[LANES] = {0};
+
+    uint64_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t j = 0; j < LANES; j++)
+            lanes[j] += a[i + j] * b[i + j];
+    }
+
+    double dot = reduce_sum(lanes);
+    for (; i < n; i++)
+        dot += a[i] * b[i];
+
+    return dot;
+}
+
+static uint64_t sum_i64_scalar(const uint64_t* x, uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++)
+        sum += x[i];
+
+    return sum;
+}
+
+static double sum_f64_scalar(const double* x, uint64_t n) {
+    double lanes[LANES] = {0};
+
+    uint64_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t j = 0; j < LANES; j++)
+            lanes[j] += x[i + j];
+    }
+
+    double sum = reduce_sum(lanes);
+    for (; i < n; i++)
+        sum += x[i];
+
+    return sum;
+}
+
+static int64_t min_i64_scalar(const int64_t* x, uint64_t n) {
+    int64_t min = n > 0 ? x[0] : 0;
+    for (uint64_t i = 1; i < n; i++)
+        min = MIN(x[i], min);
+
+    return min;
+}
+
+static int64_t max_i64_scalar(const int64_t* x, uint64_t n) {
+    int64_t max = n > 0 ? x[0] : 0;
+    for (uint64_t i = 1; i < n; i++)
+        max = MAX(x[i], max);
+
+    return max;
+}
+
+static double min_f64_scalar(const double* x, uint64_t n) {
+    if (n < LANES) {
+        double min = n > 0 ? x[0] : 0.0;
+        for (uint64_t i = 1; i < n; i++)
+            min = MIN(x[i], min);
+
+        return min;
+    }
+
+    double lanes[LANES] = {x[0], x[1], x[2], x[3]};
+
+    uint64_t i = LANES;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t j = 0; j < LANES; j++)
+            lanes[j] = MIN(x[i + j], lanes[j]);
+    }
+
+    double min = reduce_min(lanes);
+    for (; i < n; i++)
+        min = MIN(x[i], min);
+
+    return min;
+}
+
+static double max_f64_scalar(const double* x, uint64_t n) {
+    if (n < LANES) {
+        double max = n > 0 ? x[0] : 0.0;
+        for (uint64_t i = 1; i < n; i++)
+            max = MAX(x[i], max);
+
+        return max;
+    }
+
+    double lanes[LANES] = {x[0], x[1], x[2], x[3]};
+
+    uint64_t i = LANES;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t j = 0; j < LANES; j++)
+            lanes[j] = MAX(x[i + j], lanes[j]);
+    }
+
+    double max = reduce_max(lanes);
+    for (; i < n; i++)
+        max = MAX(x[i], max);
+
+    return max;
+}
+
+static const MayaVectorImpl scalar_impl = {
+    .add_i64 = add_i64_scalar,
+    .add_f64 = add_f64_scalar,
+    .mul_f64 = mul_f64_scalar,
+    .fma_f64 = fma_f64_scalar,
+    .scale_f64 = scale_f64_scalar,
+    .dot_f64 = dot_f64_scalar,
+    .sum_i64 = sum_i64_scalar,
+    .sum_f64 = sum_f64_scalar,
+    .min_i64 = min_i64_scalar,
+    .max_i64 = max_i64_scalar,
+    .min_f64 = min_f64_scalar,
+    .max_f64 = max_f64_scalar,
+};
+
+#ifdef MAYA_VECTOR_X86
+// sse2 holds two lanes per register, the four float lanes are two registers.
+
+static void add_i64_sse2(uint64_t* dst, const uint64_t* a, const uint64_t* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i*)&a[i]), _mm_loadu_si128((const __m128i*)&b[i]));
+        _mm_storeu_si128((__m128i*)&dst[i], sum);
+    }
+
+    add_i64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+static void add_f64_sse2(double* dst, const double* a, const double* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(&dst[i], _mm_add_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+
+    add_f64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+static void mul_f64_sse2(double* dst, const double* a, const double* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(&dst[i], _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+
+    mul_f64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+static void fma_f64_sse2(double* dst, const double* a, const double* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d product = _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i]));
+        _mm_storeu_pd(&dst[i], _mm_add_pd(_mm_loadu_pd(&dst[i]), product));
+    }
+
+    fma_f64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+static void scale_f64_sse2(double* dst, const double* src, double k, uint64_t n) {
+    __m128d factor = _mm_set1_pd(k);
+
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(&dst[i], _mm_mul_pd(_mm_loadu_pd(&src[i]), factor));
+
+    scale_f64_scalar(&dst[i], &src[i], k, n - i);
+}
+
+static double dot_f64_sse2(const double* a, const double* b, uint64_t n) {
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+
+    uint64_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        low = _mm_add_pd(low, _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+        high = _mm_add_pd(high, _mm_mul_pd(_mm_loadu_pd(&a[i + 2]), _mm_loadu_pd(&b[i + 2])));
+    }
+
+    double lanes[LANES];
+    _mm_storeu_pd(&lanes[0], low);
+    _mm_storeu_pd(&lanes[2], high);
+
+    double dot = reduce_sum(lanes);
+    for (; i < n; i++)
+        dot += a[i] * b[i];
+
+    return dot;
+}
+
+static uint64_t sum_i64_sse2(const uint64_t* x, uint64_t n) {
+    __m128i sum = _mm_setzero_si128();
+
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        sum = _mm_add_epi64(sum, _mm_loadu_si128((const __m128i*)&x[i]));
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, sum);
+    return lanes[0] + lanes[1] + sum_i64_scalar(&x[i], n - i);
+}
+
+static double sum_f64_sse2(const double* x, uint64_t n) {
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+
+    uint64_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        low = _mm_add_pd(low, _mm_loadu_pd(&x[i]));
+        high = _mm_add_pd(high, _mm_loadu_pd(&x[i + 2]));
+    }
+
+    double lanes[LANES];
+    _mm_storeu_pd(&lanes[0], low);
+    _mm_storeu_pd(&lanes[2], high);
+
+    double sum = reduce_sum(lanes);
+    for (; i < n; i++)
+        sum += x[i];
+
+    return sum;
+}
+
+static double min_f64_sse2(const double* x, uint64_t n) {
+    if (n < LANES)
+        return min_f64_scalar(x, n);
+
+    __m128d low = _mm_loadu_pd(&x[0]);
+    __m128d high = _mm_loadu_pd(&x[2]);
+
+    uint64_t i = LANES;
+    for (; i + LANES <= n; i += LANES) {
+        low = _mm_min_pd(_mm_loadu_pd(&x[i]), low);
+        high = _mm_min_pd(_mm_loadu_pd(&x[i + 2]), high);
+    }
+
+    double lanes[LANES];
+    _mm_storeu_pd(&lanes[0], low);
+    _mm_storeu_pd(&lanes[2], high);
+
+    double min = reduce_min(lanes);
+    for (; i < n; i++)
+        min = MIN(x[i], min);
+
+    return min;
+}
+
+static double max_f64_sse2(const double* x, uint64_t n) {
+    if (n < LANES)
+        return max_f64_scalar(x, n);
+
+    __m128d low = _mm_loadu_pd(&x[0]);
+    __m128d high = _mm_loadu_pd(&x[2]);
+
+    uint64_t i = LANES;
+    for (; i + LANES <= n; i += LANES) {
+        low = _mm_max_pd(_mm_loadu_pd(&x[i]), low);
+        high = _mm_max_pd(_mm_loadu_pd(&x[i + 2]), high);
+    }
+
+    double lanes[LANES];
+    _mm_storeu_pd(&lanes[0], low);
+    _mm_storeu_pd(&lanes[2], high);
+
+    double max = reduce_max(lanes);
+    for (; i < n; i++)
+        max = MAX(x[i], max);
+
+    return max;
+}
+
+static const MayaVectorImpl sse2_impl = {
+    .add_i64 = add_i64_sse2,
+    .add_f64 = add_f64_sse2,
+    .mul_f64 = mul_f64_sse2,
+    .fma_f64 = fma_f64_sse2,
+    .scale_f64 = scale_f64_sse2,
+    .dot_f64 = dot_f64_sse2,
+    .sum_i64 = sum_i64_sse2,
+    .sum_f64 = sum_f64_sse2,
+    .min_i64 = min_i64_scalar,
+    .max_i64 = max_i64_scalar,
+    .min_f64 = min_f64_sse2,
+    .max_f64 = max_f64_sse2,
+};
+
+// avx2 holds the four lanes in one register.
+
+AVX2 static void add_i64_avx2(uint64_t* dst, const uint64_t* a, const uint64_t* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)&a[i]), _mm256_loadu_si256((const __m256i*)&b[i]));
+        _mm256_storeu_si256((__m256i*)&dst[i], sum);
+    }
+
+    add_i64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+AVX2 static void add_f64_avx2(double* dst, const double* a, const double* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(&dst[i], _mm256_add_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+
+    add_f64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+AVX2 static void mul_f64_avx2(double* dst, const double* a, const double* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(&dst[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+
+    mul_f64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+// a multiply and an add rather than vfmadd, which rounds once and would not match the others.
+AVX2 static void fma_f64_avx2(double* dst, const double* a, const double* b, uint64_t n) {
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d product = _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i]));
+        _mm256_storeu_pd(&dst[i], _mm256_add_pd(_mm256_loadu_pd(&dst[i]), product));
+    }
+
+    fma_f64_scalar(&dst[i], &a[i], &b[i], n - i);
+}
+
+AVX2 static void scale_f64_avx2(double* dst, const double* src, double k, uint64_t n) {
+    __m256d factor = _mm256_set1_pd(k);
+
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(&dst[i], _mm256_mul_pd(_mm256_loadu_pd(&src[i]), factor));
+
+    scale_f64_scalar(&dst[i], &src[i], k, n - i);
+}
+
+AVX2 static double dot_f64_avx2(const double* a, const double* b, uint64_t n) {
+    __m256d dot = _mm256_setzero_pd();
+
+    uint64_t i = 0;
+    for (; i + LANES <= n; i += LANES)
+        dot = _mm256_add_pd(dot, _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, dot);
+
+    double result = reduce_sum(lanes);
+    for (; i < n; i++)
+        result += a[i] * b[i];
+
+    return result;
+}
+
+AVX2 static uint64_t sum_i64_avx2(const uint64_t* x, uint64_t n) {
+    __m256i sum = _mm256_setzero_si256();
+
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        sum = _mm256_add_epi64(sum, _mm256_loadu_si256((const __m256i*)&x[i]));
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_i64_scalar(&x[i], n - i);
+}
+
+AVX2 static double sum_f64_avx2(const double* x, uint64_t n) {
+    __m256d sum = _mm256_setzero_pd();
+
+    uint64_t i = 0;
+    for (; i + LANES <= n; i += LANES)
+        sum = _mm256_add_pd(sum, _mm256_loadu_pd(&x[i]));
+
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, sum);
+
+    double result = reduce_sum(lanes);
+    for (; i < n; i++)
+        result += x[i];
+
+    return result;
+}
+
+// integer min and max have no instruction of their own, a compare picks the lanes to replace.
+AVX2 static int64_t min_i64_avx2(const int64_t* x, uint64_t n) {
+    if (n < 4)
+        return min_i64_scalar(x, n);
+
+    __m256i min = _mm256_loadu_si256((const __m256i*)&x[0]);
+
+    uint64_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i value = _mm256_loadu_si256((const __m256i*)&x[i]);
+        min = _mm256_blendv_epi8(min, value, _mm256_cmpgt_epi64(min, value));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, min);
+
+    int64_t result = MIN(MIN(lanes[1], lanes[0]), MIN(lanes[3], lanes[2]));
+    for (; i < n; i++)
+        result = MIN(x[i], result);
+
+    return result;
+}
+
+AVX2 static int64_t max_i64_avx2(const int64_t* x, uint64_t n) {
+    if (n < 4)
+        return max_i64_scalar(x, n);
+
+    __m256i max = _mm256_loadu_si256((const __m256i*)&x[0]);
+
+    uint64_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i value = _mm256_loadu_si256((const __m256i*)&x[i]);
+        max = _mm256_blendv_epi8(max, value, _mm256_cmpgt_epi64(value, max));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, max);
+
+    int64_t result = MAX(MAX(lanes[1], lanes[0]), MAX(lanes[3], lanes[2]));
+    for (; i < n; i++)
+        result = MAX(x[i], result);
+
+    return result;
+}
+
+AVX2 static double min_f64_avx2(const double* x, uint64_t n) {
+    if (n < LANES)
+        return min_f64_scalar(x, n);
+
+    __m256d min = _mm256_loadu_pd(&x[0]);
+
+    uint64_t i = LANES;
+    for (; i + LANES <= n; i += LANES)
+        min = _mm256_min_pd(_mm256_loadu_pd(&x[i]), min);
+
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, min);
+
+    double result = reduce_min(lanes);
+    for (; i < n; i++)
+        result = MIN(x[i], result);
+
+    return result;
+}
+
+AVX2 static double max_f64_avx2(const double* x, uint64_t n) {
+    if (n < LANES)
+        return max_f64_scalar(x, n);
+
+    __m256d max = _mm256_loadu_pd(&x[0]);
+
+    uint64_t i = LANES;
+    for (; i + LANES <= n; i += LANES)
+        max = _mm256_max_pd(_mm256_loadu_pd(&x[i]), max);
+
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, max);
+
+    double result = reduce_max(lanes);
+    for (; i < n; i++)
+        result = MAX(x[i], result);
+
+    return result;
+}
+
+static const MayaVectorImpl avx2_impl = {
+    .add_i64 = add_i64_avx2,
+    .add_f64 = add_f64_avx2,
+    .mul_f64 = mul_f64_avx2,
+    .fma_f64 = fma_f64_avx2,
+    .scale_f64 = scale_f64_avx2,
+    .dot_f64 = dot_f64_avx2,
+    .sum_i64 = sum_i64_avx2,
+    .sum_f64 = sum_f64_avx2,
+    .min_i64 = min_i64_avx2,
+    .max_i64 = max_i64_avx2,
+    .min_f64 = min_f64_avx2,
+    .max_f64 = max_f64_avx2,
+};
+#endif
+
+static const MayaVectorImpl* impl = &scalar_impl;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void select_impl(void) {
+#ifdef MAYA_VECTOR_X86
+    __builtin_cpu_init();
+    impl = __builtin_cpu_supports("avx2") ? &avx2_impl : &sse2_impl;
+#endif
+}
+
+void maya_vector_run(MayaVm* maya, uint8_t kernel, Frame* args) {
+    pthread_once(&select_once, select_impl);
+
+    uint64_t n = args[maya_vector_entries[kernel].effect.arity - 1].as_u64;
+    void* dst = args[0].as_ptr;
+
+    switch (kernel) {
+    case VEC_ADD_I64:
+        impl->add_i64(dst, args[1].as_ptr, args[2].as_ptr, n);
+        break;
+    case VEC_ADD_F64:
+        impl->add_f64(dst, args[1].as_ptr, args[2].as_ptr, n);
+        break;
+    case VEC_MUL_I64: {
+        uint64_t* out = dst;
+        const uint64_t* a = args[1].as_ptr;
+        const uint64_t* b = args[2].as_ptr;
+        for (uint64_t i = 0; i < n; i++)
+            out[i] = a[i] * b[i];
+        break;
+    }
+    case VEC_MUL_F64:
+        impl->mul_f64(dst, args[1].as_ptr, args[2].as_ptr, n);
+        break;
+    case VEC_FMA_I64: {
+        uint64_t* out = dst;
+        const uint64_t* a = args[1].as_ptr;
+        const uint64_t* b = args[2].as_ptr;
+        for (uint64_t i = 0; i < n; i++)
+            out[i] += a[i] * b[i];
+        break;
+    }
+    case VEC_FMA_F64:
+        impl->fma_f64(dst, args[1].as_ptr, args[2].as_ptr, n);
+        break;
+    case VEC_SCALE_I64: {
+        uint64_t* out = dst;
+        const uint64_t* src = args[1].as_ptr;
+        for (uint64_t i = 0; i < n; i++)
+            out[i] = src[i] * args[2].as_u64;
+        break;
+    }
+    case VEC_SCALE_F64:
+        impl->scale_f64(dst, args[1].as_ptr, args[2].as_f64, n);
+        break;
+    case VEC_DOT_I64: {
+        const uint64_t* a = args[0].as_ptr;
+        const uint64_t* b = args[1].as_ptr;
+
+        uint64_t dot = 0;
+        for (uint64_t i = 0; i < n; i++)
+            dot += a[i] * b[i];
+
+        args[0].as_u64 = dot;
+        return;
+    }
+    case VEC_DOT_F64:
+        args[0].as_f64 = impl->dot_f64(args[0].as_ptr, args[1].as_ptr, n);
+        return;
+    case VEC_SUM_I64:
+        args[0].as_u64 = impl->sum_i64(args[0].as_ptr, n);
+        return;
+    case VEC_SUM_F64:
+        args[0].as_f64 = impl->sum_f64(args[0].as_ptr, n);
+        return;
+    case VEC_MIN_I64:
+        args[0].as_i64 = impl->min_i64(args[0].as_ptr, n);
+        return;
+    case VEC_MIN_F64:
+        args[0].as_f64 = impl->min_f64(args[0].as_ptr, n);
+        return;
+    case VEC_MAX_I64:
+        args[0].as_i64 = impl->max_i64(args[0].as_ptr, n);
+        return;
+    case VEC_MAX_F64:
+        args[0].as_f64 = impl->max_f64(args[0].as_ptr, n);
+        return;
+    default:
+        return;
+    }
+
+    // the elementwise kernels may write pointers into heap objects, like memcpy.
+    if (maya->heap != NULL)
+        maya_heap_barrier_range(maya->heap, dst, n * sizeof(Frame));
+}
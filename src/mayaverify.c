@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "maya.h"
+
+// calls a function may return to, more than that and the program is left to the checked
+// interpreter.
+#define MAYA_VERIFY_SITES_CAP 8
+
+// abstract state at a rip: the stack depth relative to the base of the running frame, a lower
+// bound of that base (how many frames below it arguments can reach), and the call sites the
+// running function returns to. a call site also records the number of values its callee leaves.
+typedef struct MayaVerifyState_t {
+    bool reached;
+    bool queued;
+    bool returns;
+    int64_t depth;
+    size_t base;
+    int64_t returned;
+    size_t sites[MAYA_VERIFY_SITES_CAP];
+    size_t sites_size;
+} MayaVerifyState;
+
+typedef struct MayaVerifier_t {
+    const MayaVm* maya;
+    const uint8_t* program;
+    const bool* boundaries;
+    MayaVerifyState* states;
+    size_t* worklist;
+    size_t worklist_size;
+    MayaVerifyError error;
+} MayaVerifier;
+
+static bool fail(MayaVerifier* v, size_t rip, const char* message) {
+    v->error.rip = rip;
+    v->error.message = message;
+    return false;
+}
+
+static void enqueue(MayaVerifier* v, size_t rip) {
+    if (v->states[rip].queued)
+        return;
+
+    v->states[rip].queued = true;
+    v->worklist[v->worklist_size++] = rip;
+}
+
+static bool add_site(MayaVerifyState* state, size_t site) {
+    for (size_t i = 0; i < state->sites_size; i++) {
+        if (state->sites[i] == site)
+            return true;
+    }
+
+    if (state->sites_size == MAYA_VERIFY_SITES_CAP)
+        return false;
+
+    state->sites[state->sites_size++] = site;
+    return true;
+}
+
+// merges the incoming state into the state of target.
+static bool flow(MayaVerifier* v, size_t from, size_t target, const MayaVerifyState* incoming) {
+    if (target >= v->maya->program_size || !v->boundaries[target])
+        return fail(v, from, "jump target is not an instruction");
+
+    MayaVerifyState* state = &v->states[target];
+    if (!state->reached) {
+        bool returns = state->returns;
+        int64_t returned = state->returned;
+
+        *state = *incoming;
+        state->reached = true;
+        state->queued = false;
+        state->returns = returns;
+        state->returned = returned;
+        enqueue(v, target);
+        return true;
+    }
+
+    if (state->depth != incoming->depth)
+        return fail(v, target, "stack depth differs between paths");
+
+    bool changed = incoming->base < state->base;
+    if (changed)
+        state->base = incoming->base;
+
+    for (size_t i = 0; i < incoming->sites_size; i++) {
+        size_t sites_size = state->sites_size;
+        if (!add_site(state, incoming->sites[i]))
+            return fail(v, target, "reached from too many call sites");
+
+        changed |= sites_size != state->sites_size;
+    }
+
+    if (changed)
+        enqueue(v, target);
+
+    return true;
+}
+
+// the caller continues after the call site with the callee's results on top of its stack.
+static bool flow_return(MayaVerifier* v, size_t site) {
+    MayaVerifyState returned = v->states[site];
+    returned.depth += returned.returned;
+
+    return flow(v, site, site + maya_instruction_size(v->program[site]), &returned);
+}
+
+// records what the callee leaves on the stack of the caller, each function has to agree with
+// itself on every return.
+static bool return_to(MayaVerifier* v, size_t rip, size_t site, int64_t returned) {
+    MayaVerifyState* state = &v->states[site];
+    if (state->returns && state->returned != returned)
+        return fail(v, rip, "returns leave different stack depths");
+
+    state->returns = true;
+    state->returned = returned;
+    return flow_return(v, site);
+}
+
+static bool check_register(MayaVerifier* v, size_t rip, uint64_t index) {
+    if (index >= MAYA_REGISTERS_CAP)
+        return fail(v, rip, "register out of range");
+
+    return true;
+}
+
+// pushes past the stack limit fault on the guard page, only underflow is proven here. the frame
+// base is at least state.base, so the absolute depth is at least depth + base.
+static bool check_depth(MayaVerifier* v, size_t rip, const MayaVerifyState* state, int64_t needed) {
+    if (state->depth + (int64_t)state->base < needed)
+        return fail(v, rip, "stack underflow");
+
+    return true;
+}
+
+static bool check_argument(MayaVerifier* v, size_t rip, const MayaVerifyState* state, uint64_t index) {
+    if (state->sites_size == 0 || index >= state->base)
+        return fail(v, rip, "argument out of range");
+
+    return true;
+}
+
+static bool verify_instruction(MayaVerifier* v, size_t rip) {
+    v->states[rip].queued = false;
+    MayaVerifyState state = v->states[rip];
+
+    MayaInstruction instruction;
+    size_t size = maya_decode_instruction(&v->program[rip], &instruction);
+    if (size == 0)
+        return fail(v, rip, "invalid opcode");
+
+    // only the interpreter writes them, after checking the operand itself.
+    if (MAYA_IS_QUICKENED(instruction.opcode))
+        return fail(v, rip, "quickened opcode");
+
+    uint64_t operand = instruction.operands[0].as_u64;
+    size_t next = rip + size;
+
+    switch (instruction.opcode) {
+    case OP_HALT:
+        return true;
+    case OP_PUSH:
+    case OP_PUSH_S:
+        state.depth++;
+        break;
+    case OP_POP:
+        if (!check_depth(v, rip, &state, 1))
+            return false;
+
+        state.depth--;
+        break;
+    case OP_DUP:
+    case OP_DUP_S:
+        if (operand > (uint64_t)INT64_MAX || !check_depth(v, rip, &state, (int64_t)operand))
+            return false;
+
+        state.depth++;
+        break;
+    case OP_IADD:
+    case OP_FADD:
+    case OP_ISUB:
+    case OP_FSUB:
+    case OP_IMUL:
+    case OP_FMUL:
+    case OP_IDIV:
+    case OP_FDIV:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_MOD:
+        if (!check_depth(v, rip, &state, 2))
+            return false;
+
+        state.depth--;
+        break;
+    case OP_JMP:
+        return flow(v, rip, operand, &state);
+    case OP_IJEQ:
+    case OP_FJEQ:
+    case OP_IJNEQ:
+    case OP_FJNEQ:
+    case OP_IJGT:
+    case OP_FJGT:
+    case OP_IJLT:
+    case OP_FJLT:
+        if (!check_depth(v, rip, &state, 2))
+            return false;
+
+        state.depth -= 2;
+        if (!flow(v, rip, operand, &state))
+            return false;
+        break;
+    case OP_CALL: {
+        MayaVerifyState callee = {
+            .depth = 0,
+            .base = (size_t)((int64_t)state.base + state.depth),
+        };
+        add_site(&callee, rip);
+
+        if (!flow(v, rip, operand, &callee))
+            return false;
+
+        // the callee may already be known to return, then this state flows to the return point.
+        return !state.returns || flow_return(v, rip);
+    }
+    case OP_RET:
+    case OP_RETV: {
+        if (state.sites_size == 0)
+            return fail(v, rip, "ret outside of a call");
+
+        int64_t returned = 0;
+        if (instruction.opcode == OP_RETV) {
+            if (!check_depth(v, rip, &state, 1) || operand > state.base)
+                return fail(v, rip, "stack underflow");
+
+            returned = 1 - (int64_t)operand;
+        }
+
+        for (size_t i = 0; i < state.sites_size; i++) {
+            size_t site = state.sites[i];
+
+            // dropped arguments have to belong to the caller's own frame.
+            if (v->states[site].depth + returned < 0)
+                return fail(v, rip, "stack underflow");
+
+            if (!return_to(v, rip, site, returned))
+                return false;
+        }
+
+        return true;
+    }
+    case OP_LOAD_ARG:
+        if (!check_argument(v, rip, &state, operand))
+            return false;
+
+        state.depth++;
+        break;
+    case OP_STORE_ARG:
+        if (!check_depth(v, rip, &state, 1) || !check_argument(v, rip, &state, operand))
+            return false;
+
+        state.depth--;
+        break;
+    case OP_LOAD_LOCAL:
+        if ((int64_t)operand >= state.depth)
+            return fail(v, rip, "local out of range");
+
+        state.depth++;
+        break;
+    case OP_STORE_LOCAL:
+        if (!check_depth(v, rip, &state, 1))
+            return false;
+
+        state.depth--;
+        if ((int64_t)operand >= state.depth)
+            return fail(v, rip, "local out of range");
+        break;
+    case OP_NATIVE: {
+        if (operand >= v->maya->natives_size)
+            return fail(v, rip, "native out of range");
+
+        MayaNativeEffect effect = v->maya->natives_effects[operand];
+
+        if (!check_depth(v, rip, &state, effect.arity) || !check_depth(v, rip, &state, -effect.delta))
+            return false;
+
+        state.depth += effect.delta;
+        break;
+    }
+    case OP_VECTOR: {
+        if (operand >= VEC_COUNT)
+            return fail(v, rip, "vector kernel out of range");
+
+        MayaNativeEffect effect = maya_vector_entries[operand].effect;
+        if (!check_depth(v, rip, &state, effect.arity))
+            return false;
+
+        state.depth += effect.delta;
+        break;
+    }
+    case OP_NATIVE_BATCH: {
+        if (operand >= v->maya->natives_size)
+            return fail(v, rip, "native out of range");
+
+        if (v->maya->natives_batches[operand] == NULL)
+            return fail(v, rip, "native has no batched form");
+
+        int64_t count = (int64_t)instruction.operands[1].as_u64;
+        if (!check_depth(v, rip, &state, count))
+            return false;
+
+        state.depth -= count;
+        break;
+    }
+    case OP_LOAD:
+    case OP_LOAD_S:
+        if (!check_register(v, rip, operand))
+            return false;
+
+        state.depth++;
+        break;
+    case OP_STORE:
+    case OP_STORE_S:
+        if (!check_depth(v, rip, &state, 1) || !check_register(v, rip, operand))
+            return false;
+
+        state.depth--;
+        break;
+    case OP_LOAD_PTR:
+        if (!check_register(v, rip, operand))
+            return false;
+
+        state.depth++;
+        break;
+    case OP_PUSH_PTR:
+    case OP_STORE_PTR:
+        if (!check_depth(v, rip, &state, 1) || !check_register(v, rip, instruction.operands[1].as_u64))
+            return false;
+        break;
+    case OP_IADDI:
+    case OP_ISUBI:
+    case OP_IMULI:
+    case OP_I2F:
+    case OP_F2I:
+        if (!check_depth(v, rip, &state, 1))
+            return false;
+        break;
+    case OP_INC:
+    case OP_DEC:
+        if (!check_register(v, rip, operand))
+            return false;
+        break;
+    case OP_IJLTI:
+        if (!check_register(v, rip, operand) || !flow(v, rip, instruction.operands[2].as_u64, &state))
+            return false;
+        break;
+    default:
+        return fail(v, rip, "invalid opcode");
+    }
+
+    if (next >= v->maya->program_size)
+        return fail(v, rip, "execution runs past the end of the program");
+
+    return flow(v, rip, next, &state);
+}
+
+bool maya_verify_depths(const MayaVm* maya, MayaVerifyError* error, int64_t* depths) {
+    size_t program_size = maya->program_size;
+
+    // superinstructions keep the instructions they replace, so the unfused program describes
+    // every rip the fused one can reach.
+    uint8_t* program = malloc(program_size == 0 ? 1 : program_size);
+    bool* boundaries = calloc(program_size + 1, sizeof(bool));
+    MayaVerifyState* states = calloc(program_size + 1, sizeof(MayaVerifyState));
+    size_t* worklist = malloc(sizeof(size_t) * (program_size + 1));
+    if (!program || !boundaries || !states || !worklist) {
+        // unproven programs still run, on the checked interpreter.
+        if (error)
+            *error = (MayaVerifyError) {.rip = maya->rip, .message = "cannot allocate memory"};
+
+        free(worklist);
+        free(states);
+        free(boundaries);
+        free(program);
+        return false;
+    }
+
+    memcpy(program, maya->program, program_size);
+    maya_unfuse_program(program, program_size);
+
+    for (size_t rip = 0; rip < program_size;) {
+        size_t size = maya_instruction_size(program[rip]);
+        if (size == 0 || rip + size > program_size)
+            break;
+
+        boundaries[rip] = true;
+        rip += size;
+    }
+
+    MayaVerifier v = {
+        .maya = maya,
+        .program = program,
+        .boundaries = boundaries,
+        .states = states,
+        .worklist = worklist,
+    };
+
+    MayaVerifyState entry = {.depth = (int64_t)(maya->sp - maya->bp), .base = maya->bp};
+    bool verified = flow(&v, maya->rip, maya->rip, &entry);
+
+    while (verified && v.worklist_size > 0)
+        verified = verify_instruction(&v, v.worklist[--v.worklist_size]);
+
+    if (!verified && error)
+        *error = v.error;
+
+    for (size_t rip = 0; verified && depths != NULL && rip < program_size; rip++)
+        depths[rip] = states[rip].reached ? states[rip].depth : MAYA_DEPTH_UNREACHED;
+
+    free(worklist);
+    free(states);
+    free(boundaries);
+    free(program);
+
+    return verified;
+}
+
+bool maya_verify_program(const MayaVm* maya, MayaVerifyError* error) {
+    return maya_verify_depths(maya, error, NULL);
+}
@@ -13,9 +13,29 @@ StringView sv_from_cstr(const char* str) {
     };
 }
 
+// delimiters as a 256 bit membership set, so testing a character is a single lookup instead of
+// a strchr over the delimiter string.
+typedef struct DelimSet_t {
+    uint64_t bits[4];
+} DelimSet;
+
+static DelimSet delim_set(const char* delim) {
+    DelimSet set = {0};
+    for (; *delim != 0; delim++)
+        set.bits[(uint8_t)*delim >> 6] |= 1ull << ((uint8_t)*delim & 63);
+
+    return set;
+}
+
+static inline bool delim_has(const DelimSet* set, char c) {
+    return (set->bits[(uint8_t)c >> 6] >> ((uint8_t)c & 63)) & 1;
+}
+
 StringView sv_strip_by_delim(StringView sv, const char* delim) {
+    DelimSet set = delim_set(delim);
+
     const char* ptr = sv.str;
-    while (sv.len != 0 && strchr(delim, *ptr) != NULL) {
+    while (sv.len != 0 && delim_has(&set, *ptr)) {
         ptr++;
         sv.len--;
     }
@@ -31,12 +51,20 @@ StringView sv_chop_by_delim(StringView* sv, const char* delim) {
 
     const char* start = sv->str;
     size_t len = 0;
-    while (sv->len != 0 && strchr(delim, *sv->str) == NULL) {
-        len++;
-        sv->str++;
-        sv->len--;
+
+    if (delim[0] != 0 && delim[1] == 0) {
+        // a single delimiter is found with memchr, which scans a word or a vector at a time.
+        const char* end = memchr(start, delim[0], sv->len);
+        len = end != NULL ? (size_t)(end - start) : sv->len;
+    } else {
+        DelimSet set = delim_set(delim);
+        while (len != sv->len && !delim_has(&set, start[len]))
+            len++;
     }
 
+    sv->str += len;
+    sv->len -= len;
+
     return (StringView) {
         .str = start,
         .len = len,
@@ -79,3 +107,14 @@ bool sv_equals(StringView lhs, StringView rhs) {
 
     return true;
 }
+
+// 64 bit FNV-1a.
+uint64_t sv_hash(StringView sv) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < sv.len; i++) {
+        hash ^= (uint8_t)sv.str[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
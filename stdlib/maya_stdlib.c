@@ -1,57 +1,277 @@
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "maya.h"
 
-MayaError maya_alloc(MayaVm* maya) {
-    if (maya->sp < 1)
-        return ERR_STACK_UNDERFLOW;
+// the vm checks the declared arity before calling a native, see maya_natives below.
 
-    maya->stack[maya->sp - 1].as_ptr = malloc(maya->stack[maya->sp - 1].as_u64);
+// with -r the vm hands alloc its own arena, released with the vm, and free has nothing to do.
+MayaError maya_alloc(MayaVm* maya) {
+    size_t size = maya->stack[maya->sp - 1].as_u64;
+    maya->stack[maya->sp - 1].as_ptr = maya->arena != NULL ? maya_arena_alloc(maya->arena, size) : malloc(size);
     return ERR_OK;
 }
 
 MayaError maya_free(MayaVm* maya) {
-    if (maya->sp < 1)
-        return ERR_STACK_UNDERFLOW;
+    if (maya->arena == NULL)
+        free(maya->stack[maya->sp - 1].as_ptr);
 
-    free(maya->stack[maya->sp - 1].as_ptr);
     maya->sp--;
     return ERR_OK;
 }
 
 MayaError maya_print_f64(MayaVm* maya) {
-    if (maya->sp < 1)
-        return ERR_STACK_UNDERFLOW;
-
-    printf("%lf\n", maya->stack[maya->sp - 1].as_f64);
+    maya_output_f64(&maya->output, maya->stack[maya->sp - 1].as_f64);
     maya->sp--;
     return ERR_OK;
 }
 
 MayaError maya_print_i64(MayaVm* maya) {
-    if (maya->sp < 1)
-        return ERR_STACK_UNDERFLOW;
-
-    printf("%ld\n", maya->stack[maya->sp - 1].as_i64);
+    maya_output_i64(&maya->output, maya->stack[maya->sp - 1].as_i64);
     maya->sp--;
     return ERR_OK;
 }
 
 MayaError maya_print_str(MayaVm* maya) {
-    if (maya->sp < 1)
-        return ERR_STACK_UNDERFLOW;
-
-    printf("%s\n", (char*)maya->stack[maya->sp - 1].as_ptr);
+    maya_output_str(&maya->output, maya->stack[maya->sp - 1].as_ptr);
     maya->sp--;
     return ERR_OK;
 }
 
 MayaError maya_print_ptr(MayaVm* maya) {
-    if (maya->sp < 1)
-        return ERR_STACK_UNDERFLOW;
+    maya_output_ptr(&maya->output, maya->stack[maya->sp - 1].as_ptr);
+    maya->sp--;
+    return ERR_OK;
+}
+
+// writes out what the print natives buffered so far.
+MayaError maya_flush(MayaVm* maya) {
+    maya_output_flush(&maya->output);
+    return ERR_OK;
+}
+
+// arenas and pools, for short lived buffers that would otherwise go through malloc one by one.
+
+// chunk_size -> arena, 0 picks the default chunk size
+MayaError maya_arena_create_native(MayaVm* maya) {
+    maya->stack[maya->sp - 1].as_ptr = maya_arena_create(maya->stack[maya->sp - 1].as_u64);
+    return ERR_OK;
+}
+
+// arena size -> ptr
+MayaError maya_arena_alloc_native(MayaVm* maya) {
+    maya->stack[maya->sp - 2].as_ptr = maya_arena_alloc(maya->stack[maya->sp - 2].as_ptr, maya->stack[maya->sp - 1].as_u64);
+    maya->sp--;
+    return ERR_OK;
+}
+
+// arena ->
+MayaError maya_arena_reset_native(MayaVm* maya) {
+    maya_arena_reset(maya->stack[maya->sp - 1].as_ptr);
+    maya->sp--;
+    return ERR_OK;
+}
+
+// arena ->
+MayaError maya_arena_destroy_native(MayaVm* maya) {
+    maya_arena_destroy(maya->stack[maya->sp - 1].as_ptr);
+    maya->sp--;
+    return ERR_OK;
+}
+
+// block_size -> pool
+MayaError maya_pool_create_native(MayaVm* maya) {
+    maya->stack[maya->sp - 1].as_ptr = maya_pool_create(maya->stack[maya->sp - 1].as_u64);
+    return ERR_OK;
+}
+
+// pool -> ptr
+MayaError maya_pool_alloc_native(MayaVm* maya) {
+    maya->stack[maya->sp - 1].as_ptr = maya_pool_alloc(maya->stack[maya->sp - 1].as_ptr);
+    return ERR_OK;
+}
 
-    printf("%p\n", maya->stack[maya->sp - 1].as_ptr);
+// pool ptr ->
+MayaError maya_pool_free_native(MayaVm* maya) {
+    maya_pool_free(maya->stack[maya->sp - 2].as_ptr, maya->stack[maya->sp - 1].as_ptr);
+    maya->sp -= 2;
+    return ERR_OK;
+}
+
+// pool ->
+MayaError maya_pool_destroy_native(MayaVm* maya) {
+    maya_pool_destroy(maya->stack[maya->sp - 1].as_ptr);
     maya->sp--;
     return ERR_OK;
 }
+
+// garbage collected allocations, never freed by hand. the heap is created on first use.
+
+// size -> ptr, zeroed
+MayaError maya_gc_alloc(MayaVm* maya) {
+    if (maya->heap == NULL)
+        maya->heap = maya_heap_create();
+
+    // out of memory gives a null pointer, like alloc.
+    maya->stack[maya->sp - 1].as_ptr = maya->heap != NULL ? maya_heap_alloc(maya->heap, maya, maya->stack[maya->sp - 1].as_u64) : NULL;
+    return ERR_OK;
+}
+
+// runs a whole collection now.
+MayaError maya_gc_collect(MayaVm* maya) {
+    if (maya->heap != NULL)
+        maya_heap_collect(maya->heap, maya);
+
+    return ERR_OK;
+}
+
+// reports collections and pause times on stderr.
+MayaError maya_gc_report(MayaVm* maya) {
+    if (maya->heap != NULL)
+        maya_heap_report(maya->heap);
+
+    return ERR_OK;
+}
+
+// batched forms of the natives above, called once for a whole slice of the stack.
+static MayaError maya_free_batch(MayaVm* maya, Frame* values, size_t count) {
+    if (maya->arena != NULL)
+        return ERR_OK;
+
+    for (size_t i = 0; i < count; i++)
+        free(values[i].as_ptr);
+
+    return ERR_OK;
+}
+
+static MayaError maya_print_f64_batch(MayaVm* maya, Frame* values, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        maya_output_f64(&maya->output, values[i].as_f64);
+
+    return ERR_OK;
+}
+
+static MayaError maya_print_i64_batch(MayaVm* maya, Frame* values, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        maya_output_i64(&maya->output, values[i].as_i64);
+
+    return ERR_OK;
+}
+
+static MayaError maya_print_str_batch(MayaVm* maya, Frame* values, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        maya_output_str(&maya->output, values[i].as_ptr);
+
+    return ERR_OK;
+}
+
+static MayaError maya_print_ptr_batch(MayaVm* maya, Frame* values, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        maya_output_ptr(&maya->output, values[i].as_ptr);
+
+    return ERR_OK;
+}
+
+// bulk natives over memory: a pointer and a count of 64 bit elements (bytes for memset and
+// memcpy) on top of the stack, so a whole array is handled without going back to the loop.
+
+// ptr count -> sum
+MayaError maya_sum_i64(MayaVm* maya) {
+    const int64_t* values = maya->stack[maya->sp - 2].as_ptr;
+    uint64_t count = maya->stack[maya->sp - 1].as_u64;
+
+    int64_t sum = 0;
+    for (uint64_t i = 0; i < count; i++)
+        sum += values[i];
+
+    maya->stack[maya->sp - 2].as_i64 = sum;
+    maya->sp--;
+    return ERR_OK;
+}
+
+// ptr count -> sum
+MayaError maya_sum_f64(MayaVm* maya) {
+    const double* values = maya->stack[maya->sp - 2].as_ptr;
+    uint64_t count = maya->stack[maya->sp - 1].as_u64;
+
+    double sum = 0.0;
+    for (uint64_t i = 0; i < count; i++)
+        sum += values[i];
+
+    maya->stack[maya->sp - 2].as_f64 = sum;
+    maya->sp--;
+    return ERR_OK;
+}
+
+// ptr count -> min, 0 for an empty array
+MayaError maya_min_i64(MayaVm* maya) {
+    const int64_t* values = maya->stack[maya->sp - 2].as_ptr;
+    uint64_t count = maya->stack[maya->sp - 1].as_u64;
+
+    int64_t min = count > 0 ? values[0] : 0;
+    for (uint64_t i = 1; i < count; i++)
+        min = values[i] < min ? values[i] : min;
+
+    maya->stack[maya->sp - 2].as_i64 = min;
+    maya->sp--;
+    return ERR_OK;
+}
+
+// ptr count -> max, 0 for an empty array
+MayaError maya_max_i64(MayaVm* maya) {
+    const int64_t* values = maya->stack[maya->sp - 2].as_ptr;
+    uint64_t count = maya->stack[maya->sp - 1].as_u64;
+
+    int64_t max = count > 0 ? values[0] : 0;
+    for (uint64_t i = 1; i < count; i++)
+        max = values[i] > max ? values[i] : max;
+
+    maya->stack[maya->sp - 2].as_i64 = max;
+    maya->sp--;
+    return ERR_OK;
+}
+
+// ptr byte count ->
+MayaError maya_memset(MayaVm* maya) {
+    memset(maya->stack[maya->sp - 3].as_ptr, (int)maya->stack[maya->sp - 2].as_u64, maya->stack[maya->sp - 1].as_u64);
+    maya->sp -= 3;
+    return ERR_OK;
+}
+
+// dst src count ->
+MayaError maya_memcpy(MayaVm* maya) {
+    memmove(maya->stack[maya->sp - 3].as_ptr, maya->stack[maya->sp - 2].as_ptr, maya->stack[maya->sp - 1].as_u64);
+    if (maya->heap != NULL)
+        maya_heap_barrier_range(maya->heap, maya->stack[maya->sp - 3].as_ptr, maya->stack[maya->sp - 1].as_u64);
+
+    maya->sp -= 3;
+    return ERR_OK;
+}
+
+const MayaNativeEntry maya_natives[] = {
+    {"alloc", maya_alloc, {.arity = 1, .delta = 0}, NULL},
+    {"free", maya_free, {.arity = 1, .delta = -1}, maya_free_batch},
+    {"print_f64", maya_print_f64, {.arity = 1, .delta = -1}, maya_print_f64_batch},
+    {"print_i64", maya_print_i64, {.arity = 1, .delta = -1}, maya_print_i64_batch},
+    {"print_str", maya_print_str, {.arity = 1, .delta = -1}, maya_print_str_batch},
+    {"print_ptr", maya_print_ptr, {.arity = 1, .delta = -1}, maya_print_ptr_batch},
+    {"sum_i64", maya_sum_i64, {.arity = 2, .delta = -1}, NULL},
+    {"sum_f64", maya_sum_f64, {.arity = 2, .delta = -1}, NULL},
+    {"min_i64", maya_min_i64, {.arity = 2, .delta = -1}, NULL},
+    {"max_i64", maya_max_i64, {.arity = 2, .delta = -1}, NULL},
+    {"memset", maya_memset, {.arity = 3, .delta = -3}, NULL},
+    {"memcpy", maya_memcpy, {.arity = 3, .delta = -3}, NULL},
+    {"flush", maya_flush, {.arity = 0, .delta = 0}, NULL},
+    {"arena_create", maya_arena_create_native, {.arity = 1, .delta = 0}, NULL},
+    {"arena_alloc", maya_arena_alloc_native, {.arity = 2, .delta = -1}, NULL},
+    {"arena_reset", maya_arena_reset_native, {.arity = 1, .delta = -1}, NULL},
+    {"arena_destroy", maya_arena_destroy_native, {.arity = 1, .delta = -1}, NULL},
+    {"pool_create", maya_pool_create_native, {.arity = 1, .delta = 0}, NULL},
+    {"pool_alloc", maya_pool_alloc_native, {.arity = 1, .delta = 0}, NULL},
+    {"pool_free", maya_pool_free_native, {.arity = 2, .delta = -2}, NULL},
+    {"pool_destroy", maya_pool_destroy_native, {.arity = 1, .delta = -1}, NULL},
+    {"gc_alloc", maya_gc_alloc, {.arity = 1, .delta = 0}, NULL},
+    {"gc_collect", maya_gc_collect, {.arity = 0, .delta = 0}, NULL},
+    {"gc_report", maya_gc_report, {.arity = 0, .delta = 0}, NULL},
+    {NULL, NULL, {0}, NULL},
+};